@@ -0,0 +1,641 @@
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include <json-c/json.h>
+#include <archive.h>
+#include <archive_entry.h>
+#include <zlib.h>
+
+#include "aur.h"
+#include "build.h"
+#include "config.h"
+#include "index.h"
+#include "jsonstream.h"
+#include "mock_server.h"
+#include "results.h"
+#include "search.h"
+#include "snapshot.h"
+#include "util.h"
+#include "vercmp.h"
+
+#define BENCH_QUERY "bench"
+#define BENCH_INSTALLED_VERSION "1.0-1"
+#define BENCH_OUTDATED_EVERY 10
+#define BENCH_PARSE_CHUNK (64 * 1024)
+#define BENCH_SNAPSHOT_FILE (1024 * 1024)
+
+typedef struct {
+    int iterations;
+    int latency_ms;
+    long bandwidth;              // bytes per second, 0 = unlimited
+    int results;                 // synthetic AUR search hits
+    int packages;                // installed AUR packages for the upgrade check
+    int snapshot_mib;            // unpacked size of the synthetic snapshot
+    const char *fixture_dir;
+} BenchOptions;
+
+typedef struct {
+    double *ms;
+    int count;
+} Samples;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const Samples *samples, double p) {
+    int index = (int)ceil(p * samples->count) - 1;
+    if (index < 0) index = 0;
+    if (index >= samples->count) index = samples->count - 1;
+    return samples->ms[index];
+}
+
+// One line of the report; throughput is derived from the median run
+static void report(const char *label, Samples *samples, double bytes, double items, const char *item_unit) {
+    char rate[64] = "";
+
+    if (samples->count == 0) {
+        printf("%-40s failed\n", label);
+        return;
+    }
+
+    qsort(samples->ms, samples->count, sizeof(double), compare_double);
+    double median = percentile(samples, 0.5);
+
+    if (median > 0 && bytes > 0) {
+        snprintf(rate, sizeof(rate), "%8.1f MB/s", bytes / 1e6 / (median / 1000.0));
+    } else if (median > 0 && items > 0) {
+        snprintf(rate, sizeof(rate), "%8.0f %s/s", items / (median / 1000.0), item_unit);
+    }
+
+    printf("%-40s %4d %9.2f %9.2f %9.2f  %s\n", label, samples->count,
+           samples->ms[0], median, percentile(samples, 0.95), rate);
+}
+
+static int body_append(MockBody *body, const void *data, size_t size) {
+    char *grown = realloc(body->data, body->size + size + 1);
+    if (!grown) return 1;
+
+    memcpy(grown + body->size, data, size);
+    body->data = grown;
+    body->size += size;
+    body->data[body->size] = '\0';
+    return 0;
+}
+
+static int body_from_json(MockBody *body, struct json_object *root) {
+    const char *text = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+    int status = body_append(body, text, strlen(text));
+    json_object_put(root);
+    return status;
+}
+
+// A recorded response from the fixture directory, if there is one
+static int load_fixture(const char *dir, const char *name, MockBody *body) {
+    char path[PATH_MAX];
+    char buffer[BENCH_PARSE_CHUNK];
+    size_t read;
+
+    if (dir == NULL) return 1;
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return 1;
+
+    while ((read = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        if (body_append(body, buffer, read) != 0) {
+            fclose(fp);
+            return 1;
+        }
+    }
+
+    fclose(fp);
+    printf("Using recorded %s\n", path);
+    return 0;
+}
+
+static int generate_search(MockBody *body, int count) {
+    struct json_object *root = json_object_new_object();
+    struct json_object *results = json_object_new_array();
+    char text[128];
+
+    for (int i = 0; i < count; i++) {
+        struct json_object *package = json_object_new_object();
+
+        snprintf(text, sizeof(text), "%s-%d", BENCH_QUERY, i);
+        json_object_object_add(package, "Name", json_object_new_string(text));
+        json_object_object_add(package, "PackageBase", json_object_new_string(text));
+        snprintf(text, sizeof(text), "%d.%d-1", i % 7, i % 13);
+        json_object_object_add(package, "Version", json_object_new_string(text));
+        json_object_object_add(package, "Description",
+                               json_object_new_string("Synthetic package \"for\" benchmarking {search} [parsing]"));
+        snprintf(text, sizeof(text), "maintainer%d", i % 97);
+        json_object_object_add(package, "Maintainer", json_object_new_string(text));
+        json_object_object_add(package, "URL", json_object_new_string("https://example.org/"));
+        json_object_object_add(package, "NumVotes", json_object_new_int(i % 500));
+        json_object_object_add(package, "Popularity", json_object_new_double((i % 100) / 10.0));
+        json_object_array_add(results, package);
+    }
+
+    json_object_object_add(root, "resultcount", json_object_new_int(count));
+    json_object_object_add(root, "results", results);
+    json_object_object_add(root, "type", json_object_new_string("search"));
+    json_object_object_add(root, "version", json_object_new_int(5));
+    return body_from_json(body, root);
+}
+
+// The metadata dump: the search hits as a gzipped top-level array
+static int generate_dump(MockBody *body, const MockBody *search) {
+    struct json_object *root = json_tokener_parse(search->data);
+    struct json_object *results;
+    unsigned char out[BENCH_PARSE_CHUNK];
+    z_stream zs;
+    int ret = Z_OK;
+
+    if (root == NULL || !json_object_object_get_ex(root, "results", &results)) {
+        json_object_put(root);
+        return 1;
+    }
+
+    const char *text = json_object_to_json_string_ext(results, JSON_C_TO_STRING_PLAIN);
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        json_object_put(root);
+        return 1;
+    }
+
+    zs.next_in = (unsigned char *)text;
+    zs.avail_in = (uInt)strlen(text);
+    while (ret != Z_STREAM_END) {
+        zs.next_out = out;
+        zs.avail_out = sizeof(out);
+        ret = deflate(&zs, Z_FINISH);
+        if ((ret != Z_OK && ret != Z_STREAM_END) || body_append(body, out, sizeof(out) - zs.avail_out) != 0) {
+            ret = Z_STREAM_ERROR;
+            break;
+        }
+    }
+
+    deflateEnd(&zs);
+    json_object_put(root);
+    return ret != Z_STREAM_END;
+}
+
+static int generate_arch(MockBody *body) {
+    struct json_object *root = json_object_new_object();
+    struct json_object *results = json_object_new_array();
+    char name[64];
+
+    for (int i = 0; i < 50; i++) {
+        struct json_object *package = json_object_new_object();
+
+        snprintf(name, sizeof(name), "%s-%s-%d", BENCH_QUERY, i % 2 ? "extra" : "core", i);
+        json_object_object_add(package, "pkgname", json_object_new_string(name));
+        json_object_object_add(package, "pkgver", json_object_new_string("1.0"));
+        json_object_object_add(package, "pkgdesc", json_object_new_string("Synthetic repository package"));
+        json_object_object_add(package, "repo", json_object_new_string(i % 2 ? "extra" : "core"));
+        json_object_object_add(package, "url", json_object_new_string("https://example.org/"));
+        json_object_array_add(results, package);
+    }
+
+    json_object_object_add(root, "version", json_object_new_int(2));
+    json_object_object_add(root, "limit", json_object_new_int(250));
+    json_object_object_add(root, "valid", json_object_new_boolean(1));
+    json_object_object_add(root, "results", results);
+    return body_from_json(body, root);
+}
+
+static ssize_t snapshot_write(struct archive *archive, void *userdata, const void *data, size_t size) {
+    (void)archive;
+    return body_append((MockBody *)userdata, data, size) == 0 ? (ssize_t)size : -1;
+}
+
+static int add_snapshot_file(struct archive *writer, const char *path, const char *data, size_t size) {
+    struct archive_entry *entry = archive_entry_new();
+
+    archive_entry_set_pathname(entry, path);
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    archive_entry_set_size(entry, size);
+
+    int failed = archive_write_header(writer, entry) != ARCHIVE_OK ||
+                 archive_write_data(writer, data, size) != (ssize_t)size;
+    archive_entry_free(entry);
+    return failed;
+}
+
+// A cgit-style snapshot: a top-level directory holding the recipe plus
+// mib MiB of text that compresses about as well as real sources do
+static int generate_snapshot(MockBody *body, int mib) {
+    static const char *words[] = { "static", "int", "return", "struct", "void", "const", "char",
+                                   "if", "else", "for", "while", "size_t", "NULL", "0", "1", "{", "}" };
+    struct archive *writer = archive_write_new();
+    char *text = malloc(BENCH_SNAPSHOT_FILE);
+    char path[64];
+    unsigned int seed = 1;
+    int failed = 0;
+
+    if (!writer || !text ||
+        archive_write_add_filter_gzip(writer) != ARCHIVE_OK ||
+        archive_write_set_format_pax_restricted(writer) != ARCHIVE_OK ||
+        archive_write_open(writer, body, NULL, snapshot_write, NULL) != ARCHIVE_OK) {
+        fprintf(stderr, "Error: Failed to create snapshot archive\n");
+        if (writer) archive_write_free(writer);
+        free(text);
+        return 1;
+    }
+
+    const char *pkgbuild = "pkgname=" BENCH_QUERY "\npkgver=1.0\npkgrel=1\narch=(any)\n";
+    const char *srcinfo = "pkgbase = " BENCH_QUERY "\n\tpkgver = 1.0\n\tpkgrel = 1\n\narch = any\npkgname = " BENCH_QUERY "\n";
+    failed |= add_snapshot_file(writer, BENCH_QUERY "/PKGBUILD", pkgbuild, strlen(pkgbuild));
+    failed |= add_snapshot_file(writer, BENCH_QUERY "/.SRCINFO", srcinfo, strlen(srcinfo));
+
+    for (int i = 0; i < mib && !failed; i++) {
+        size_t used = 0;
+        while (used < BENCH_SNAPSHOT_FILE) {
+            seed = seed * 1103515245 + 12345;
+            const char *word = words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+            size_t length = strlen(word);
+            if (used + length + 1 > BENCH_SNAPSHOT_FILE) break;
+            memcpy(text + used, word, length);
+            used += length;
+            text[used++] = (seed >> 8) % 11 == 0 ? '\n' : ' ';
+        }
+
+        snprintf(path, sizeof(path), "%s/src/file%03d.c", BENCH_QUERY, i);
+        failed |= add_snapshot_file(writer, path, text, used);
+    }
+
+    failed |= archive_write_close(writer) != ARCHIVE_OK;
+    archive_write_free(writer);
+    free(text);
+
+    if (failed) fprintf(stderr, "Error: Failed to create snapshot archive\n");
+    return failed;
+}
+
+// Search both backends and rank the first page, as the CLI does
+static void bench_search(const BenchOptions *options, Samples *samples, int *hits) {
+    for (int i = 0; i < options->iterations; i++) {
+        ResultSet set;
+        double start = now_ms();
+
+        if (search_packages(BENCH_QUERY, &set) != 0) continue;
+        for (int rank = 0; rank < SEARCH_PAGE_SIZE; rank++) result_set_get(&set, rank);
+        samples->ms[samples->count++] = now_ms() - start;
+
+        *hits = set.count;
+        result_set_free(&set);
+    }
+}
+
+static int count_element(struct json_object *element, void *userdata) {
+    (void)element;
+    (*(int *)userdata)++;
+    return 0;
+}
+
+// Feed the search body through the streaming parser in network-sized
+// chunks; no network is involved
+static void bench_parse_stream(const BenchOptions *options, const MockBody *body, Samples *samples, int *elements) {
+    for (int i = 0; i < options->iterations; i++) {
+        JsonStream stream;
+        int count = 0;
+        double start = now_ms();
+
+        if (json_stream_init(&stream, "results", count_element, &count) != 0) return;
+        for (size_t offset = 0; offset < body->size && !stream.done; offset += BENCH_PARSE_CHUNK) {
+            size_t length = body->size - offset < BENCH_PARSE_CHUNK ? body->size - offset : BENCH_PARSE_CHUNK;
+            if (json_stream_feed(&stream, body->data + offset, length) != 0) break;
+        }
+        int failed = stream.failed;
+        json_stream_free(&stream);
+        if (failed) return;
+
+        samples->ms[samples->count++] = now_ms() - start;
+        *elements = count;
+    }
+}
+
+static void bench_parse_tree(const BenchOptions *options, const MockBody *body, Samples *samples) {
+    for (int i = 0; i < options->iterations; i++) {
+        double start = now_ms();
+
+        struct json_object *root = json_tokener_parse(body->data);
+        if (root == NULL) return;
+        json_object_put(root);
+
+        samples->ms[samples->count++] = now_ms() - start;
+    }
+}
+
+// The AUR half of -Ufull: batched info queries, then a version
+// comparison per installed package
+static void bench_upgrade_check(const BenchOptions *options, Samples *samples, int *outdated) {
+    const char **names = calloc(options->packages, sizeof(char *));
+    char *storage = calloc(options->packages, 32);
+
+    if (!names || !storage) {
+        free(names);
+        free(storage);
+        return;
+    }
+    for (int i = 0; i < options->packages; i++) {
+        names[i] = storage + i * 32;
+        snprintf(storage + i * 32, 32, "%s-pkg-%05d", BENCH_QUERY, i);
+    }
+
+    for (int i = 0; i < options->iterations; i++) {
+        AurInfo *info = NULL;
+        int info_count = 0;
+        int count = 0;
+        double start = now_ms();
+
+        int failed = aur_info_query(names, options->packages, &info, &info_count);
+        for (int j = 0; j < options->packages && !failed; j++) {
+            const AurInfo *remote = aur_info_find(info, info_count, names[j]);
+            if (remote && vercmp(remote->version, BENCH_INSTALLED_VERSION) > 0) count++;
+        }
+        double elapsed = now_ms() - start;
+
+        free_aur_info(info, info_count);
+        if (failed || info_count != options->packages) continue;
+
+        samples->ms[samples->count++] = elapsed;
+        *outdated = count;
+    }
+
+    free(names);
+    free(storage);
+}
+
+static void bench_snapshot(const BenchOptions *options, const char *work_dir, Samples *samples) {
+    char url[PATH_MAX];
+    char dest[PATH_MAX];
+
+    snprintf(url, sizeof(url), "%s%s%s.tar.gz", config.aur_url, AUR_SNAPSHOT_PATH, BENCH_QUERY);
+
+    for (int i = 0; i < options->iterations; i++) {
+        snprintf(dest, sizeof(dest), "%s/snapshot-%d", work_dir, i);
+        if (mkdir_p(dest, 0755) != 0) return;
+
+        double start = now_ms();
+        int status = snapshot_extract(url, dest);
+        double elapsed = now_ms() - start;
+
+        char *argv[] = { "rm", "-rf", dest, NULL };
+        run_command(argv, NULL);
+        if (status != 0) continue;
+
+        samples->ms[samples->count++] = elapsed;
+    }
+}
+
+// index_sync() reports its progress, which would break up the table
+static int quiet_index_sync(const char *url) {
+    fflush(stdout);
+    fflush(stderr);
+    int saved_out = dup(STDOUT_FILENO), saved_err = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+    }
+
+    int status = index_sync(url);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+    return status;
+}
+
+static int indexed_packages(void) {
+    PackageIndex index;
+    if (index_open(&index) != 0) return -1;
+
+    int count = (int)index.header->package_count;
+    index_close(&index);
+    return count;
+}
+
+static void bench_index_sync(const BenchOptions *options, Samples *samples, int *packages) {
+    char url[PATH_MAX];
+    char path[PATH_MAX];
+
+    snprintf(url, sizeof(url), "%s%s", config.aur_url, AUR_META_DUMP_PATH);
+    if (index_path(path, sizeof(path)) != 0) return;
+
+    for (int i = 0; i < options->iterations; i++) {
+        // An index built from the same dump would be kept as it is
+        unlink(path);
+
+        double start = now_ms();
+        int status = quiet_index_sync(url);
+        double elapsed = now_ms() - start;
+        if (status != 0) continue;
+
+        samples->ms[samples->count++] = elapsed;
+    }
+    *packages = indexed_packages();
+}
+
+// A dump cut short must be refused, and the index built before it kept
+static int check_truncated_dump(int packages) {
+    char url[PATH_MAX];
+
+    snprintf(url, sizeof(url), "%s%s%s", config.aur_url, MOCK_TRUNCATED_PREFIX, AUR_META_DUMP_PATH);
+    if (packages < 0) {
+        fprintf(stderr, "Error: No index was built from the metadata dump\n");
+        return 1;
+    }
+    if (quiet_index_sync(url) == 0) {
+        fprintf(stderr, "Error: A truncated metadata dump was accepted\n");
+        return 1;
+    }
+    if (indexed_packages() != packages) {
+        fprintf(stderr, "Error: A truncated metadata dump replaced the index\n");
+        return 1;
+    }
+
+    printf("%-40s %s\n", "index sync, truncated dump", "rejected");
+    return 0;
+}
+
+static void print_usage(void) {
+    printf("Usage: methaur_bench [options]\n");
+    printf("Options:\n");
+    printf("  --iterations N      Runs per benchmark (default 10)\n");
+    printf("  --latency MS        Mock server delay before each response (default 0)\n");
+    printf("  --bandwidth KIB     Mock server rate per connection in KiB/s (default unlimited)\n");
+    printf("  --results N         AUR search hits to serve (default 5000)\n");
+    printf("  --packages N        Installed AUR packages for the upgrade check (default 1000)\n");
+    printf("  --snapshot-size MIB Unpacked size of the snapshot tarball (default 8)\n");
+    printf("  --fixtures DIR      Serve recorded search.json, arch.json, snapshot.tar.gz and\n");
+    printf("                      packages-meta-ext-v1.json.gz from DIR\n");
+    printf("  -h, --help          Show this help message\n");
+}
+
+static int parse_options(int argc, char *argv[], BenchOptions *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *option = argv[i];
+        if (strcmp(option, "-h") == 0 || strcmp(option, "--help") == 0) {
+            print_usage();
+            exit(0);
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: Unknown option or missing value: %s\n", option);
+            return 1;
+        }
+
+        const char *value = argv[++i];
+        long number = atol(value);
+        if (strcmp(option, "--fixtures") == 0) {
+            options->fixture_dir = value;
+        } else if (number < 0) {
+            fprintf(stderr, "Error: Invalid value for %s: %s\n", option, value);
+            return 1;
+        } else if (strcmp(option, "--iterations") == 0) {
+            options->iterations = (int)number;
+        } else if (strcmp(option, "--latency") == 0) {
+            options->latency_ms = (int)number;
+        } else if (strcmp(option, "--bandwidth") == 0) {
+            options->bandwidth = number * 1024;
+        } else if (strcmp(option, "--results") == 0) {
+            options->results = (int)number;
+        } else if (strcmp(option, "--packages") == 0) {
+            options->packages = (int)number;
+        } else if (strcmp(option, "--snapshot-size") == 0) {
+            options->snapshot_mib = (int)number;
+        } else {
+            fprintf(stderr, "Error: Unknown option: %s\n", option);
+            return 1;
+        }
+    }
+
+    if (options->iterations < 1) options->iterations = 1;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = { 10, 0, 0, 5000, 1000, 8, NULL };
+    MockServer server;
+    char work_dir[] = "/tmp/methaur-bench.XXXXXX";
+    char label[128];
+    int hits = 0, elements = 0, outdated = 0, packages = -1;
+    int status = 0;
+
+    if (parse_options(argc, argv, &options) != 0) return 1;
+
+    memset(&server, 0, sizeof(server));
+    server.latency_ms = options.latency_ms;
+    server.bandwidth = options.bandwidth;
+    server.installed_version = BENCH_INSTALLED_VERSION;
+    server.info_outdated_every = BENCH_OUTDATED_EVERY;
+
+    if ((load_fixture(options.fixture_dir, "search.json", &server.search) != 0 &&
+         generate_search(&server.search, options.results) != 0) ||
+        (load_fixture(options.fixture_dir, "arch.json", &server.arch) != 0 &&
+         generate_arch(&server.arch) != 0) ||
+        (load_fixture(options.fixture_dir, "snapshot.tar.gz", &server.snapshot) != 0 &&
+         generate_snapshot(&server.snapshot, options.snapshot_mib) != 0) ||
+        (load_fixture(options.fixture_dir, "packages-meta-ext-v1.json.gz", &server.dump) != 0 &&
+         generate_dump(&server.dump, &server.search) != 0)) {
+        return 1;
+    }
+
+    if (mkdtemp(work_dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    if (mock_server_start(&server) != 0) {
+        curl_global_cleanup();
+        return 1;
+    }
+
+    // Everything methaur fetches now goes to the mock server, and the
+    // response cache starts empty and is never fresh
+    load_config();
+    snprintf(config.cache_dir, sizeof(config.cache_dir), "%s/cache", work_dir);
+    snprintf(config.aur_url, sizeof(config.aur_url), "http://127.0.0.1:%d", server.port);
+    snprintf(config.arch_url, sizeof(config.arch_url), "http://127.0.0.1:%d", server.port);
+    config.cache_ttl = 0;
+
+    printf("Mock server on 127.0.0.1:%d, latency %d ms, bandwidth ", server.port, options.latency_ms);
+    if (options.bandwidth > 0) {
+        printf("%ld KiB/s\n\n", options.bandwidth / 1024);
+    } else {
+        printf("unlimited\n\n");
+    }
+    printf("%-40s %4s %9s %9s %9s  %s\n", "benchmark", "runs", "min ms", "median", "p95", "throughput");
+
+    Samples samples = { calloc(options.iterations, sizeof(double)), 0 };
+    if (samples.ms == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+
+    bench_search(&options, &samples, &hits);
+    snprintf(label, sizeof(label), "search, end to end (%d hits)", hits);
+    report(label, &samples, 0, 0, NULL);
+
+    samples.count = 0;
+    bench_parse_stream(&options, &server.search, &samples, &elements);
+    snprintf(label, sizeof(label), "json parse, streamed (%d records)", elements);
+    report(label, &samples, server.search.size, 0, NULL);
+
+    samples.count = 0;
+    bench_parse_tree(&options, &server.search, &samples);
+    snprintf(label, sizeof(label), "json parse, full tree (%.0f KB)", server.search.size / 1e3);
+    report(label, &samples, server.search.size, 0, NULL);
+
+    samples.count = 0;
+    bench_upgrade_check(&options, &samples, &outdated);
+    snprintf(label, sizeof(label), "upgrade check (%d pkgs, %d outdated)", options.packages, outdated);
+    report(label, &samples, 0, options.packages, "pkgs");
+
+    samples.count = 0;
+    bench_snapshot(&options, work_dir, &samples);
+    snprintf(label, sizeof(label), "snapshot fetch+extract (%.1f MB)", server.snapshot.size / 1e6);
+    report(label, &samples, server.snapshot.size, 0, NULL);
+
+    samples.count = 0;
+    bench_index_sync(&options, &samples, &packages);
+    snprintf(label, sizeof(label), "index sync (%d pkgs)", packages);
+    report(label, &samples, server.dump.size, packages, "pkgs");
+    status = check_truncated_dump(packages);
+
+    free(samples.ms);
+    mock_server_stop(&server);
+    curl_global_cleanup();
+
+    char *rm_argv[] = { "rm", "-rf", work_dir, NULL };
+    run_command(rm_argv, NULL);
+
+    free(server.search.data);
+    free(server.arch.data);
+    free(server.snapshot.data);
+    free(server.dump.data);
+    return status;
+}
@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <json-c/json.h>
+
+#include "index.h"
+#include "mock_server.h"
+
+typedef struct {
+    MockServer *server;
+    int fd;
+} MockConnection;
+
+static void sleep_until(const struct timespec *deadline) {
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR);
+}
+
+static int send_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return 0;
+}
+
+// Pace the body so that it never runs ahead of the configured rate
+static int send_throttled(const MockServer *server, int fd, const char *data, size_t size) {
+    struct timespec start;
+    size_t sent = 0;
+
+    if (server->bandwidth <= 0) return send_all(fd, data, size);
+
+    size_t slice = server->bandwidth / MOCK_SLICES_PER_SECOND;
+    if (slice == 0) slice = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (sent < size) {
+        size_t length = size - sent < slice ? size - sent : slice;
+        if (send_all(fd, data + sent, length) != 0) return 1;
+        sent += length;
+
+        long long due_ns = (long long)((double)sent / server->bandwidth * 1e9);
+        struct timespec deadline = start;
+        deadline.tv_sec += due_ns / 1000000000LL;
+        deadline.tv_nsec += due_ns % 1000000000LL;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        sleep_until(&deadline);
+    }
+
+    return 0;
+}
+
+static int send_response(const MockServer *server, int fd, int status, const char *type,
+                         const char *body, size_t size) {
+    char header[256];
+
+    if (server->latency_ms > 0) {
+        struct timespec delay = { server->latency_ms / 1000, (server->latency_ms % 1000) * 1000000L };
+        nanosleep(&delay, NULL);
+    }
+
+    int length = snprintf(header, sizeof(header),
+                          "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+                          status, status == 200 ? "OK" : "Not Found", type, size);
+    if (send_all(fd, header, length) != 0) return 1;
+    return send_throttled(server, fd, body, size);
+}
+
+static int hex_value(char c) {
+    if (isdigit((unsigned char)c)) return c - '0';
+    c = tolower((unsigned char)c);
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+// Decode a query string value in place
+static void url_decode(char *str) {
+    char *out = str;
+    for (char *in = str; *in; in++) {
+        if (*in == '%' && hex_value(in[1]) >= 0 && hex_value(in[2]) >= 0) {
+            *out++ = (char)(hex_value(in[1]) * 16 + hex_value(in[2]));
+            in += 2;
+        } else if (*in == '+') {
+            *out++ = ' ';
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+}
+
+static unsigned long hash_name(const char *name) {
+    unsigned long hash = 5381;
+    for (; *name; name++) hash = hash * 33 + (unsigned char)*name;
+    return hash;
+}
+
+// Answer a type=info request with one result per arg[] in the query
+static int send_info(const MockServer *server, int fd, char *query) {
+    struct json_object *root = json_object_new_object();
+    struct json_object *results = json_object_new_array();
+    char *save = NULL;
+    int count = 0;
+
+    for (char *arg = strtok_r(query, "&", &save); arg; arg = strtok_r(NULL, "&", &save)) {
+        char *value;
+        if (strncmp(arg, "arg[]=", 6) == 0) {
+            value = arg + 6;
+        } else if (strncmp(arg, "arg%5B%5D=", 10) == 0) {
+            value = arg + 10;
+        } else {
+            continue;
+        }
+        url_decode(value);
+
+        int outdated = server->info_outdated_every > 0 && hash_name(value) % server->info_outdated_every == 0;
+        struct json_object *package = json_object_new_object();
+        json_object_object_add(package, "Name", json_object_new_string(value));
+        json_object_object_add(package, "PackageBase", json_object_new_string(value));
+        json_object_object_add(package, "Version", json_object_new_string(outdated ? "99.0-1" : server->installed_version));
+        json_object_array_add(results, package);
+        count++;
+    }
+
+    json_object_object_add(root, "resultcount", json_object_new_int(count));
+    json_object_object_add(root, "results", results);
+    json_object_object_add(root, "type", json_object_new_string("multiinfo"));
+    json_object_object_add(root, "version", json_object_new_int(5));
+
+    const char *body = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN);
+    int status = send_response(server, fd, 200, "application/json", body, strlen(body));
+    json_object_put(root);
+    return status;
+}
+
+static int route(const MockServer *server, int fd, char *target) {
+    char *query = strchr(target, '?');
+    if (query) *query++ = '\0';
+
+    if (strcmp(target, "/rpc/") == 0 && query && strstr(query, "type=info")) {
+        return send_info(server, fd, query);
+    }
+    if (strcmp(target, "/rpc/") == 0 && query && strstr(query, "type=search")) {
+        return send_response(server, fd, 200, "application/json", server->search.data, server->search.size);
+    }
+    if (strcmp(target, "/packages/search/json/") == 0) {
+        return send_response(server, fd, 200, "application/json", server->arch.data, server->arch.size);
+    }
+    if (strncmp(target, "/cgit/aur.git/snapshot/", 23) == 0) {
+        return send_response(server, fd, 200, "application/x-gzip", server->snapshot.data, server->snapshot.size);
+    }
+    if (strcmp(target, AUR_META_DUMP_PATH) == 0) {
+        return send_response(server, fd, 200, "application/x-gzip", server->dump.data, server->dump.size);
+    }
+    if (strcmp(target, MOCK_TRUNCATED_PREFIX AUR_META_DUMP_PATH) == 0) {
+        return send_response(server, fd, 200, "application/x-gzip", server->dump.data, server->dump.size / 2);
+    }
+
+    return send_response(server, fd, 404, "text/plain", "", 0);
+}
+
+// Serve GET requests on one keep-alive connection until the client closes it
+static void *serve_connection(void *arg) {
+    MockConnection *connection = (MockConnection *)arg;
+    char *request = malloc(MOCK_REQUEST_MAX);
+    size_t used = 0;
+
+    while (request) {
+        char *end;
+        while ((end = memmem(request, used, "\r\n\r\n", 4)) == NULL) {
+            if (used == MOCK_REQUEST_MAX) goto done;
+
+            ssize_t received = recv(connection->fd, request + used, MOCK_REQUEST_MAX - used, 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) goto done;
+            used += received;
+        }
+
+        size_t header_length = end + 4 - request;
+        *end = '\0';
+
+        // "GET <target> HTTP/1.1"
+        char *target = strchr(request, ' ');
+        char *version = target ? strchr(target + 1, ' ') : NULL;
+        if (!target || !version) goto done;
+        *version = '\0';
+
+        if (route(connection->server, connection->fd, target + 1) != 0) goto done;
+
+        memmove(request, request + header_length, used - header_length);
+        used -= header_length;
+    }
+
+done:
+    free(request);
+    close(connection->fd);
+    free(connection);
+    return NULL;
+}
+
+static void *accept_loop(void *arg) {
+    MockServer *server = (MockServer *)arg;
+
+    for (;;) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return NULL;
+        }
+
+        MockConnection *connection = malloc(sizeof(MockConnection));
+        pthread_t thread;
+        if (!connection) {
+            close(fd);
+            continue;
+        }
+        connection->server = server;
+        connection->fd = fd;
+
+        if (pthread_create(&thread, NULL, serve_connection, connection) != 0) {
+            close(fd);
+            free(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+// Listen on an ephemeral loopback port and serve from a background thread
+int mock_server_start(MockServer *server) {
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+
+    if (bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(server->listen_fd, 64) != 0 ||
+        getsockname(server->listen_fd, (struct sockaddr *)&address, &length) != 0) {
+        perror("mock server");
+        close(server->listen_fd);
+        return 1;
+    }
+    server->port = ntohs(address.sin_port);
+
+    if (pthread_create(&server->thread, NULL, accept_loop, server) != 0) {
+        fprintf(stderr, "Error: Failed to start mock server thread\n");
+        close(server->listen_fd);
+        return 1;
+    }
+
+    return 0;
+}
+
+void mock_server_stop(MockServer *server) {
+    shutdown(server->listen_fd, SHUT_RDWR);
+    pthread_join(server->thread, NULL);
+    close(server->listen_fd);
+}
@@ -0,0 +1,38 @@
+#ifndef METHAUR_MOCK_SERVER_H
+#define METHAUR_MOCK_SERVER_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define MOCK_REQUEST_MAX 16384
+#define MOCK_SLICES_PER_SECOND 100
+#define MOCK_TRUNCATED_PREFIX "/truncated"
+
+typedef struct {
+    char *data;
+    size_t size;
+} MockBody;
+
+// A local stand-in for aurweb and archweb. Search, snapshot and metadata
+// dump requests get the recorded bodies; type=info requests are answered
+// for exactly the names asked for, one in every info_outdated_every one
+// newer than installed_version. MOCK_TRUNCATED_PREFIX followed by the dump
+// path serves the first half of the dump, like a download cut short.
+typedef struct {
+    int latency_ms;              // delay before every response
+    long bandwidth;              // bytes per second per connection, 0 = unlimited
+    MockBody search;             // AUR RPC type=search
+    MockBody arch;               // archweb package search
+    MockBody snapshot;           // cgit snapshot tarball
+    MockBody dump;               // packages-meta-ext-v1.json.gz
+    const char *installed_version;
+    int info_outdated_every;
+    int port;                    // set by mock_server_start
+    int listen_fd;
+    pthread_t thread;
+} MockServer;
+
+int mock_server_start(MockServer *server);
+void mock_server_stop(MockServer *server);
+
+#endif
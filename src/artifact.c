@@ -0,0 +1,320 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "artifact.h"
+#include "build.h"
+#include "config.h"
+#include "util.h"
+#include "vcs.h"
+
+#define SRCINFO_VALUE_MAX 256
+
+typedef struct {
+    char path[PATH_MAX];
+    long long size;
+    time_t used;
+} ArtifactSlot;
+
+// First "key = value" for key in the pkgbase section of a .SRCINFO
+static void srcinfo_value(FILE *fp, const char *key, char *value, size_t size) {
+    char line[4096];
+    size_t key_length = strlen(key);
+
+    value[0] = '\0';
+    rewind(fp);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+
+        if (strncmp(p, "pkgname = ", 10) == 0) break;
+        if (strncmp(p, key, key_length) != 0 || strncmp(p + key_length, " = ", 3) != 0) continue;
+
+        p += key_length + 3;
+        p[strcspn(p, "\r\n")] = '\0';
+        snprintf(value, size, "%s", p);
+        return;
+    }
+}
+
+static int hash_file(EVP_MD_CTX *ctx, const char *path) {
+    char buffer[16384];
+    ssize_t n;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        EVP_DigestUpdate(ctx, buffer, (size_t)n);
+    }
+
+    close(fd);
+    return n < 0;
+}
+
+// sha256(PKGBUILD + .SRCINFO) as hex
+static int hash_recipe(const char *dir, char *hex, size_t size) {
+    char path[PATH_MAX];
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    int failed = 0;
+
+    if (size < 65) return 1;
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (!ctx || EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) {
+        EVP_MD_CTX_free(ctx);
+        return 1;
+    }
+
+    static const char *recipe[] = { "PKGBUILD", ".SRCINFO" };
+    for (size_t i = 0; i < sizeof(recipe) / sizeof(recipe[0]) && !failed; i++) {
+        failed = snprintf(path, sizeof(path), "%s/%s", dir, recipe[i]) >= (int)sizeof(path) ||
+                 hash_file(ctx, path) != 0;
+    }
+
+    if (!failed && EVP_DigestFinal_ex(ctx, digest, &digest_length) == 1) {
+        for (unsigned int i = 0; i < digest_length && i < 32; i++) {
+            snprintf(hex + i * 2, 3, "%02x", digest[i]);
+        }
+    } else {
+        failed = 1;
+    }
+
+    EVP_MD_CTX_free(ctx);
+    return failed;
+}
+
+// Cache key for the extracted package: pkgbase/[epoch:]pkgver-pkgrel-arch-recipehash,
+// plus "-clean" for a chroot build, since a host build may have picked up
+// whatever the host had installed. Returns non-zero if the package should
+// not be cached.
+int artifact_key(const char *package_name, char *key, size_t size) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    char pkgbase[SRCINFO_VALUE_MAX], pkgver[SRCINFO_VALUE_MAX];
+    char pkgrel[SRCINFO_VALUE_MAX], epoch[SRCINFO_VALUE_MAX];
+    char hash[65];
+    struct utsname uts;
+
+    if (config.artifact_cache_size <= 0) return 1;
+    if (package_build_dir(package_name, dir, sizeof(dir)) != 0) return 1;
+
+    if (snprintf(path, sizeof(path), "%s/.SRCINFO", dir) >= (int)sizeof(path)) return 1;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return 1;
+
+    srcinfo_value(fp, "pkgbase", pkgbase, sizeof(pkgbase));
+    srcinfo_value(fp, "pkgver", pkgver, sizeof(pkgver));
+    srcinfo_value(fp, "pkgrel", pkgrel, sizeof(pkgrel));
+    srcinfo_value(fp, "epoch", epoch, sizeof(epoch));
+    fclose(fp);
+
+    if (!*pkgbase || !*pkgver || !*pkgrel || strchr(pkgbase, '/') || vcs_package(pkgbase)) return 1;
+    if (hash_recipe(dir, hash, sizeof(hash)) != 0) return 1;
+    if (uname(&uts) != 0) return 1;
+
+    return snprintf(key, size, "%s/%s%s%s-%s-%s-%s%s", pkgbase, epoch, *epoch ? ":" : "",
+                    pkgver, pkgrel, uts.machine, hash, config.clean_build ? "-clean" : "") >= (int)size;
+}
+
+static int artifact_dir(const char *key, char *path, size_t size) {
+    return snprintf(path, size, "%s/%s/%s", config.cache_dir, ARTIFACT_CACHE_SUBDIR, key) >= (int)size;
+}
+
+static int list_files(const char *dir, char ***files, int *count) {
+    char path[PATH_MAX];
+    struct dirent *ent;
+
+    *files = NULL;
+    *count = 0;
+
+    DIR *dp = opendir(dir);
+    if (dp == NULL) return 1;
+
+    while ((ent = readdir(dp)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name) >= (int)sizeof(path)) continue;
+
+        char **grown = realloc(*files, (*count + 1) * sizeof(char *));
+        if (!grown) break;
+        *files = grown;
+        (*files)[(*count)++] = strdup(path);
+    }
+
+    closedir(dp);
+    return 0;
+}
+
+// On a hit, files receives the cached package files and the entry
+// becomes the most recently used one
+int artifact_lookup(const char *key, char ***files, int *count) {
+    char dir[PATH_MAX];
+
+    *files = NULL;
+    *count = 0;
+
+    if (artifact_dir(key, dir, sizeof(dir)) != 0) return 1;
+    if (list_files(dir, files, count) != 0) return 1;
+
+    if (*count == 0) {
+        free_string_list(*files, *count);
+        *files = NULL;
+        return 1;
+    }
+
+    utime(dir, NULL);
+    return 0;
+}
+
+static void remove_slot(const char *dir) {
+    char **files = NULL;
+    int count = 0;
+
+    if (list_files(dir, &files, &count) == 0) {
+        for (int i = 0; i < count; i++) unlink(files[i]);
+        free_string_list(files, count);
+    }
+    rmdir(dir);
+}
+
+// Copy freshly built package files into the cache. The entry is filled
+// in a private directory and renamed into place, so readers never see a
+// partial one. Returns 0 only if the entry is in the cache afterwards;
+// one larger than the whole cache is not stored at all.
+int artifact_store(const char *key, char **files, int count) {
+    char dir[PATH_MAX];
+    char tmp[PATH_MAX];
+    char dest[PATH_MAX];
+    long long size = 0;
+    struct stat st;
+
+    if (count <= 0 || artifact_dir(key, dir, sizeof(dir)) != 0) return 1;
+
+    for (int i = 0; i < count; i++) {
+        if (stat(files[i], &st) == 0) size += st.st_size;
+    }
+    if (size > config.artifact_cache_size) return 1;
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", dir, (long)getpid()) >= (int)sizeof(tmp)) return 1;
+
+    char *slash = strrchr(tmp, '/');
+    *slash = '\0';
+    int failed = mkdir_p(tmp, 0755) != 0;
+    *slash = '/';
+
+    if (failed || mkdir(tmp, 0755) != 0) {
+        fprintf(stderr, "Warning: Failed to create artifact cache entry %s\n", key);
+        return 1;
+    }
+
+    for (int i = 0; i < count && !failed; i++) {
+        const char *base = strrchr(files[i], '/');
+        base = base ? base + 1 : files[i];
+
+        failed = snprintf(dest, sizeof(dest), "%s/%s", tmp, base) >= (int)sizeof(dest) ||
+                 copy_file(files[i], dest, 0) != 0;
+    }
+
+    // Another run may have cached the same build in the meantime
+    if (failed || rename(tmp, dir) != 0) {
+        remove_slot(tmp);
+        if (failed) fprintf(stderr, "Warning: Failed to cache built packages for %s\n", key);
+        return failed;
+    }
+
+    // The new entry is the most recently used one and stays
+    artifact_evict(config.artifact_cache_size, dir);
+    return access(dir, F_OK) != 0;
+}
+
+static int compare_slots(const void *a, const void *b) {
+    const ArtifactSlot *slot_a = a;
+    const ArtifactSlot *slot_b = b;
+    return (slot_a->used > slot_b->used) - (slot_a->used < slot_b->used);
+}
+
+static void collect_slots(const char *base_dir, ArtifactSlot **slots, int *count, long long *total) {
+    char path[PATH_MAX];
+    struct dirent *ent;
+    struct stat st;
+
+    DIR *dp = opendir(base_dir);
+    if (dp == NULL) return;
+
+    while ((ent = readdir(dp)) != NULL) {
+        if (ent->d_name[0] == '.' || strstr(ent->d_name, ".tmp.")) continue;
+        if (snprintf(path, sizeof(path), "%s/%s", base_dir, ent->d_name) >= (int)sizeof(path)) continue;
+        if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+
+        ArtifactSlot *grown = realloc(*slots, (*count + 1) * sizeof(ArtifactSlot));
+        if (!grown) break;
+        *slots = grown;
+
+        ArtifactSlot *slot = &(*slots)[(*count)++];
+        snprintf(slot->path, sizeof(slot->path), "%s", path);
+        slot->used = st.st_mtime;
+        slot->size = 0;
+
+        char **files = NULL;
+        int file_count = 0;
+        if (list_files(path, &files, &file_count) == 0) {
+            for (int i = 0; i < file_count; i++) {
+                if (stat(files[i], &st) == 0) slot->size += st.st_size;
+            }
+            free_string_list(files, file_count);
+        }
+        *total += slot->size;
+    }
+
+    closedir(dp);
+}
+
+// Drop least recently used entries until the cache fits in limit bytes.
+// keep (or NULL) names an entry that is never dropped.
+void artifact_evict(long long limit, const char *keep) {
+    char root[PATH_MAX];
+    char base_dir[PATH_MAX];
+    struct dirent *ent;
+    ArtifactSlot *slots = NULL;
+    int count = 0;
+    long long total = 0;
+
+    if (snprintf(root, sizeof(root), "%s/%s", config.cache_dir, ARTIFACT_CACHE_SUBDIR) >= (int)sizeof(root)) return;
+
+    DIR *dp = opendir(root);
+    if (dp == NULL) return;
+
+    while ((ent = readdir(dp)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+        if (snprintf(base_dir, sizeof(base_dir), "%s/%s", root, ent->d_name) >= (int)sizeof(base_dir)) continue;
+        collect_slots(base_dir, &slots, &count, &total);
+    }
+    closedir(dp);
+
+    if (total > limit) {
+        qsort(slots, count, sizeof(ArtifactSlot), compare_slots);
+
+        for (int i = 0; i < count && total > limit; i++) {
+            if (keep && strcmp(slots[i].path, keep) == 0) continue;
+            remove_slot(slots[i].path);
+            total -= slots[i].size;
+
+            // Drops the pkgbase directory once its last entry is gone
+            char *slash = strrchr(slots[i].path, '/');
+            *slash = '\0';
+            rmdir(slots[i].path);
+        }
+    }
+
+    free(slots);
+}
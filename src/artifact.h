@@ -0,0 +1,13 @@
+#ifndef METHAUR_ARTIFACT_H
+#define METHAUR_ARTIFACT_H
+
+#include <stddef.h>
+
+#define ARTIFACT_CACHE_SUBDIR "artifacts"
+
+int artifact_key(const char *package_name, char *key, size_t size);
+int artifact_lookup(const char *key, char ***files, int *count);
+int artifact_store(const char *key, char **files, int count);
+void artifact_evict(long long limit, const char *keep);
+
+#endif
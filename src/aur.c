@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <json-c/json.h>
+
+#include "aur.h"
+#include "config.h"
+#include "http.h"
+#include "jsonstream.h"
+#include "vercmp.h"
+
+typedef struct {
+    AurInfo *items;
+    int count;
+    int capacity;
+    int failed;
+} AurInfoSet;
+
+// Chunks are in flight concurrently, so each response gets its own stream
+typedef struct {
+    AurInfoSet *set;
+    JsonStream stream;
+} AurInfoRequest;
+
+static int aur_info_append(AurInfoSet *set, const char *name, const char *version, const char *package_base) {
+    if (set->count == set->capacity) {
+        int capacity = set->capacity ? set->capacity * 2 : 64;
+        AurInfo *items = realloc(set->items, capacity * sizeof(AurInfo));
+        if (!items) return 1;
+        set->items = items;
+        set->capacity = capacity;
+    }
+
+    AurInfo *entry = &set->items[set->count];
+    entry->name = strdup(name);
+    entry->version = strdup(version);
+    entry->package_base = strdup(package_base);
+    if (!entry->name || !entry->version || !entry->package_base) {
+        free(entry->name);
+        free(entry->version);
+        free(entry->package_base);
+        return 1;
+    }
+
+    set->count++;
+    return 0;
+}
+
+static int aur_info_element(struct json_object *package_obj, void *userdata) {
+    AurInfoSet *set = (AurInfoSet *)userdata;
+    struct json_object *name_obj = NULL, *version_obj = NULL, *base_obj = NULL;
+
+    json_object_object_get_ex(package_obj, "Name", &name_obj);
+    json_object_object_get_ex(package_obj, "Version", &version_obj);
+    json_object_object_get_ex(package_obj, "PackageBase", &base_obj);
+    if (!name_obj || !version_obj) return 0;
+
+    const char *name = json_object_get_string(name_obj);
+    const char *package_base = base_obj ? json_object_get_string(base_obj) : name;
+    if (aur_info_append(set, name, json_object_get_string(version_obj), package_base) != 0) {
+        fprintf(stderr, "Error: Out of memory\n");
+        set->failed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static int aur_info_chunk(const char *data, size_t size, void *userdata) {
+    AurInfoRequest *info_request = (AurInfoRequest *)userdata;
+    return json_stream_feed(&info_request->stream, data, size) != 0 || info_request->stream.done;
+}
+
+static void aur_info_done(HttpRequest *request, void *userdata) {
+    AurInfoRequest *info_request = (AurInfoRequest *)userdata;
+    AurInfoSet *set = info_request->set;
+
+    if (!http_request_ok(request)) {
+        if (request->result == CURLE_OK) {
+            fprintf(stderr, "Error: AUR info query returned HTTP %ld\n", request->status);
+        }
+        set->failed = 1;
+    } else if (info_request->stream.failed || !info_request->stream.array_found) {
+        fprintf(stderr, "Error: Failed to parse AUR info response\n");
+        set->failed = 1;
+    }
+
+    json_stream_free(&info_request->stream);
+    free(info_request);
+}
+
+static void queue_info_request(HttpEngine *engine, const char *url, AurInfoSet *set) {
+    AurInfoRequest *info_request = malloc(sizeof(AurInfoRequest));
+    if (!info_request) {
+        set->failed = 1;
+        return;
+    }
+
+    info_request->set = set;
+    if (json_stream_init(&info_request->stream, "results", aur_info_element, set) != 0) {
+        free(info_request);
+        set->failed = 1;
+        return;
+    }
+
+    HttpRequest *request = http_engine_add_cached(engine, url, aur_info_done, info_request);
+    if (request == NULL) {
+        json_stream_free(&info_request->stream);
+        free(info_request);
+        set->failed = 1;
+        return;
+    }
+    http_request_stream(request, aur_info_chunk, info_request);
+}
+
+static int compare_aur_info(const void *a, const void *b) {
+    return strcmp(((const AurInfo *)a)->name, ((const AurInfo *)b)->name);
+}
+
+// Look up names with as few type=info requests as the URL length limit
+// allows. All chunks are sent concurrently. Names the AUR does not know
+// are simply absent from the results, which come back sorted by name.
+int aur_info_query(const char **names, int count, AurInfo **results, int *result_count) {
+    AurInfoSet set = {0};
+    HttpEngine engine;
+    char url[AUR_MAX_URL_LENGTH + 1];
+
+    *results = NULL;
+    *result_count = 0;
+
+    if (count <= 0) return 0;
+    if (http_engine_init(&engine) != 0) return 1;
+
+    int i = 0;
+    while (i < count) {
+        size_t length = snprintf(url, sizeof(url), "%s%s", config.aur_url, AUR_INFO_PATH);
+        int in_chunk = 0;
+
+        while (i < count) {
+            char *escaped = http_escape(names[i]);
+            if (!escaped) {
+                set.failed = 1;
+                i++;
+                continue;
+            }
+
+            size_t needed = strlen("&arg[]=") + strlen(escaped);
+            if (length + needed > AUR_MAX_URL_LENGTH && in_chunk > 0) {
+                curl_free(escaped);
+                break;
+            }
+
+            if (length + needed <= AUR_MAX_URL_LENGTH) {
+                length += snprintf(url + length, sizeof(url) - length, "&arg[]=%s", escaped);
+                in_chunk++;
+            } else {
+                fprintf(stderr, "Error: Package name too long for AUR query: %s\n", names[i]);
+            }
+            curl_free(escaped);
+            i++;
+        }
+
+        if (in_chunk > 0) {
+            queue_info_request(&engine, url, &set);
+        }
+    }
+
+    http_engine_run(&engine);
+    http_engine_cleanup(&engine);
+
+    if (set.count > 1) {
+        qsort(set.items, set.count, sizeof(AurInfo), compare_aur_info);
+    }
+
+    *results = set.items;
+    *result_count = set.count;
+    return set.failed;
+}
+
+const AurInfo *aur_info_find(const AurInfo *info, int count, const char *name) {
+    if (info == NULL || count <= 0) return NULL;
+
+    AurInfo key = { .name = (char *)name };
+    return bsearch(&key, info, count, sizeof(AurInfo), compare_aur_info);
+}
+
+void free_aur_info(AurInfo *info, int count) {
+    if (info == NULL) return;
+
+    for (int i = 0; i < count; i++) {
+        free(info[i].name);
+        free(info[i].version);
+        free(info[i].package_base);
+    }
+
+    free(info);
+}
+
+// One entry per installed package, in the same order
+int aur_compare_installed(const InstalledPackage *installed, int count, const AurInfo *info, int info_count,
+                          AurUpgrade **upgrades) {
+    *upgrades = calloc(count > 0 ? count : 1, sizeof(AurUpgrade));
+    if (*upgrades == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory\n");
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const AurInfo *remote = aur_info_find(info, info_count, installed[i].name);
+        AurUpgrade *upgrade = &(*upgrades)[i];
+
+        upgrade->name = strdup(installed[i].name);
+        upgrade->installed = strdup(installed[i].version);
+        upgrade->available = remote ? strdup(remote->version) : NULL;
+        upgrade->outdated = remote && vercmp(remote->version, installed[i].version) > 0;
+        if (!upgrade->name || !upgrade->installed || (remote && !upgrade->available)) {
+            fprintf(stderr, "Error: Failed to allocate memory\n");
+            free_aur_upgrades(*upgrades, i + 1);
+            *upgrades = NULL;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Check every foreign package with one batched round of info queries.
+// A failed query only leaves its packages looking absent from the AUR.
+int aur_check_upgrades(AurUpgrade **upgrades, int *count) {
+    InstalledPackage *installed = NULL;
+    int installed_count = 0;
+
+    *upgrades = NULL;
+    *count = 0;
+
+    if (pacdb_foreign_packages(&installed, &installed_count) != 0) {
+        return 1;
+    }
+
+    const char **names = malloc((installed_count > 0 ? installed_count : 1) * sizeof(char *));
+    if (names == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory\n");
+        free_installed_packages(installed, installed_count);
+        return 1;
+    }
+    for (int i = 0; i < installed_count; i++) {
+        names[i] = installed[i].name;
+    }
+
+    AurInfo *info = NULL;
+    int info_count = 0;
+    if (aur_info_query(names, installed_count, &info, &info_count) != 0) {
+        fprintf(stderr, "Warning: Some AUR info queries failed, results may be incomplete\n");
+    }
+    free(names);
+
+    int status = aur_compare_installed(installed, installed_count, info, info_count, upgrades);
+    if (status == 0) *count = installed_count;
+
+    free_aur_info(info, info_count);
+    free_installed_packages(installed, installed_count);
+    return status;
+}
+
+void free_aur_upgrades(AurUpgrade *upgrades, int count) {
+    if (upgrades == NULL) return;
+
+    for (int i = 0; i < count; i++) {
+        free(upgrades[i].name);
+        free(upgrades[i].installed);
+        free(upgrades[i].available);
+    }
+
+    free(upgrades);
+}
@@ -0,0 +1,34 @@
+#ifndef METHAUR_AUR_H
+#define METHAUR_AUR_H
+
+#include "pacdb.h"
+
+#define AUR_INFO_PATH "/rpc/?v=5&type=info"
+
+// aurweb rejects request URIs longer than 4443 bytes; leave some headroom
+#define AUR_MAX_URL_LENGTH 4000
+
+typedef struct {
+    char *name;
+    char *version;
+    char *package_base;      // the recipe that builds it, shared by split packages
+} AurInfo;
+
+// An installed foreign package held against what the AUR has
+typedef struct {
+    char *name;
+    char *installed;
+    char *available;         // NULL when the AUR does not know the package
+    int outdated;
+} AurUpgrade;
+
+int aur_info_query(const char **names, int count, AurInfo **results, int *result_count);
+const AurInfo *aur_info_find(const AurInfo *info, int count, const char *name);
+void free_aur_info(AurInfo *info, int count);
+
+int aur_compare_installed(const InstalledPackage *installed, int count, const AurInfo *info, int info_count,
+                          AurUpgrade **upgrades);
+int aur_check_upgrades(AurUpgrade **upgrades, int *count);
+void free_aur_upgrades(AurUpgrade *upgrades, int count);
+
+#endif
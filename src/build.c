@@ -0,0 +1,189 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "build.h"
+#include "chroot.h"
+#include "config.h"
+#include "gitcache.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "util.h"
+
+int package_build_dir(const char *package_name, char *path, size_t size) {
+    return snprintf(path, size, "%s%s", TMP_DIR, package_name) >= (int)size;
+}
+
+// Check the recipe of package_name out into its build directory from the
+// cached git clone. Without git, the cgit snapshot is streamed instead.
+int fetch_aur_source(const char *package_name) {
+    char dir[PATH_MAX];
+    char url[PATH_MAX];
+
+    if (package_name == NULL || strlen(package_name) == 0) {
+        fprintf(stderr, "Error: Invalid package name\n");
+        return 1;
+    }
+
+    if (package_build_dir(package_name, dir, sizeof(dir)) != 0 ||
+        snprintf(url, sizeof(url), "%s%s%s.tar.gz", config.aur_url, AUR_SNAPSHOT_PATH, package_name) >= (int)sizeof(url)) {
+        fprintf(stderr, "Error: Invalid package name\n");
+        return 1;
+    }
+
+    // Leftovers from an earlier run would mix with the new recipe
+    clean_build_files(package_name);
+
+    printf("Downloading %s from AUR...\n", package_name);
+    int status = find_program("git") ? git_cache_checkout(package_name, dir) : snapshot_extract(url, TMP_DIR);
+    if (status != 0) {
+        fprintf(stderr, "Error: Failed to download package %s\n", package_name);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Fetch several recipes at once, each in its own process. Returns the
+// number that failed.
+int fetch_aur_sources(const char **names, int count) {
+    int next = 0, running = 0, failed = 0;
+
+    if (count == 1) return fetch_aur_source(names[0]) != 0;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    while (next < count || running > 0) {
+        while (next < count && running < FETCH_MAX_JOBS) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                int status = fetch_aur_source(names[next]);
+                fflush(stdout);
+                _exit(status != 0);
+            }
+
+            if (pid < 0) {
+                failed++;
+            } else {
+                trace_process_label(pid, "fetch", names[next]);
+                running++;
+            }
+            next++;
+        }
+
+        if (running == 0) break;
+
+        struct rusage usage;
+        int status;
+        pid_t pid = wait4(-1, &status, 0, &usage);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            failed += running;
+            break;
+        }
+
+        trace_process_end(pid, &usage);
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+    }
+
+    return failed;
+}
+
+// Build (but do not install) an extracted package in the background.
+// Dependencies are expected to be installed already, so makepkg is not
+// allowed to call pacman itself; that keeps parallel builds from fighting
+// over the database lock.
+pid_t start_makepkg(const char *package_name, const char *log_path) {
+    char dir[PATH_MAX];
+    char *profile = (char *)build_profile_config();
+    char *argv[] = { "makepkg", "--noconfirm", "--force", profile ? "--config" : NULL, profile, NULL };
+
+    if (package_build_dir(package_name, dir, sizeof(dir)) != 0) return -1;
+    return spawn_command(argv, dir, log_path);
+}
+
+// Download and verify the upstream sources of an extracted package in
+// the background. The build that follows finds them in place and goes
+// straight to compiling.
+pid_t start_source_download(const char *package_name, const char *log_path) {
+    char dir[PATH_MAX];
+    char *profile = (char *)build_profile_config();
+    char *argv[] = { "makepkg", "--verifysource", "--noconfirm", profile ? "--config" : NULL, profile, NULL };
+
+    if (package_build_dir(package_name, dir, sizeof(dir)) != 0) return -1;
+    return spawn_command(argv, dir, log_path);
+}
+
+// Ask makepkg which package files the build produced
+int list_built_packages(const char *package_name, char ***files, int *count) {
+    char dir[PATH_MAX];
+    char *output = NULL;
+    // Same config as the build, or PKGEXT could name other files
+    char *profile = (char *)(config.clean_build ? chroot_makepkg_config() : build_profile_config());
+    char *argv[] = { "makepkg", "--packagelist", profile ? "--config" : NULL, profile, NULL };
+
+    *files = NULL;
+    *count = 0;
+
+    if (package_build_dir(package_name, dir, sizeof(dir)) != 0) return 1;
+
+    if (run_capture(argv, dir, &output) != 0) {
+        fprintf(stderr, "Error: Failed to list packages built for %s\n", package_name);
+        free(output);
+        return 1;
+    }
+
+    char *saveptr = NULL;
+    for (char *line = strtok_r(output, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        // --packagelist also names split packages or debug packages that
+        // were not produced; only keep what exists
+        if (access(line, F_OK) != 0) continue;
+
+        char **grown = realloc(*files, (*count + 1) * sizeof(char *));
+        if (!grown) break;
+        *files = grown;
+        (*files)[(*count)++] = strdup(line);
+    }
+
+    free(output);
+    return *count > 0 ? 0 : 1;
+}
+
+int install_package_files(char **files, int count, int as_deps) {
+    char **argv = calloc(count + 6, sizeof(char *));
+    int argc = 0;
+
+    if (!argv) return 1;
+
+    argv[argc++] = "sudo";
+    argv[argc++] = "pacman";
+    argv[argc++] = "-U";
+    argv[argc++] = "--noconfirm";
+    if (as_deps) argv[argc++] = "--asdeps";
+    for (int i = 0; i < count; i++) {
+        argv[argc++] = files[i];
+    }
+
+    int status = run_command(argv, NULL);
+    free(argv);
+    return status;
+}
+
+// Remove the build directory. Not a glob: other packages sharing the
+// name prefix may still be building next to it.
+void clean_build_files(const char *package_name) {
+    char dir[PATH_MAX];
+
+    if (package_build_dir(package_name, dir, sizeof(dir)) != 0) return;
+
+    char *argv[] = { "rm", "-rf", dir, NULL };
+    run_command(argv, NULL);
+}
@@ -0,0 +1,23 @@
+#ifndef METHAUR_BUILD_H
+#define METHAUR_BUILD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define AUR_SNAPSHOT_PATH "/cgit/aur.git/snapshot/"
+#define TMP_DIR "/tmp/methaur/"
+#define FETCH_MAX_JOBS 8
+#define SOURCE_MAX_JOBS 4
+
+// All of these work on one recipe, so package_name is its pkgbase: that
+// names the AUR git repository, the snapshot and the build directory
+int package_build_dir(const char *package_name, char *path, size_t size);
+int fetch_aur_source(const char *package_name);
+int fetch_aur_sources(const char **names, int count);
+pid_t start_makepkg(const char *package_name, const char *log_path);
+pid_t start_source_download(const char *package_name, const char *log_path);
+int list_built_packages(const char *package_name, char ***files, int *count);
+int install_package_files(char **files, int count, int as_deps);
+void clean_build_files(const char *package_name);
+
+#endif
@@ -0,0 +1,284 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+
+#include "cache.h"
+#include "config.h"
+#include "util.h"
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// Sort the '&'-separated parameters so equivalent queries share an entry
+static char *sort_query(const char *query) {
+    char *copy = strdup(query);
+    if (!copy) return NULL;
+
+    size_t capacity = 1;
+    for (const char *p = query; *p; p++) {
+        if (*p == '&') capacity++;
+    }
+
+    char **params = malloc(capacity * sizeof(char *));
+    char *sorted = malloc(strlen(query) + 1);
+    if (!params || !sorted) {
+        free(copy);
+        free(params);
+        free(sorted);
+        return NULL;
+    }
+
+    size_t count = 0;
+    char *saveptr = NULL;
+    for (char *param = strtok_r(copy, "&", &saveptr); param; param = strtok_r(NULL, "&", &saveptr)) {
+        params[count++] = param;
+    }
+    qsort(params, count, sizeof(char *), compare_strings);
+
+    sorted[0] = '\0';
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) strcat(sorted, "&");
+        strcat(sorted, params[i]);
+    }
+
+    free(params);
+    free(copy);
+    return sorted;
+}
+
+static void lowercase(char *str) {
+    for (; str && *str; str++) {
+        *str = (char)tolower((unsigned char)*str);
+    }
+}
+
+// Canonical form of a request URL: lowercase scheme and host, no default
+// port, no fragment, and query parameters in sorted order.
+char *normalize_url(const char *url) {
+    CURLU *handle = curl_url();
+    if (!handle) return NULL;
+
+    char *result = NULL;
+    char *scheme = NULL, *host = NULL, *port = NULL, *path = NULL, *query = NULL;
+    char *sorted = NULL;
+
+    if (curl_url_set(handle, CURLUPART_URL, url, 0) != CURLUE_OK) goto cleanup;
+
+    curl_url_get(handle, CURLUPART_SCHEME, &scheme, 0);
+    curl_url_get(handle, CURLUPART_HOST, &host, 0);
+    curl_url_get(handle, CURLUPART_PORT, &port, 0);
+    curl_url_get(handle, CURLUPART_PATH, &path, 0);
+    curl_url_get(handle, CURLUPART_QUERY, &query, 0);
+    if (!scheme || !host) goto cleanup;
+
+    lowercase(scheme);
+    lowercase(host);
+
+    if (port && ((strcmp(scheme, "http") == 0 && strcmp(port, "80") == 0) ||
+                 (strcmp(scheme, "https") == 0 && strcmp(port, "443") == 0))) {
+        curl_free(port);
+        port = NULL;
+    }
+
+    if (query) {
+        sorted = sort_query(query);
+        if (!sorted) goto cleanup;
+    }
+
+    size_t length = strlen(scheme) + strlen(host) + (port ? strlen(port) : 0) +
+                    (path ? strlen(path) : 0) + (sorted ? strlen(sorted) : 0) + 8;
+    result = malloc(length);
+    if (result) {
+        snprintf(result, length, "%s://%s%s%s%s%s%s",
+                 scheme, host,
+                 port ? ":" : "", port ? port : "",
+                 (path && *path) ? path : "/",
+                 sorted ? "?" : "", sorted ? sorted : "");
+    }
+
+cleanup:
+    curl_free(scheme);
+    curl_free(host);
+    curl_free(port);
+    curl_free(path);
+    curl_free(query);
+    free(sorted);
+    curl_url_cleanup(handle);
+    return result;
+}
+
+static uint64_t fnv1a(const char *str) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *str; str++) {
+        hash ^= (unsigned char)*str;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static char *header_value(char *line, const char *name) {
+    size_t length = strlen(name);
+    if (strncmp(line, name, length) != 0 || line[length] != ' ') return NULL;
+
+    char *value = line + length + 1;
+    value[strcspn(value, "\r\n")] = '\0';
+    return value;
+}
+
+// Resolve the cache slot for url and read its validators, if any. Returns
+// non-zero only when the URL cannot be cached at all.
+int cache_entry_open(const char *url, CacheEntry *entry) {
+    char path[PATH_MAX];
+
+    memset(entry, 0, sizeof(CacheEntry));
+
+    entry->key = normalize_url(url);
+    if (!entry->key) return 1;
+
+    int length = snprintf(path, sizeof(path), "%s/%s/%016llx", config.cache_dir, HTTP_CACHE_SUBDIR,
+                          (unsigned long long)fnv1a(entry->key));
+    entry->path = length < (int)sizeof(path) ? strdup(path) : NULL;
+    if (!entry->path) {
+        cache_entry_free(entry);
+        return 1;
+    }
+
+    FILE *fp = fopen(entry->path, "r");
+    if (fp == NULL) return 0;
+
+    struct stat st;
+    char line[HTTP_CACHE_MAX_HEADER];
+    int valid = 0;
+    int key_matches = 0;
+
+    if (fstat(fileno(fp), &st) == 0 && fgets(line, sizeof(line), fp) != NULL &&
+        strncmp(line, HTTP_CACHE_MAGIC, strlen(HTTP_CACHE_MAGIC)) == 0) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            char *value;
+            if (line[0] == '\n') {
+                valid = 1;
+                break;
+            }
+
+            if ((value = header_value(line, "URL")) != NULL) {
+                key_matches = strcmp(value, entry->key) == 0;
+            } else if ((value = header_value(line, "ETag")) != NULL) {
+                free(entry->etag);
+                entry->etag = strdup(value);
+            } else if ((value = header_value(line, "Last-Modified")) != NULL) {
+                free(entry->last_modified);
+                entry->last_modified = strdup(value);
+            }
+        }
+    }
+
+    // A hash collision or a damaged file is treated as a miss
+    if (valid && key_matches) {
+        entry->body_offset = ftell(fp);
+        entry->exists = 1;
+        entry->fresh = (time(NULL) - st.st_mtime) < config.cache_ttl;
+    } else {
+        free(entry->etag);
+        free(entry->last_modified);
+        entry->etag = NULL;
+        entry->last_modified = NULL;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+int cache_entry_read_body(const CacheEntry *entry, char **data, size_t *size) {
+    *data = NULL;
+    *size = 0;
+
+    if (!entry->exists) return 1;
+
+    FILE *fp = fopen(entry->path, "r");
+    if (fp == NULL) return 1;
+
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_size < entry->body_offset ||
+        fseek(fp, entry->body_offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return 1;
+    }
+
+    size_t length = (size_t)(st.st_size - entry->body_offset);
+    char *buffer = malloc(length + 1);
+    if (!buffer) {
+        fclose(fp);
+        return 1;
+    }
+
+    if (fread(buffer, 1, length, fp) != length) {
+        free(buffer);
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+
+    buffer[length] = '\0';
+    *data = buffer;
+    *size = length;
+    return 0;
+}
+
+// Write the entry to a temporary file and rename it into place, so a
+// concurrent reader never sees a half-written response.
+int cache_entry_store(const CacheEntry *entry, const char *etag, const char *last_modified,
+                      const char *data, size_t size) {
+    char dir[PATH_MAX];
+    char tmp_path[PATH_MAX];
+
+    if (snprintf(dir, sizeof(dir), "%s/%s", config.cache_dir, HTTP_CACHE_SUBDIR) >= (int)sizeof(dir) ||
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", entry->path, (long)getpid()) >= (int)sizeof(tmp_path)) {
+        return 1;
+    }
+
+    if (mkdir_p(dir, 0755) != 0) return 1;
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL) return 1;
+
+    fprintf(fp, "%s\n", HTTP_CACHE_MAGIC);
+    fprintf(fp, "URL %s\n", entry->key);
+    if (etag && *etag) fprintf(fp, "ETag %s\n", etag);
+    if (last_modified && *last_modified) fprintf(fp, "Last-Modified %s\n", last_modified);
+    fprintf(fp, "\n");
+
+    int failed = fwrite(data, 1, size, fp) != size;
+    failed |= fclose(fp) != 0;
+
+    if (failed || rename(tmp_path, entry->path) != 0) {
+        unlink(tmp_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+// A 304 revalidation restarts the entry's TTL without rewriting it
+void cache_entry_touch(const CacheEntry *entry) {
+    if (entry->exists) {
+        utime(entry->path, NULL);
+    }
+}
+
+void cache_entry_free(CacheEntry *entry) {
+    if (entry == NULL) return;
+
+    free(entry->path);
+    free(entry->key);
+    free(entry->etag);
+    free(entry->last_modified);
+    memset(entry, 0, sizeof(CacheEntry));
+}
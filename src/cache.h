@@ -0,0 +1,31 @@
+#ifndef METHAUR_CACHE_H
+#define METHAUR_CACHE_H
+
+#include <stddef.h>
+
+#define HTTP_CACHE_SUBDIR "http"
+#define HTTP_CACHE_MAGIC "METHAUR-CACHE 1"
+#define HTTP_CACHE_MAX_HEADER 8192
+
+// A response cache slot, keyed by the normalized request URL. Opening an
+// entry only reads its small header; the body is loaded on demand.
+typedef struct {
+    char *path;
+    char *key;
+    char *etag;
+    char *last_modified;
+    long body_offset;
+    int exists;
+    int fresh;
+} CacheEntry;
+
+int cache_entry_open(const char *url, CacheEntry *entry);
+int cache_entry_read_body(const CacheEntry *entry, char **data, size_t *size);
+int cache_entry_store(const CacheEntry *entry, const char *etag, const char *last_modified,
+                      const char *data, size_t size);
+void cache_entry_touch(const CacheEntry *entry);
+void cache_entry_free(CacheEntry *entry);
+
+char *normalize_url(const char *url);
+
+#endif
@@ -0,0 +1,170 @@
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "build.h"
+#include "chroot.h"
+#include "config.h"
+#include "util.h"
+
+static int prepared = 0;     // 1 once the base root is up to date, -1 if that failed
+static char makepkg_config[PATH_MAX];
+
+// The paths of one build: the makechrootpkg copy name, where the overlay
+// is mounted, and where its upper and work directories live
+static int overlay_paths(const char *package_name, char *copy, char *mountpoint, char *layer, size_t size) {
+    return snprintf(copy, size, "%s%s", CHROOT_COPY_PREFIX, package_name) >= (int)size ||
+           snprintf(mountpoint, size, "%s/%s", config.chroot_dir, copy) >= (int)size ||
+           snprintf(layer, size, "%s/%s/%s", config.chroot_dir, CHROOT_LAYERS, package_name) >= (int)size;
+}
+
+// Overlays of a run that was killed are still mounted on the root
+static void remove_stale_overlays(void) {
+    DIR *dir = opendir(config.chroot_dir);
+    struct dirent *entry;
+    size_t prefix = strlen(CHROOT_COPY_PREFIX);
+
+    if (dir == NULL) return;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (strncmp(entry->d_name, CHROOT_COPY_PREFIX, prefix) != 0 || length == prefix) continue;
+        if (length > 5 && strcmp(entry->d_name + length - 5, ".lock") == 0) continue;
+        chroot_finish_build(entry->d_name + prefix);
+    }
+    closedir(dir);
+}
+
+int chroot_prepare(void) {
+    const char *tools[] = { "mkarchroot", "arch-nspawn", "makechrootpkg", "mountpoint" };
+    char root[PATH_MAX];
+
+    if (prepared) return prepared < 0;
+    prepared = -1;
+
+    for (size_t i = 0; i < sizeof(tools) / sizeof(tools[0]); i++) {
+        if (!find_program(tools[i])) {
+            fprintf(stderr, "Error: CleanBuild needs %s (from devtools) but it was not found\n", tools[i]);
+            return 1;
+        }
+    }
+
+    if (snprintf(root, sizeof(root), "%s/%s", config.chroot_dir, CHROOT_ROOT) >= (int)sizeof(root)) {
+        fprintf(stderr, "Error: Path too long: %s\n", config.chroot_dir);
+        return 1;
+    }
+
+    if (access(root, F_OK) != 0) {
+        char *mkdir_argv[] = { "sudo", "mkdir", "-p", config.chroot_dir, NULL };
+        char *create_argv[] = { "sudo", "mkarchroot", root, CHROOT_PACKAGES, NULL };
+
+        printf("Creating the clean build root in %s...\n", root);
+        if (run_command(mkdir_argv, NULL) != 0 || run_command(create_argv, NULL) != 0) {
+            fprintf(stderr, "Error: Failed to create the clean build root\n");
+            return 1;
+        }
+    } else {
+        // This runs before the first overlay of the run is mounted: the
+        // lower directory of an overlay must not change under it
+        remove_stale_overlays();
+        char *update_argv[] = { "sudo", "arch-nspawn", root, "pacman", "-Syu", "--noconfirm", NULL };
+
+        printf("Updating the clean build root...\n");
+        if (run_command(update_argv, NULL) != 0) {
+            fprintf(stderr, "Error: Failed to update the clean build root\n");
+            return 1;
+        }
+    }
+
+    prepared = 1;
+    return 0;
+}
+
+pid_t chroot_start_build(const char *package_name, char **dep_files, int dep_count, const char *log_path) {
+    char dir[PATH_MAX];
+    char copy[PATH_MAX], mountpoint[PATH_MAX], layer[PATH_MAX];
+    char upper[PATH_MAX + 8], work[PATH_MAX + 8];
+    char options[PATH_MAX * 3 + 64];
+
+    if (chroot_prepare() != 0) return -1;
+
+    if (package_build_dir(package_name, dir, sizeof(dir)) != 0 ||
+        overlay_paths(package_name, copy, mountpoint, layer, sizeof(copy)) != 0) {
+        fprintf(stderr, "Error: Path too long for the clean build of %s\n", package_name);
+        return -1;
+    }
+    snprintf(upper, sizeof(upper), "%s/upper", layer);
+    snprintf(work, sizeof(work), "%s/work", layer);
+    if (snprintf(options, sizeof(options), "lowerdir=%s/%s,upperdir=%s,workdir=%s",
+                 config.chroot_dir, CHROOT_ROOT, upper, work) >= (int)sizeof(options)) {
+        return -1;
+    }
+
+    // An interrupted run may have left this overlay behind
+    chroot_finish_build(package_name);
+
+    char *mkdir_argv[] = { "sudo", "mkdir", "-p", upper, work, mountpoint, NULL };
+    char *mount_argv[] = { "sudo", "mount", "-t", "overlay", "overlay", "-o", options, mountpoint, NULL };
+    if (run_command(mkdir_argv, NULL) != 0 || run_command(mount_argv, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to mount the build overlay for %s\n", package_name);
+        chroot_finish_build(package_name);
+        return -1;
+    }
+
+    // makechrootpkg finds its copy in place and builds in it as is,
+    // instead of syncing one from the root
+    char **argv = calloc(dep_count * 2 + 6, sizeof(char *));
+    int argc = 0;
+    if (!argv) {
+        chroot_finish_build(package_name);
+        return -1;
+    }
+
+    argv[argc++] = "makechrootpkg";
+    argv[argc++] = "-r";
+    argv[argc++] = config.chroot_dir;
+    argv[argc++] = "-l";
+    argv[argc++] = copy;
+    for (int i = 0; i < dep_count; i++) {
+        argv[argc++] = "-I";
+        argv[argc++] = dep_files[i];
+    }
+
+    pid_t pid = spawn_command(argv, dir, log_path);
+    free(argv);
+    if (pid < 0) chroot_finish_build(package_name);
+    return pid;
+}
+
+void chroot_finish_build(const char *package_name) {
+    char copy[PATH_MAX], mountpoint[PATH_MAX], layer[PATH_MAX];
+    char lock[PATH_MAX + 8];
+
+    if (overlay_paths(package_name, copy, mountpoint, layer, sizeof(copy)) != 0) return;
+    snprintf(lock, sizeof(lock), "%s.lock", mountpoint);
+
+    char *check_argv[] = { "mountpoint", "-q", mountpoint, NULL };
+    char *umount_argv[] = { "sudo", "umount", mountpoint, NULL };
+    if (access(mountpoint, F_OK) == 0 && run_command(check_argv, NULL) == 0 &&
+        run_command(umount_argv, NULL) != 0) {
+        // Deleting through a live mount would not reach the root, but
+        // the overlay is still in use
+        fprintf(stderr, "Warning: Failed to unmount %s\n", mountpoint);
+        return;
+    }
+
+    char *rm_argv[] = { "sudo", "rm", "-rf", layer, mountpoint, lock, NULL };
+    if (access(layer, F_OK) == 0 || access(mountpoint, F_OK) == 0 || access(lock, F_OK) == 0) {
+        run_command(rm_argv, NULL);
+    }
+}
+
+const char *chroot_makepkg_config(void) {
+    if (snprintf(makepkg_config, sizeof(makepkg_config), "%s/%s/etc/makepkg.conf",
+                 config.chroot_dir, CHROOT_ROOT) >= (int)sizeof(makepkg_config)) {
+        return NULL;
+    }
+    return makepkg_config;
+}
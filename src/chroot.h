@@ -0,0 +1,26 @@
+#ifndef METHAUR_CHROOT_H
+#define METHAUR_CHROOT_H
+
+#include <sys/types.h>
+
+#define CHROOT_ROOT "root"               // the base root, where devtools expects it
+#define CHROOT_LAYERS "layers"           // upper and work directories of the overlays
+#define CHROOT_COPY_PREFIX "methaur-"    // the overlays, as makechrootpkg copies of root
+#define CHROOT_PACKAGES "base-devel"
+
+// With CleanBuild = yes, packages are built with the devtools in a chroot
+// under ChrootDir. Its base root is created once and upgraded by the first
+// build of every run. Each build then gets an overlayfs on top of the base
+// root, mounted where makechrootpkg looks for its working copy, so nothing
+// is copied; the overlay is thrown away once the build is done. Builds
+// running side by side each have their own.
+int chroot_prepare(void);
+// Build package_name in a fresh overlay, installing dep_files (AUR
+// dependencies built in this run) into it first
+pid_t chroot_start_build(const char *package_name, char **dep_files, int dep_count, const char *log_path);
+// Unmount and delete the overlay of package_name
+void chroot_finish_build(const char *package_name);
+// The makepkg.conf the chroot builds with, so its package names can be listed
+const char *chroot_makepkg_config(void);
+
+#endif
@@ -0,0 +1,270 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+MethaurConfig config;
+
+static void set_defaults(void) {
+    const char *xdg_cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (xdg_cache && *xdg_cache) {
+        snprintf(config.cache_dir, sizeof(config.cache_dir), "%s/methaur", xdg_cache);
+    } else if (home && *home) {
+        snprintf(config.cache_dir, sizeof(config.cache_dir), "%s/.cache/methaur", home);
+    } else {
+        snprintf(config.cache_dir, sizeof(config.cache_dir), "/tmp/methaur/cache");
+    }
+
+    config.cache_ttl = DEFAULT_CACHE_TTL;
+    config.build_jobs = 0;
+    config.prefetch_depth = DEFAULT_PREFETCH_DEPTH;
+    config.build_dir[0] = '\0';
+    config.compiler_cache = COMPILER_CACHE_AUTO;
+    config.make_flags[0] = '\0';
+    config.compression = COMPRESSION_FAST;
+    config.artifact_cache_size = DEFAULT_ARTIFACT_CACHE_SIZE;
+    snprintf(config.aur_url, sizeof(config.aur_url), "%s", DEFAULT_AUR_URL);
+    snprintf(config.arch_url, sizeof(config.arch_url), "%s", DEFAULT_ARCH_URL);
+    snprintf(config.aur_urls[0], sizeof(config.aur_urls[0]), "%s", DEFAULT_AUR_URL);
+    snprintf(config.arch_urls[0], sizeof(config.arch_urls[0]), "%s", DEFAULT_ARCH_URL);
+    config.aur_url_count = 1;
+    config.arch_url_count = 1;
+    config.request_timeout = DEFAULT_REQUEST_TIMEOUT;
+    config.index_max_age = DEFAULT_INDEX_MAX_AGE;
+    config.clean_build = 0;
+    snprintf(config.chroot_dir, sizeof(config.chroot_dir), "%s", DEFAULT_CHROOT_DIR);
+}
+
+static char *trim(char *str) {
+    while (isspace((unsigned char)*str)) str++;
+
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+
+    return str;
+}
+
+static int parse_long(const char *value, long *out) {
+    char *end;
+    errno = 0;
+    long parsed = strtol(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0') return 1;
+
+    *out = parsed;
+    return 0;
+}
+
+// A byte count with an optional K, M or G suffix (powers of 1024)
+static int parse_size(const char *value, long long *out) {
+    char *end;
+    errno = 0;
+    long long parsed = strtoll(value, &end, 10);
+    if (errno != 0 || end == value || parsed < 0) return 1;
+
+    int shift = 0;
+    switch (toupper((unsigned char)*end)) {
+        case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+    }
+    if (*end != '\0' || parsed > (LLONG_MAX >> shift)) return 1;
+
+    *out = parsed << shift;
+    return 0;
+}
+
+// Copy a base URL option without its trailing slashes; paths are appended
+static int parse_url(const char *value, char *dest, size_t size) {
+    size_t length = strlen(value);
+    while (length > 0 && value[length - 1] == '/') length--;
+
+    if (strstr(value, "://") == NULL || length >= size) return 1;
+
+    snprintf(dest, size, "%.*s", (int)length, value);
+    return 0;
+}
+
+// A whitespace separated list of base URLs, the first being the default
+// choice and the rest its mirrors. Nothing changes unless all are valid.
+static int parse_url_list(const char *value, char urls[][CONFIG_URL_MAX], int *count) {
+    char parsed[CONFIG_MAX_URLS][CONFIG_URL_MAX];
+    char list[PATH_MAX + 64];
+    char *saveptr = NULL;
+    int n = 0;
+
+    snprintf(list, sizeof(list), "%s", value);
+    for (char *url = strtok_r(list, " \t", &saveptr); url; url = strtok_r(NULL, " \t", &saveptr)) {
+        if (n == CONFIG_MAX_URLS || parse_url(url, parsed[n], CONFIG_URL_MAX) != 0) return 1;
+        n++;
+    }
+    if (n == 0) return 1;
+
+    memcpy(urls, parsed, sizeof(parsed[0]) * n);
+    *count = n;
+    return 0;
+}
+
+// Copy a path option, expanding a leading "~/" to $HOME
+static void expand_path(char *dest, size_t size, const char *value) {
+    const char *home = getenv("HOME");
+
+    if (value[0] == '~' && value[1] == '/' && home && *home) {
+        snprintf(dest, size, "%s%s", home, value + 1);
+    } else {
+        snprintf(dest, size, "%s", value);
+    }
+}
+
+static void apply_option(const char *path, int line_number, const char *key, const char *value) {
+    if (strcmp(key, "CacheDir") == 0) {
+        expand_path(config.cache_dir, sizeof(config.cache_dir), value);
+    } else if (strcmp(key, "CacheTTL") == 0) {
+        if (parse_long(value, &config.cache_ttl) != 0 || config.cache_ttl < 0) {
+            fprintf(stderr, "Warning: %s:%d: invalid CacheTTL '%s'\n", path, line_number, value);
+            config.cache_ttl = DEFAULT_CACHE_TTL;
+        }
+    } else if (strcmp(key, "BuildJobs") == 0) {
+        long jobs;
+        if (parse_long(value, &jobs) != 0 || jobs < 0 || jobs > 1024) {
+            fprintf(stderr, "Warning: %s:%d: invalid BuildJobs '%s'\n", path, line_number, value);
+        } else {
+            config.build_jobs = (int)jobs;
+        }
+    } else if (strcmp(key, "PrefetchDepth") == 0) {
+        long depth;
+        if (parse_long(value, &depth) != 0 || depth < 0 || depth > 1024) {
+            fprintf(stderr, "Warning: %s:%d: invalid PrefetchDepth '%s'\n", path, line_number, value);
+        } else {
+            config.prefetch_depth = (int)depth;
+        }
+    } else if (strcmp(key, "BuildDir") == 0) {
+        if (strcmp(value, "auto") == 0) {
+            config.build_dir[0] = '\0';
+        } else {
+            expand_path(config.build_dir, sizeof(config.build_dir), value);
+        }
+    } else if (strcmp(key, "CompilerCache") == 0) {
+        if (strcmp(value, "auto") == 0) {
+            config.compiler_cache = COMPILER_CACHE_AUTO;
+        } else if (strcmp(value, "none") == 0) {
+            config.compiler_cache = COMPILER_CACHE_NONE;
+        } else if (strcmp(value, "ccache") == 0) {
+            config.compiler_cache = COMPILER_CACHE_CCACHE;
+        } else if (strcmp(value, "sccache") == 0) {
+            config.compiler_cache = COMPILER_CACHE_SCCACHE;
+        } else {
+            fprintf(stderr, "Warning: %s:%d: invalid CompilerCache '%s'\n", path, line_number, value);
+        }
+    } else if (strcmp(key, "MakeFlags") == 0) {
+        snprintf(config.make_flags, sizeof(config.make_flags), "%s", strcmp(value, "auto") == 0 ? "" : value);
+    } else if (strcmp(key, "PackageCompression") == 0) {
+        if (strcmp(value, "fast") == 0) {
+            config.compression = COMPRESSION_FAST;
+        } else if (strcmp(value, "none") == 0) {
+            config.compression = COMPRESSION_NONE;
+        } else if (strcmp(value, "makepkg") == 0) {
+            config.compression = COMPRESSION_MAKEPKG;
+        } else {
+            fprintf(stderr, "Warning: %s:%d: invalid PackageCompression '%s'\n", path, line_number, value);
+        }
+    } else if (strcmp(key, "ArtifactCacheSize") == 0) {
+        if (parse_size(value, &config.artifact_cache_size) != 0) {
+            fprintf(stderr, "Warning: %s:%d: invalid ArtifactCacheSize '%s'\n", path, line_number, value);
+            config.artifact_cache_size = DEFAULT_ARTIFACT_CACHE_SIZE;
+        }
+    } else if (strcmp(key, "AurURL") == 0) {
+        if (parse_url_list(value, config.aur_urls, &config.aur_url_count) != 0) {
+            fprintf(stderr, "Warning: %s:%d: invalid AurURL '%s'\n", path, line_number, value);
+        }
+        snprintf(config.aur_url, sizeof(config.aur_url), "%s", config.aur_urls[0]);
+    } else if (strcmp(key, "ArchURL") == 0) {
+        if (parse_url_list(value, config.arch_urls, &config.arch_url_count) != 0) {
+            fprintf(stderr, "Warning: %s:%d: invalid ArchURL '%s'\n", path, line_number, value);
+        }
+        snprintf(config.arch_url, sizeof(config.arch_url), "%s", config.arch_urls[0]);
+    } else if (strcmp(key, "RequestTimeout") == 0) {
+        if (parse_long(value, &config.request_timeout) != 0 || config.request_timeout < 0) {
+            fprintf(stderr, "Warning: %s:%d: invalid RequestTimeout '%s'\n", path, line_number, value);
+            config.request_timeout = DEFAULT_REQUEST_TIMEOUT;
+        }
+    } else if (strcmp(key, "IndexMaxAge") == 0) {
+        if (parse_long(value, &config.index_max_age) != 0 || config.index_max_age < 0) {
+            fprintf(stderr, "Warning: %s:%d: invalid IndexMaxAge '%s'\n", path, line_number, value);
+            config.index_max_age = DEFAULT_INDEX_MAX_AGE;
+        }
+    } else if (strcmp(key, "CleanBuild") == 0) {
+        if (strcmp(value, "yes") == 0) {
+            config.clean_build = 1;
+        } else if (strcmp(value, "no") == 0) {
+            config.clean_build = 0;
+        } else {
+            fprintf(stderr, "Warning: %s:%d: invalid CleanBuild '%s'\n", path, line_number, value);
+        }
+    } else if (strcmp(key, "ChrootDir") == 0) {
+        // overlayfs mount options are split on ',' and ':'
+        if (value[0] != '/' && value[0] != '~') {
+            fprintf(stderr, "Warning: %s:%d: ChrootDir must be an absolute path\n", path, line_number);
+        } else if (strpbrk(value, ",:")) {
+            fprintf(stderr, "Warning: %s:%d: ChrootDir may not contain ',' or ':'\n", path, line_number);
+        } else {
+            expand_path(config.chroot_dir, sizeof(config.chroot_dir), value);
+        }
+    } else {
+        fprintf(stderr, "Warning: %s:%d: unknown option '%s'\n", path, line_number, key);
+    }
+}
+
+// Load defaults, then override them from $XDG_CONFIG_HOME/methaur/methaur.conf
+// (or ~/.config/methaur/methaur.conf). The file uses pacman.conf syntax:
+// "Key = Value" lines, '#' comments, and [section] headers are ignored.
+int load_config(void) {
+    char path[PATH_MAX];
+    const char *xdg_config = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+
+    set_defaults();
+
+    if (xdg_config && *xdg_config) {
+        snprintf(path, sizeof(path), "%s/%s", xdg_config, CONFIG_FILE_NAME);
+    } else if (home && *home) {
+        snprintf(path, sizeof(path), "%s/.config/%s", home, CONFIG_FILE_NAME);
+    } else {
+        return 0;
+    }
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    char line[PATH_MAX + 64];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char *key = trim(line);
+        if (*key == '\0' || *key == '[') continue;
+
+        char *value = strchr(key, '=');
+        if (value == NULL) {
+            fprintf(stderr, "Warning: %s:%d: expected 'Key = Value'\n", path, line_number);
+            continue;
+        }
+
+        *value++ = '\0';
+        apply_option(path, line_number, trim(key), trim(value));
+    }
+
+    fclose(fp);
+    return 0;
+}
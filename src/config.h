@@ -0,0 +1,58 @@
+#ifndef METHAUR_CONFIG_H
+#define METHAUR_CONFIG_H
+
+#include <limits.h>
+
+#define CONFIG_FILE_NAME "methaur/methaur.conf"
+#define DEFAULT_CACHE_TTL 300
+#define DEFAULT_ARTIFACT_CACHE_SIZE (4LL << 30)
+#define DEFAULT_PREFETCH_DEPTH 4
+#define DEFAULT_AUR_URL "https://aur.archlinux.org"
+#define DEFAULT_ARCH_URL "https://archlinux.org"
+#define DEFAULT_REQUEST_TIMEOUT 30
+#define DEFAULT_INDEX_MAX_AGE 7     // days
+#define DEFAULT_CHROOT_DIR "/var/lib/methaur/chroot"
+#define CONFIG_URL_MAX 256
+#define CONFIG_MAX_URLS 8
+#define CONFIG_FLAGS_MAX 256
+
+typedef enum {
+    COMPILER_CACHE_AUTO,     // whichever of ccache and sccache is installed
+    COMPILER_CACHE_NONE,
+    COMPILER_CACHE_CCACHE,
+    COMPILER_CACHE_SCCACHE
+} CompilerCache;
+
+typedef enum {
+    COMPRESSION_FAST,        // multithreaded zstd at its fastest level
+    COMPRESSION_NONE,        // plain .pkg.tar
+    COMPRESSION_MAKEPKG      // whatever makepkg.conf says
+} PackageCompression;
+
+typedef struct {
+    char cache_dir[PATH_MAX];
+    long cache_ttl;          // seconds a cached response is served without revalidation
+    int build_jobs;          // parallel makepkg runs, 0 = one per online CPU
+    int prefetch_depth;      // packages whose sources are downloaded ahead of their build
+    char build_dir[PATH_MAX];       // makepkg BUILDDIR, "" = in RAM when memory allows
+    CompilerCache compiler_cache;
+    char make_flags[CONFIG_FLAGS_MAX];  // "" = -j from CPUs and memory
+    PackageCompression compression;
+    long long artifact_cache_size;  // bytes of built packages kept, 0 = no cache
+    char aur_url[CONFIG_URL_MAX];   // base of the RPC, snapshots, git clones and metadata dump
+    char arch_url[CONFIG_URL_MAX];  // base of the archweb package search
+    char aur_urls[CONFIG_MAX_URLS][CONFIG_URL_MAX];   // aur_url and its mirrors
+    int aur_url_count;
+    char arch_urls[CONFIG_MAX_URLS][CONFIG_URL_MAX];
+    int arch_url_count;
+    long request_timeout;    // seconds an API request may take, 0 = no limit
+    long index_max_age;      // days the offline index is searched after its last sync, 0 = no limit
+    int clean_build;         // build in throwaway overlays of a clean chroot
+    char chroot_dir[PATH_MAX];      // holds the base root and the overlays
+} MethaurConfig;
+
+extern MethaurConfig config;
+
+int load_config(void);
+
+#endif
@@ -0,0 +1,293 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+
+// $XDG_RUNTIME_DIR/methaur/daemon.sock, or a per-user directory in /tmp.
+// The directory must belong to us and be closed to everyone else, so a
+// socket planted by another user is never trusted.
+int daemon_socket_path(char *path, size_t size, int create) {
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    char dir[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    struct stat st;
+
+    if (runtime && *runtime) {
+        snprintf(dir, sizeof(dir), "%s/methaur", runtime);
+    } else {
+        snprintf(dir, sizeof(dir), "/tmp/methaur-%u", (unsigned)getuid());
+    }
+
+    if (create && mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Failed to create %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+        if (create) fprintf(stderr, "Error: %s is not a private directory\n", dir);
+        return 1;
+    }
+
+    if (snprintf(path, size, "%s/%s", dir, DAEMON_SOCKET_NAME) >= (int)size ||
+        strlen(path) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+        if (create) fprintf(stderr, "Error: Socket path too long: %s\n", dir);
+        return 1;
+    }
+    return 0;
+}
+
+// Write one line, NULL fields as empty ones
+int daemon_write_record(FILE *fp, const char *const *fields, int count) {
+    for (int i = 0; i < count; i++) {
+        if (i > 0) putc('\t', fp);
+
+        for (const char *c = fields[i] ? fields[i] : ""; *c; c++) {
+            if (*c == '\\') {
+                fputs("\\\\", fp);
+            } else if (*c == '\t') {
+                fputs("\\t", fp);
+            } else if (*c == '\n') {
+                fputs("\\n", fp);
+            } else {
+                putc(*c, fp);
+            }
+        }
+    }
+    putc('\n', fp);
+    return ferror(fp) ? 1 : 0;
+}
+
+static void unescape(char *str) {
+    char *out = str;
+    for (char *in = str; *in; in++) {
+        if (*in == '\\' && in[1]) {
+            in++;
+            *out++ = *in == 't' ? '\t' : *in == 'n' ? '\n' : *in;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+}
+
+// Read one line into *line and point fields into it. Returns the number
+// of fields, or -1 at end of input. Fields past max are left joined to
+// the last one.
+int daemon_read_record(FILE *fp, char **line, size_t *size, char **fields, int max) {
+    ssize_t length = getline(line, size, fp);
+    if (length <= 0 || (*line)[length - 1] != '\n') return -1;
+    (*line)[length - 1] = '\0';
+
+    int count = 0;
+    char *field = *line;
+    while (count < max) {
+        fields[count++] = field;
+        char *tab = strchr(field, '\t');
+        if (tab == NULL || count == max) break;
+        *tab = '\0';
+        field = tab + 1;
+    }
+
+    for (int i = 0; i < count; i++) unescape(fields[i]);
+    return count;
+}
+
+typedef struct {
+    int fd;
+    FILE *in;
+    char *line;
+    size_t size;
+} DaemonConnection;
+
+static void daemon_disconnect(DaemonConnection *connection) {
+    if (connection->in) {
+        fclose(connection->in);
+    } else if (connection->fd >= 0) {
+        close(connection->fd);
+    }
+    free(connection->line);
+}
+
+// Silent when nobody is listening; that is the usual case
+static int daemon_connect(DaemonConnection *connection) {
+    struct sockaddr_un address;
+    struct timeval timeout = { DAEMON_TIMEOUT, 0 };
+
+    memset(connection, 0, sizeof(*connection));
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (daemon_socket_path(address.sun_path, sizeof(address.sun_path), 0) != 0) return 1;
+
+    connection->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection->fd < 0) return 1;
+
+    setsockopt(connection->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(connection->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(connection->fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        (connection->in = fdopen(connection->fd, "r")) == NULL) {
+        daemon_disconnect(connection);
+        return 1;
+    }
+    return 0;
+}
+
+// Send the request in one piece, without SIGPIPE should the daemon go
+// away, then read the status line. Returns the number of records that
+// follow, or -1.
+static int daemon_request(DaemonConnection *connection, const char *const *fields, int count,
+                          const char **names, int name_count) {
+    char *request = NULL;
+    size_t length = 0;
+    char *status[2];
+
+    FILE *fp = open_memstream(&request, &length);
+    if (fp == NULL) return -1;
+    daemon_write_record(fp, fields, count);
+    for (int i = 0; i < name_count; i++) {
+        daemon_write_record(fp, &names[i], 1);
+    }
+    fclose(fp);
+
+    for (size_t sent = 0; sent < length;) {
+        ssize_t n = send(connection->fd, request + sent, length - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            free(request);
+            return -1;
+        }
+        sent += n;
+    }
+    free(request);
+
+    int n = daemon_read_record(connection->in, &connection->line, &connection->size, status, 2);
+    if (n == 2 && strcmp(status[0], "ok") == 0) {
+        return atoi(status[1]);
+    }
+    if (n == 2 && strcmp(status[0], "error") == 0) {
+        fprintf(stderr, "Warning: methaurd: %s, continuing without it\n", status[1]);
+    }
+    return -1;
+}
+
+int daemon_search(const char *query, ResultSet *set) {
+    DaemonConnection connection;
+    const char *request[] = { "search", query };
+    char *fields[DAEMON_MAX_FIELDS];
+
+    if (daemon_connect(&connection) != 0) return 1;
+
+    int count = daemon_request(&connection, request, 2, NULL, 0);
+    if (count < 0 || result_set_init(set, query) != 0) {
+        daemon_disconnect(&connection);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (daemon_read_record(connection.in, &connection.line, &connection.size, fields, 8) != 8) {
+            result_set_free(set);
+            daemon_disconnect(&connection);
+            return 1;
+        }
+
+        Package package = {
+            .name = fields[0],
+            .repo = fields[1],
+            .version = fields[2],
+            .description = fields[3],
+            .maintainer = fields[4],
+            .url = fields[5],
+            .votes = atoi(fields[6]),
+            .popularity = atof(fields[7]),
+        };
+        result_set_add(set, &package);
+    }
+
+    daemon_disconnect(&connection);
+    return 0;
+}
+
+int daemon_info(const char **names, int count, AurInfo **info, int *info_count) {
+    DaemonConnection connection;
+    char number[16];
+    const char *request[] = { "info", number };
+    char *fields[DAEMON_MAX_FIELDS];
+
+    if (daemon_connect(&connection) != 0) return 1;
+
+    snprintf(number, sizeof(number), "%d", count);
+    int n = daemon_request(&connection, request, 2, names, count);
+    if (n < 0) {
+        daemon_disconnect(&connection);
+        return 1;
+    }
+
+    AurInfo *items = calloc(n > 0 ? n : 1, sizeof(AurInfo));
+    int got = 0;
+    int failed = items == NULL;
+    while (!failed && got < n) {
+        if (daemon_read_record(connection.in, &connection.line, &connection.size, fields, 3) != 3) {
+            failed = 1;
+            break;
+        }
+        AurInfo *entry = &items[got++];
+        entry->name = strdup(fields[0]);
+        entry->version = strdup(fields[1]);
+        entry->package_base = strdup(fields[2]);
+        failed = !entry->name || !entry->version || !entry->package_base;
+    }
+    daemon_disconnect(&connection);
+
+    if (failed) {
+        free_aur_info(items, got);
+        return 1;
+    }
+
+    *info = items;
+    *info_count = n;
+    return 0;
+}
+
+int daemon_upgrades(AurUpgrade **upgrades, int *count) {
+    DaemonConnection connection;
+    const char *request[] = { "upgrades" };
+    char *fields[DAEMON_MAX_FIELDS];
+
+    if (daemon_connect(&connection) != 0) return 1;
+
+    int n = daemon_request(&connection, request, 1, NULL, 0);
+    if (n < 0) {
+        daemon_disconnect(&connection);
+        return 1;
+    }
+
+    AurUpgrade *items = calloc(n > 0 ? n : 1, sizeof(AurUpgrade));
+    int got = 0;
+    int failed = items == NULL;
+    while (!failed && got < n) {
+        if (daemon_read_record(connection.in, &connection.line, &connection.size, fields, 4) != 4) {
+            failed = 1;
+            break;
+        }
+        AurUpgrade *upgrade = &items[got++];
+        upgrade->name = strdup(fields[0]);
+        upgrade->installed = strdup(fields[1]);
+        upgrade->available = *fields[2] ? strdup(fields[2]) : NULL;
+        upgrade->outdated = atoi(fields[3]);
+        failed = !upgrade->name || !upgrade->installed || (*fields[2] && !upgrade->available);
+    }
+    daemon_disconnect(&connection);
+
+    if (failed) {
+        free_aur_upgrades(items, got);
+        return 1;
+    }
+
+    *upgrades = items;
+    *count = n;
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef METHAUR_DAEMON_H
+#define METHAUR_DAEMON_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "aur.h"
+#include "results.h"
+
+#define DAEMON_SOCKET_NAME "daemon.sock"
+#define DAEMON_TIMEOUT 30            // seconds a client waits on the daemon
+#define DAEMON_MAX_FIELDS 8
+
+// One connection carries one request. Every message is a line of tab
+// separated fields, with backslash, tab and newline escaped:
+//
+//   search <query>         ->  ok <n>, then n lines of
+//                              name repo version description maintainer url votes popularity
+//   info <n>, n names      ->  ok <n>, then n lines of name version pkgbase, sorted by name
+//   upgrades               ->  ok <n>, then n lines of name installed available outdated
+//
+// and any failure is answered with a single "error <message>" line.
+
+int daemon_socket_path(char *path, size_t size, int create);
+int daemon_write_record(FILE *fp, const char *const *fields, int count);
+int daemon_read_record(FILE *fp, char **line, size_t *size, char **fields, int max);
+
+// Ask a running methaurd. Each returns non-zero, with nothing to free,
+// when there is no daemon or it could not answer, so the caller can do
+// the work itself.
+int daemon_search(const char *query, ResultSet *set);
+int daemon_info(const char **names, int count, AurInfo **info, int *info_count);
+int daemon_upgrades(AurUpgrade **upgrades, int *count);
+
+#endif
@@ -0,0 +1,320 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "download.h"
+#include "http.h"
+#include "trace.h"
+
+typedef struct {
+    int fd;
+    CURL *handle;
+    EVP_MD_CTX *digest;
+    const char *validator_path;
+    char validator[DOWNLOAD_VALIDATOR_MAX];
+    curl_off_t offset;       // bytes already in the .part when the attempt started
+    curl_off_t written;      // ... and added by this attempt
+    int started;             // the response of this attempt has been checked
+    int failed;              // writing locally failed, retrying will not help
+} Download;
+
+int download_retryable(CURLcode result, long status) {
+    switch (result) {
+    case CURLE_HTTP_RETURNED_ERROR:
+        return status >= 500 || status == 408 || status == 429;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+void download_backoff(int attempt) {
+    long ms = DOWNLOAD_BACKOFF_MS;
+    while (attempt-- > 0 && ms < DOWNLOAD_BACKOFF_MAX_MS) ms *= 2;
+    if (ms > DOWNLOAD_BACKOFF_MAX_MS) ms = DOWNLOAD_BACKOFF_MAX_MS;
+
+    struct timespec pause = { ms / 1000, (ms % 1000) * 1000000L };
+    while (nanosleep(&pause, &pause) != 0 && errno == EINTR) {}
+}
+
+// Remember what identifies the response being received, a strong ETag or
+// else its Last-Modified date, so a resumed request can insist on it
+size_t download_header_callback(char *buffer, size_t size, size_t nitems, void *userdata) {
+    char *validator = userdata;
+    size_t length = size * nitems;
+
+    // Every response (redirects included) starts over
+    if (length >= 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+        validator[0] = '\0';
+        return length;
+    }
+
+    int etag = length > 5 && strncasecmp(buffer, "ETag:", 5) == 0;
+    int modified = length > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0;
+    if (!etag && !(modified && validator[0] == '\0')) return length;
+
+    const char *value = buffer + (etag ? 5 : 14);
+    const char *end = buffer + length;
+    while (value < end && (*value == ' ' || *value == '\t')) value++;
+    while (end > value && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ')) end--;
+
+    // If-Range only accepts strong validators
+    if (etag && end - value >= 2 && strncmp(value, "W/", 2) == 0) return length;
+    if (end - value > 0 && end - value < DOWNLOAD_VALIDATOR_MAX) {
+        memcpy(validator, value, end - value);
+        validator[end - value] = '\0';
+    }
+    return length;
+}
+
+// Ask for the rest of the file from offset on. If-Range makes the server
+// send the whole file again, instead of the rest of a file that has since
+// changed; unlike CURLOPT_RESUME_FROM, a plain range lets that 200 through.
+// The returned headers must outlive the transfer.
+struct curl_slist *download_set_range(CURL *handle, curl_off_t offset, const char *validator) {
+    char header[DOWNLOAD_VALIDATOR_MAX + 16];
+    char range[32];
+    struct curl_slist *headers = NULL;
+
+    if (validator[0] != '\0') {
+        snprintf(header, sizeof(header), "If-Range: %s", validator);
+        headers = curl_slist_append(NULL, header);
+        curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+    }
+    snprintf(range, sizeof(range), "%lld-", (long long)offset);
+    curl_easy_setopt(handle, CURLOPT_RANGE, range);
+    return headers;
+}
+
+static int restart_part(Download *download) {
+    download->offset = 0;
+    download->written = 0;
+    return ftruncate(download->fd, 0) != 0 || lseek(download->fd, 0, SEEK_SET) != 0 ||
+           EVP_DigestInit_ex(download->digest, EVP_sha256(), NULL) != 1;
+}
+
+static void save_validator(Download *download) {
+    if (download->validator[0] == '\0') {
+        unlink(download->validator_path);
+        return;
+    }
+
+    FILE *fp = fopen(download->validator_path, "w");
+    if (fp) {
+        fprintf(fp, "%s\n", download->validator);
+        fclose(fp);
+    }
+}
+
+static size_t download_write(void *contents, size_t size, size_t nmemb, void *userp) {
+    Download *download = userp;
+    size_t real_size = size * nmemb;
+
+    if (!download->started) {
+        long status = 0;
+        download->started = 1;
+        curl_easy_getinfo(download->handle, CURLINFO_RESPONSE_CODE, &status);
+
+        // A 200 to a Range request is the whole file: it has changed, or
+        // the server does not do ranges
+        if (status != 206 && download->offset > 0 && restart_part(download) != 0) {
+            download->failed = 1;
+            return 0;
+        }
+        if (download->offset == 0) save_validator(download);
+    }
+
+    for (size_t done = 0; done < real_size; ) {
+        ssize_t n = write(download->fd, (const char *)contents + done, real_size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            download->failed = 1;
+            return 0;
+        }
+        done += (size_t)n;
+    }
+
+    EVP_DigestUpdate(download->digest, contents, real_size);
+    download->written += (curl_off_t)real_size;
+    return real_size;
+}
+
+// Pick up a .part left behind by an earlier run. Its bytes are hashed
+// once here; everything after them is hashed as it arrives.
+static void resume_part(Download *download) {
+    char buffer[16384];
+    ssize_t n;
+    FILE *fp = fopen(download->validator_path, "r");
+
+    if (!fp || !fgets(download->validator, sizeof(download->validator), fp)) {
+        if (fp) fclose(fp);
+        download->validator[0] = '\0';
+        restart_part(download);
+        return;
+    }
+    fclose(fp);
+    download->validator[strcspn(download->validator, "\n")] = '\0';
+
+    while ((n = read(download->fd, buffer, sizeof(buffer))) > 0) {
+        EVP_DigestUpdate(download->digest, buffer, (size_t)n);
+        download->offset += n;
+    }
+    if (n < 0) restart_part(download);
+}
+
+static CURLcode download_attempt(Download *download, const char *url, long *status) {
+    struct curl_slist *headers = NULL;
+    CURLcode result;
+
+    // Without a validator a changed file would come back as the rest of
+    // the new version, spliced onto the old one
+    if (download->offset > 0 && download->validator[0] == '\0' && restart_part(download) != 0) {
+        download->failed = 1;
+        *status = 0;
+        return CURLE_WRITE_ERROR;
+    }
+
+    download->handle = curl_easy_init();
+    if (!download->handle) return CURLE_FAILED_INIT;
+
+    download->started = 0;
+    download->written = 0;
+    curl_easy_setopt(download->handle, CURLOPT_URL, url);
+    curl_easy_setopt(download->handle, CURLOPT_WRITEFUNCTION, download_write);
+    curl_easy_setopt(download->handle, CURLOPT_WRITEDATA, (void *)download);
+    curl_easy_setopt(download->handle, CURLOPT_HEADERFUNCTION, download_header_callback);
+    curl_easy_setopt(download->handle, CURLOPT_HEADERDATA, (void *)download->validator);
+    http_configure(download->handle);
+    // Offsets count the bytes on the wire, so they must not be decoded
+    curl_easy_setopt(download->handle, CURLOPT_ACCEPT_ENCODING, NULL);
+    curl_easy_setopt(download->handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(download->handle, CURLOPT_FAILONERROR, 1L);
+
+    if (download->offset > 0) {
+        // The header callback clears the validator once the response starts
+        headers = download_set_range(download->handle, download->offset, download->validator);
+    }
+
+    result = curl_easy_perform(download->handle);
+    *status = 0;
+    curl_easy_getinfo(download->handle, CURLINFO_RESPONSE_CODE, status);
+    trace_transfer(download->handle, trace_http_lane(url), url);
+
+    curl_easy_cleanup(download->handle);
+    curl_slist_free_all(headers);
+    download->handle = NULL;
+    return result;
+}
+
+int download_file(const char *url, const char *path, const char *sha256, char *sha256_out) {
+    char part_path[PATH_MAX];
+    char validator_path[PATH_MAX];
+    char hex[DOWNLOAD_SHA256_HEX];
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    Download download;
+    CURLcode result = CURLE_OK;
+    long status = 0;
+    int failed = 0;
+    double start = trace_now();
+
+    if (snprintf(part_path, sizeof(part_path), "%s%s", path, DOWNLOAD_PART_SUFFIX) >= (int)sizeof(part_path) ||
+        snprintf(validator_path, sizeof(validator_path), "%s%s", path, DOWNLOAD_VALIDATOR_SUFFIX) >= (int)sizeof(validator_path)) {
+        fprintf(stderr, "Error: Path too long: %s\n", path);
+        return 1;
+    }
+
+    memset(&download, 0, sizeof(Download));
+    download.validator_path = validator_path;
+    download.digest = EVP_MD_CTX_new();
+    download.fd = open(part_path, O_RDWR | O_CREAT, 0644);
+    if (download.fd < 0 || !download.digest || EVP_DigestInit_ex(download.digest, EVP_sha256(), NULL) != 1) {
+        fprintf(stderr, "Error: Failed to create %s\n", part_path);
+        if (download.fd >= 0) close(download.fd);
+        EVP_MD_CTX_free(download.digest);
+        return 1;
+    }
+
+    resume_part(&download);
+    if (download.offset > 0) {
+        printf("Resuming download of %s at %lld bytes\n", url, (long long)download.offset);
+    }
+
+    // Attempts that got some data further do not count against the limit;
+    // without a validator the next attempt starts over, so nothing did
+    for (int attempt = 0; ; attempt++) {
+        result = download_attempt(&download, url, &status);
+        if (result == CURLE_OK && !download.failed) break;
+
+        if (download.written > 0 && download.validator[0] != '\0') attempt = 0;
+        if (result == CURLE_HTTP_RETURNED_ERROR && status == 416 && download.offset > 0) {
+            // The .part is no prefix of what the server has now
+            failed = restart_part(&download);
+        } else if (download.failed || !download_retryable(result, status) || attempt + 1 >= DOWNLOAD_RETRIES) {
+            failed = 1;
+        }
+        if (failed) break;
+
+        fprintf(stderr, "Warning: Download of %s interrupted (%s), retrying\n", url, curl_easy_strerror(result));
+        download_backoff(attempt);
+        download.offset += download.written;
+    }
+
+    if (close(download.fd) != 0 && !failed) {
+        download.failed = failed = 1;
+    }
+
+    if (failed) {
+        if (download.failed) {
+            fprintf(stderr, "Error: Failed to write %s\n", part_path);
+        } else {
+            fprintf(stderr, "Error: Failed to download %s: %s\n", url, curl_easy_strerror(result));
+        }
+        // Keep what arrived for the next run, unless it cannot be resumed
+        if (download.validator[0] == '\0' || download.failed || download.offset + download.written == 0) {
+            unlink(part_path);
+            unlink(validator_path);
+        }
+        EVP_MD_CTX_free(download.digest);
+        trace_end("fetch", "download", url, start);
+        return 1;
+    }
+
+    EVP_DigestFinal_ex(download.digest, digest, &digest_length);
+    EVP_MD_CTX_free(download.digest);
+    for (unsigned int i = 0; i < digest_length && i < 32; i++) {
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    }
+
+    if (sha256 && strcasecmp(sha256, hex) != 0) {
+        fprintf(stderr, "Error: %s does not match its checksum\n  expected %s\n  got      %s\n", url, sha256, hex);
+        failed = 1;
+    } else if (rename(part_path, path) != 0) {
+        fprintf(stderr, "Error: Failed to move %s into place\n", part_path);
+        failed = 1;
+    }
+    if (failed) unlink(part_path);
+    unlink(validator_path);
+
+    if (!failed && sha256_out) memcpy(sha256_out, hex, DOWNLOAD_SHA256_HEX);
+    trace_end("fetch", "download", url, start);
+    return failed;
+}
@@ -0,0 +1,31 @@
+#ifndef METHAUR_DOWNLOAD_H
+#define METHAUR_DOWNLOAD_H
+
+#include <stddef.h>
+#include <curl/curl.h>
+
+#define DOWNLOAD_PART_SUFFIX ".part"
+#define DOWNLOAD_VALIDATOR_SUFFIX ".part.validator"
+#define DOWNLOAD_VALIDATOR_MAX 256
+#define DOWNLOAD_SHA256_HEX 65
+#define DOWNLOAD_RETRIES 5
+#define DOWNLOAD_BACKOFF_MS 500        // doubled after every failed attempt
+#define DOWNLOAD_BACKOFF_MAX_MS 8000
+
+// Download url to path. The data goes to path.part first and is hashed
+// with SHA-256 as it arrives. An interrupted transfer is resumed with a
+// Range request, after a growing pause, up to DOWNLOAD_RETRIES times; a
+// .part left by an earlier run is resumed as well, as long as the server
+// still has the same file. A server that sends neither a strong ETag nor
+// Last-Modified gets every retry from the start. When sha256 (hex) is given the file is only
+// moved into place if it matches. sha256_out, when not NULL, receives the
+// hex digest of the complete file.
+int download_file(const char *url, const char *path, const char *sha256, char *sha256_out);
+
+// Pieces shared with the streaming snapshot download
+int download_retryable(CURLcode result, long status);
+void download_backoff(int attempt);
+size_t download_header_callback(char *buffer, size_t size, size_t nitems, void *userdata);
+struct curl_slist *download_set_range(CURL *handle, curl_off_t offset, const char *validator);
+
+#endif
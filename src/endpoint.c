@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "config.h"
+#include "endpoint.h"
+#include "http.h"
+#include "trace.h"
+
+typedef struct {
+    char *url;               // points into config
+    double samples[ENDPOINT_SAMPLES];   // seconds to the first response byte
+    int sample_count;
+    int next_sample;
+    int failures;            // consecutive failed transfers or probes
+} Endpoint;
+
+typedef struct {
+    Endpoint endpoints[CONFIG_MAX_URLS];   // in config order, so an index stays valid
+    int order[CONFIG_MAX_URLS];            // fastest first
+    int count;
+} EndpointList;
+
+static EndpointList lists[ENDPOINT_ROLES];
+static int loaded = 0;
+static time_t probed_at = 0;
+
+static void ensure_loaded(void) {
+    if (loaded) return;
+
+    struct { char (*urls)[CONFIG_URL_MAX]; int count; } sources[ENDPOINT_ROLES] = {
+        [ENDPOINT_AUR] = { config.aur_urls, config.aur_url_count },
+        [ENDPOINT_ARCH] = { config.arch_urls, config.arch_url_count },
+    };
+
+    memset(lists, 0, sizeof(lists));
+    for (int role = 0; role < ENDPOINT_ROLES; role++) {
+        EndpointList *list = &lists[role];
+        list->count = sources[role].count;
+        for (int i = 0; i < list->count; i++) {
+            list->endpoints[i].url = sources[role].urls[i];
+            list->order[i] = i;
+        }
+    }
+    loaded = 1;
+}
+
+static int has_mirrors(void) {
+    for (int role = 0; role < ENDPOINT_ROLES; role++) {
+        if (lists[role].count > 1) return 1;
+    }
+    return 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// The given percentile of the recorded latencies, or -1 without any
+static double percentile(const Endpoint *endpoint, double fraction) {
+    double sorted[ENDPOINT_SAMPLES];
+    int n = endpoint->sample_count;
+    if (n == 0) return -1;
+
+    memcpy(sorted, endpoint->samples, sizeof(double) * n);
+    qsort(sorted, n, sizeof(double), compare_double);
+
+    int rank = (int)(fraction * n + 0.999999) - 1;
+    return sorted[rank < 0 ? 0 : rank];
+}
+
+static const EndpointList *sorting;
+
+// Working endpoints first, then by median latency; ones never measured
+// keep their place in the config after the measured ones
+static int compare_endpoints(const void *a, const void *b) {
+    const Endpoint *x = &sorting->endpoints[*(const int *)a];
+    const Endpoint *y = &sorting->endpoints[*(const int *)b];
+
+    if ((x->failures > 0) != (y->failures > 0)) return x->failures > 0 ? 1 : -1;
+
+    double mx = percentile(x, 0.5), my = percentile(y, 0.5);
+    if ((mx < 0) != (my < 0)) return mx < 0 ? 1 : -1;
+    if (mx != my) return mx < my ? -1 : 1;
+    return *(const int *)a - *(const int *)b;
+}
+
+static void select_fastest(void) {
+    for (int role = 0; role < ENDPOINT_ROLES; role++) {
+        EndpointList *list = &lists[role];
+        if (list->count < 2) continue;
+
+        sorting = list;
+        qsort(list->order, list->count, sizeof(int), compare_endpoints);
+    }
+
+    snprintf(config.aur_url, sizeof(config.aur_url), "%s", lists[ENDPOINT_AUR].endpoints[lists[ENDPOINT_AUR].order[0]].url);
+    snprintf(config.arch_url, sizeof(config.arch_url), "%s", lists[ENDPOINT_ARCH].endpoints[lists[ENDPOINT_ARCH].order[0]].url);
+}
+
+static Endpoint *find_url(const char *url) {
+    for (int role = 0; role < ENDPOINT_ROLES; role++) {
+        for (int i = 0; i < lists[role].count; i++) {
+            if (strcmp(lists[role].endpoints[i].url, url) == 0) return &lists[role].endpoints[i];
+        }
+    }
+    return NULL;
+}
+
+// "probed <time>", then one line per endpoint:
+// <url> <failures> <latency>...
+static void load_state(void) {
+    char path[PATH_MAX + sizeof(ENDPOINT_STATE_FILE) + 1];
+    char line[CONFIG_URL_MAX + ENDPOINT_SAMPLES * 16];
+
+    snprintf(path, sizeof(path), "%s/%s", config.cache_dir, ENDPOINT_STATE_FILE);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
+
+    long long when;
+    if (fgets(line, sizeof(line), fp) && sscanf(line, "probed %lld", &when) == 1) {
+        probed_at = (time_t)when;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *saveptr = NULL;
+        char *url = strtok_r(line, " \n", &saveptr);
+        char *failures = strtok_r(NULL, " \n", &saveptr);
+        Endpoint *endpoint = url && failures ? find_url(url) : NULL;
+        if (!endpoint) continue;
+
+        endpoint->failures = atoi(failures);
+        for (char *sample = strtok_r(NULL, " \n", &saveptr);
+             sample && endpoint->sample_count < ENDPOINT_SAMPLES;
+             sample = strtok_r(NULL, " \n", &saveptr)) {
+            endpoint->samples[endpoint->sample_count++] = atof(sample);
+        }
+        endpoint->next_sample = endpoint->sample_count % ENDPOINT_SAMPLES;
+    }
+
+    fclose(fp);
+}
+
+void endpoints_save(void) {
+    char path[PATH_MAX + sizeof(ENDPOINT_STATE_FILE) + 1];
+    char tmp_path[sizeof(path) + 4];
+
+    if (!loaded || !has_mirrors()) return;
+
+    snprintf(path, sizeof(path), "%s/%s", config.cache_dir, ENDPOINT_STATE_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) return;
+
+    fprintf(fp, "probed %lld\n", (long long)probed_at);
+    for (int role = 0; role < ENDPOINT_ROLES; role++) {
+        for (int i = 0; i < lists[role].count; i++) {
+            const Endpoint *endpoint = &lists[role].endpoints[i];
+
+            fprintf(fp, "%s %d", endpoint->url, endpoint->failures);
+            // Oldest first, so loading them back keeps the ring in order
+            for (int j = 0; j < endpoint->sample_count; j++) {
+                int slot = endpoint->sample_count < ENDPOINT_SAMPLES ? j : (endpoint->next_sample + j) % ENDPOINT_SAMPLES;
+                fprintf(fp, " %.6f", endpoint->samples[slot]);
+            }
+            putc('\n', fp);
+        }
+    }
+
+    if (fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+    }
+}
+
+static double monotonic_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+typedef struct {
+    CURL *handle;
+    int role;
+    int index;
+    char url[CONFIG_URL_MAX + 1];
+} Probe;
+
+// Only a server that answered counts; any status will do, a 5xx aside.
+// Returns non-zero for an answer.
+static int probe_done(Probe *probe, CURLcode result) {
+    long status = 0;
+    curl_off_t first_byte = 0;
+    int answered;
+
+    curl_easy_getinfo(probe->handle, CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(probe->handle, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+    trace_transfer(probe->handle, trace_http_lane(probe->url), probe->url);
+
+    answered = result == CURLE_OK && status > 0 && status < 500;
+    if (answered) {
+        endpoint_record(probe->role, probe->index, first_byte / 1e6);
+    } else {
+        endpoint_failure(probe->role, probe->index);
+    }
+    return answered;
+}
+
+// Time a HEAD request to every endpoint that has an alternative, all at
+// once. This also leaves a warm connection to each in the shared cache.
+// Once every role has an answer the rest get ENDPOINT_PROBE_GRACE more;
+// a straggler is then recorded as taking as long as it has so far.
+static void probe(void) {
+    Probe probes[ENDPOINT_ROLES * CONFIG_MAX_URLS];
+    int answered[ENDPOINT_ROLES] = { 0 };
+    int count = 0, roles = 0, running = 0, pending;
+    CURLM *multi = curl_multi_init();
+    CURLMsg *msg;
+
+    if (!multi) return;
+    double start = trace_now();
+    double began = monotonic_now();
+    double deadline = began + ENDPOINT_PROBE_TIMEOUT;
+
+    for (int role = 0; role < ENDPOINT_ROLES; role++) {
+        if (lists[role].count < 2) continue;
+        roles++;
+
+        for (int i = 0; i < lists[role].count; i++) {
+            Probe *probe = &probes[count];
+            probe->handle = curl_easy_init();
+            if (!probe->handle) continue;
+
+            probe->role = role;
+            probe->index = i;
+            snprintf(probe->url, sizeof(probe->url), "%s/", lists[role].endpoints[i].url);
+            http_configure(probe->handle);
+            curl_easy_setopt(probe->handle, CURLOPT_URL, probe->url);
+            curl_easy_setopt(probe->handle, CURLOPT_NOBODY, 1L);
+            curl_easy_setopt(probe->handle, CURLOPT_TIMEOUT, (long)ENDPOINT_PROBE_TIMEOUT);
+            curl_easy_setopt(probe->handle, CURLOPT_PRIVATE, (void *)probe);
+            if (curl_multi_add_handle(multi, probe->handle) != CURLM_OK) {
+                curl_easy_cleanup(probe->handle);
+                continue;
+            }
+            count++;
+        }
+    }
+
+    do {
+        if (curl_multi_perform(multi, &running) != CURLM_OK) break;
+
+        while ((msg = curl_multi_info_read(multi, &pending)) != NULL) {
+            Probe *probe = NULL;
+            if (msg->msg != CURLMSG_DONE) continue;
+
+            CURLcode result = msg->data.result;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&probe);
+            if (probe_done(probe, result) && answered[probe->role]++ == 0 && --roles == 0) {
+                double grace = monotonic_now() + ENDPOINT_PROBE_GRACE;
+                if (grace < deadline) deadline = grace;
+            }
+            curl_multi_remove_handle(multi, probe->handle);
+            curl_easy_cleanup(probe->handle);
+            probe->handle = NULL;
+        }
+
+        double left = deadline - monotonic_now();
+        if (running > 0 && left > 0) curl_multi_poll(multi, NULL, 0, (int)(left * 1000) + 1, NULL);
+    } while (running > 0 && monotonic_now() < deadline);
+
+    for (int i = 0; i < count; i++) {
+        if (!probes[i].handle) continue;
+
+        endpoint_record(probes[i].role, probes[i].index, monotonic_now() - began);
+        curl_multi_remove_handle(multi, probes[i].handle);
+        curl_easy_cleanup(probes[i].handle);
+    }
+    curl_multi_cleanup(multi);
+
+    probed_at = time(NULL);
+    if (trace_enabled()) trace_end("phase", "probe", NULL, start);
+}
+
+void endpoints_init(void) {
+    loaded = 0;
+    probed_at = 0;
+    ensure_loaded();
+    if (!has_mirrors()) return;
+
+    load_state();
+    endpoints_refresh();
+}
+
+void endpoints_refresh(void) {
+    ensure_loaded();
+    if (!has_mirrors() || time(NULL) - probed_at < ENDPOINT_PROBE_INTERVAL) {
+        select_fastest();
+        return;
+    }
+
+    probe();
+    select_fastest();
+    endpoints_save();
+}
+
+// A URL on a base that is listed for more than one role matches none:
+// its path only makes sense on that role's mirrors, and there is no
+// telling which role it is
+int endpoint_match(const char *url, EndpointRole *role, int *index) {
+    int matches = 0;
+
+    ensure_loaded();
+    for (int r = 0; r < ENDPOINT_ROLES; r++) {
+        for (int i = 0; i < lists[r].count; i++) {
+            const char *base = lists[r].endpoints[i].url;
+            size_t length = strlen(base);
+            if (strncmp(url, base, length) == 0 && strchr("/?", url[length]) != NULL) {
+                *role = r;
+                *index = i;
+                matches++;
+                break;
+            }
+        }
+    }
+    return matches != 1;
+}
+
+int endpoint_rewrite(const char *url, EndpointRole role, unsigned tried, char *out, size_t size) {
+    EndpointRole current_role;
+    int current;
+
+    if (endpoint_match(url, &current_role, &current) != 0 || current_role != role) return -1;
+
+    const EndpointList *list = &lists[role];
+    const char *path = url + strlen(list->endpoints[current].url);
+    for (int rank = 0; rank < list->count; rank++) {
+        int i = list->order[rank];
+        if (tried & (1u << i)) continue;
+
+        if (snprintf(out, size, "%s%s", list->endpoints[i].url, path) >= (int)size) return -1;
+        return i;
+    }
+    return -1;
+}
+
+int endpoint_count(EndpointRole role) {
+    ensure_loaded();
+    return lists[role].count;
+}
+
+// How long to wait for a first byte before racing a duplicate elsewhere:
+// the endpoint's p95, once there are enough samples to tell
+double endpoint_hedge_delay(EndpointRole role, int index) {
+    const Endpoint *endpoint = &lists[role].endpoints[index];
+    if (endpoint->sample_count < ENDPOINT_MIN_SAMPLES) return ENDPOINT_HEDGE_DEFAULT;
+
+    double p95 = percentile(endpoint, 0.95);
+    return p95 < ENDPOINT_HEDGE_MIN ? ENDPOINT_HEDGE_MIN : p95;
+}
+
+void endpoint_record(EndpointRole role, int index, double latency) {
+    Endpoint *endpoint = &lists[role].endpoints[index];
+
+    endpoint->samples[endpoint->next_sample] = latency;
+    endpoint->next_sample = (endpoint->next_sample + 1) % ENDPOINT_SAMPLES;
+    if (endpoint->sample_count < ENDPOINT_SAMPLES) endpoint->sample_count++;
+    endpoint->failures = 0;
+}
+
+void endpoint_failure(EndpointRole role, int index) {
+    lists[role].endpoints[index].failures++;
+}
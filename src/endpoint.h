@@ -0,0 +1,42 @@
+#ifndef METHAUR_ENDPOINT_H
+#define METHAUR_ENDPOINT_H
+
+#include <stddef.h>
+
+#define ENDPOINT_STATE_FILE "endpoints"
+#define ENDPOINT_SAMPLES 32            // latencies remembered per endpoint
+#define ENDPOINT_MIN_SAMPLES 4         // before the p95 is trusted
+#define ENDPOINT_PROBE_INTERVAL 3600   // seconds between latency probes
+#define ENDPOINT_PROBE_TIMEOUT 5
+#define ENDPOINT_PROBE_GRACE 0.2       // seconds stragglers get after the fastest
+#define ENDPOINT_HEDGE_MIN 0.05        // seconds, never hedge sooner
+#define ENDPOINT_HEDGE_DEFAULT 1.0     // ... or later than this without samples
+
+typedef enum {
+    ENDPOINT_AUR,
+    ENDPOINT_ARCH,
+    ENDPOINT_ROLES
+} EndpointRole;
+
+// The AurURL and ArchURL lists, each kept ordered fastest first. The
+// fastest one is copied to config.aur_url/arch_url, so every URL built
+// from those goes to it; the engine hedges to the others.
+//
+// endpoints_init() loads the recorded latencies from <CacheDir>/endpoints
+// and probes every endpoint again once the record is older than
+// ENDPOINT_PROBE_INTERVAL. Only roles with a mirror are ever probed.
+void endpoints_init(void);
+void endpoints_refresh(void);
+void endpoints_save(void);
+
+// Which endpoint a URL goes to; returns non-zero when it is on none
+int endpoint_match(const char *url, EndpointRole *role, int *index);
+// The same URL on the fastest endpoint not yet in tried (a bit per
+// index). Returns the endpoint index, or -1 when all have been tried.
+int endpoint_rewrite(const char *url, EndpointRole role, unsigned tried, char *out, size_t size);
+int endpoint_count(EndpointRole role);
+double endpoint_hedge_delay(EndpointRole role, int index);
+void endpoint_record(EndpointRole role, int index, double latency);
+void endpoint_failure(EndpointRole role, int index);
+
+#endif
@@ -0,0 +1,107 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "gitcache.h"
+#include "trace.h"
+#include "util.h"
+
+static int repo_path(const char *pkgbase, char *path, size_t size) {
+    return snprintf(path, size, "%s/%s/%s.git", config.cache_dir, GIT_CACHE_SUBDIR, pkgbase) >= (int)size;
+}
+
+static int git_rev(const char *repo, const char *rev, char *out, size_t size) {
+    char git_dir[PATH_MAX + 16];
+    char *output = NULL;
+
+    snprintf(git_dir, sizeof(git_dir), "--git-dir=%s", repo);
+    char *argv[] = { "git", git_dir, "rev-parse", "--verify", "--quiet", (char *)rev, NULL };
+
+    int status = run_capture(argv, NULL, &output);
+    if (status == 0 && output) {
+        output[strcspn(output, "\n")] = '\0';
+        snprintf(out, size, "%s", output);
+    }
+    free(output);
+    return status != 0 || !*out;
+}
+
+static int git_clone(const char *pkgbase, const char *repo) {
+    char url[PATH_MAX];
+    char parent[PATH_MAX];
+
+    if (snprintf(url, sizeof(url), "%s/%s.git", config.aur_url, pkgbase) >= (int)sizeof(url)) return 1;
+
+    snprintf(parent, sizeof(parent), "%s", repo);
+    *strrchr(parent, '/') = '\0';
+    if (mkdir_p(parent, 0755) != 0) return 1;
+
+    char *argv[] = { "git", "clone", "--quiet", "--bare", url, (char *)repo, NULL };
+    return run_command(argv, NULL);
+}
+
+// Only the new objects are transferred. Without force the branch must
+// fast-forward.
+static int git_fetch(const char *repo, int force) {
+    char git_dir[PATH_MAX + 16];
+    char *refspec = force ? "+" GIT_BRANCH ":" GIT_BRANCH : GIT_BRANCH ":" GIT_BRANCH;
+
+    snprintf(git_dir, sizeof(git_dir), "--git-dir=%s", repo);
+    char *argv[] = { "git", git_dir, "fetch", "--quiet", "origin", refspec, NULL };
+    return run_command(argv, NULL);
+}
+
+static void remove_repo(const char *repo) {
+    char *argv[] = { "rm", "-rf", (char *)repo, NULL };
+    run_command(argv, NULL);
+}
+
+static int checkout(const char *pkgbase, const char *dest_dir) {
+    char repo[PATH_MAX];
+    char git_dir[PATH_MAX + 16];
+    char work_tree[PATH_MAX + 16];
+    char before[64] = "";
+    char after[64] = "";
+
+    if (repo_path(pkgbase, repo, sizeof(repo)) != 0) return 1;
+
+    if (git_rev(repo, GIT_BRANCH, before, sizeof(before)) == 0) {
+        if (git_fetch(repo, 0) != 0) {
+            fprintf(stderr, "Warning: Fast-forward of %s failed, retrying with a forced fetch\n", pkgbase);
+            if (git_fetch(repo, 1) != 0) return 1;
+        }
+    } else {
+        remove_repo(repo);
+        if (git_clone(pkgbase, repo) != 0) return 1;
+    }
+
+    if (git_rev(repo, GIT_BRANCH, after, sizeof(after)) != 0) {
+        fprintf(stderr, "Error: %s has no recipe in the AUR\n", pkgbase);
+        return 1;
+    }
+
+    if (*before && strcmp(before, after) != 0) {
+        printf("%s: %.12s..%.12s\n", pkgbase, before, after);
+    }
+
+    if (mkdir_p(dest_dir, 0755) != 0) return 1;
+
+    snprintf(git_dir, sizeof(git_dir), "--git-dir=%s", repo);
+    snprintf(work_tree, sizeof(work_tree), "--work-tree=%s", dest_dir);
+    char *argv[] = { "git", git_dir, work_tree, "checkout", "--quiet", "--force", GIT_BRANCH, "--", ".", NULL };
+    return run_command(argv, NULL);
+}
+
+// Bring the cached clone of pkgbase up to date (cloning it on first use)
+// and check the recipe out into dest_dir. A history rewrite upstream is
+// fetched over the old branch; a damaged clone is replaced.
+int git_cache_checkout(const char *pkgbase, const char *dest_dir) {
+    double start = trace_now();
+    int status = checkout(pkgbase, dest_dir);
+
+    trace_end("fetch", "git", pkgbase, start);
+    return status;
+}
@@ -0,0 +1,9 @@
+#ifndef METHAUR_GITCACHE_H
+#define METHAUR_GITCACHE_H
+
+#define GIT_CACHE_SUBDIR "git"
+#define GIT_BRANCH "master"
+
+int git_cache_checkout(const char *pkgbase, const char *dest_dir);
+
+#endif
@@ -0,0 +1,801 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "endpoint.h"
+#include "http.h"
+#include "trace.h"
+
+static CURLSH *share = NULL;
+
+static double monotonic_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Append to a body, doubling its capacity so a large response costs a
+// logarithmic number of reallocations instead of one per chunk
+static int curl_data_append(CurlData *mem, const char *contents, size_t size) {
+    if (mem->size + size + 1 > mem->capacity) {
+        size_t capacity = mem->capacity ? mem->capacity : HTTP_INITIAL_BUFFER;
+        while (capacity < mem->size + size + 1) capacity *= 2;
+
+        char *ptr = realloc(mem->data, capacity);
+        if (!ptr) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        mem->data = ptr;
+        mem->capacity = capacity;
+    }
+
+    memcpy(&(mem->data[mem->size]), contents, size);
+    mem->size += size;
+    mem->data[mem->size] = 0;
+    return 0;
+}
+
+// Hand a piece of the body to the consumer, which parses it in place
+static int http_deliver(HttpRequest *request, const char *data, size_t size) {
+    double start = trace_now();
+    int stop = request->on_chunk(data, size, request->chunk_userdata) != 0;
+
+    if (trace_enabled()) {
+        trace_event("parse", "json", request->url, request->trace_lane, start, trace_now() - start);
+    }
+    return stop;
+}
+
+static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t real_size = size * nmemb;
+    HttpRequest *request = (HttpRequest *)userp;
+
+    if (request == NULL || request->cancelled) return 0;
+
+    long status = 0;
+    curl_easy_getinfo(request->handle, CURLINFO_RESPONSE_CODE, &status);
+
+    // The first duplicate to get a real answer wins the race; the other
+    // is removed by the engine once control is back in its loop
+    if (!request->received && status < 500) {
+        request->received = 1;
+        if (request->twin) {
+            request->twin->cancelled = 1;
+            request->twin->twin = NULL;
+            request->twin = NULL;
+        }
+    }
+
+    if (request->on_chunk && !request->chunk_done) {
+        if (status == 200 && http_deliver(request, contents, real_size)) {
+            request->chunk_done = 1;
+        }
+    }
+
+    // A streamed response only needs buffering when it is going to the
+    // cache; otherwise stop the transfer as soon as the consumer is done
+    if (request->on_chunk && !request->cache) {
+        return request->chunk_done ? 0 : real_size;
+    }
+
+    return curl_data_append(&request->body, contents, real_size) == 0 ? real_size : 0;
+}
+
+int curl_data_init(CurlData *data) {
+    data->data = malloc(1);
+    if (!data->data) {
+        data->size = 0;
+        data->capacity = 0;
+        return 1;
+    }
+
+    data->size = 0;
+    data->capacity = 1;
+    data->data[0] = '\0';
+    return 0;
+}
+
+void curl_data_free(CurlData *data) {
+    if (data == NULL) return;
+
+    free(data->data);
+    data->data = NULL;
+    data->size = 0;
+    data->capacity = 0;
+}
+
+static void http_request_free(HttpRequest *request) {
+    if (request == NULL) return;
+
+    if (request->twin) request->twin->twin = NULL;
+    if (request->handle) curl_easy_cleanup(request->handle);
+    if (request->headers) curl_slist_free_all(request->headers);
+    if (request->cache) {
+        cache_entry_free(request->cache);
+        free(request->cache);
+    }
+    curl_data_free(&request->body);
+    free(request->url);
+    free(request);
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+// TLS session tickets are kept in <CacheDir>/tls-sessions between runs,
+// so the first handshake of the next invocation is resumed as well. Each
+// record is the session key, the salted host hash and the session, as
+// length-prefixed blobs, followed by the expiry time.
+static void tls_session_path(char *path, size_t size) {
+    snprintf(path, size, "%s/%s", config.cache_dir, HTTP_TLS_SESSION_FILE);
+}
+
+static int write_blob(FILE *fp, const void *data, size_t size) {
+    uint32_t length = (uint32_t)size;
+    if (fwrite(&length, sizeof(length), 1, fp) != 1) return 1;
+    return size > 0 && fwrite(data, 1, size, fp) != size;
+}
+
+static unsigned char *read_blob(FILE *fp, size_t *size) {
+    uint32_t length;
+    if (fread(&length, sizeof(length), 1, fp) != 1 || length > HTTP_TLS_MAX_BLOB) return NULL;
+
+    unsigned char *data = malloc(length + 1);
+    if (!data) return NULL;
+    if (length > 0 && fread(data, 1, length, fp) != length) {
+        free(data);
+        return NULL;
+    }
+    data[length] = '\0';
+    *size = length;
+    return data;
+}
+
+static CURLcode export_session(CURL *handle, void *userptr, const char *session_key,
+                               const unsigned char *shmac, size_t shmac_len,
+                               const unsigned char *sdata, size_t sdata_len,
+                               curl_off_t valid_until, int ietf_tls_id,
+                               const char *alpn, size_t earlydata_max) {
+    FILE *fp = userptr;
+    int64_t expires = valid_until;
+    (void)handle;
+    (void)ietf_tls_id;
+    (void)alpn;
+    (void)earlydata_max;
+
+    if (write_blob(fp, session_key, session_key ? strlen(session_key) : 0) ||
+        write_blob(fp, shmac, shmac_len) ||
+        write_blob(fp, sdata, sdata_len) ||
+        fwrite(&expires, sizeof(expires), 1, fp) != 1) {
+        return CURLE_WRITE_ERROR;
+    }
+    return CURLE_OK;
+}
+
+// Best effort both ways: a missing or damaged file only costs a full
+// handshake
+static void load_tls_sessions(void) {
+    char path[PATH_MAX];
+    char magic[sizeof(HTTP_TLS_SESSION_MAGIC) - 1];
+
+    tls_session_path(path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return;
+
+    CURL *handle = curl_easy_init();
+    if (!handle || fread(magic, sizeof(magic), 1, fp) != 1 ||
+        memcmp(magic, HTTP_TLS_SESSION_MAGIC, sizeof(magic)) != 0) {
+        if (handle) curl_easy_cleanup(handle);
+        fclose(fp);
+        return;
+    }
+    curl_easy_setopt(handle, CURLOPT_SHARE, share);
+
+    time_t now = time(NULL);
+    for (;;) {
+        size_t key_len = 0, shmac_len = 0, sdata_len = 0;
+        int64_t expires;
+        unsigned char *key = read_blob(fp, &key_len);
+        unsigned char *shmac = key ? read_blob(fp, &shmac_len) : NULL;
+        unsigned char *sdata = shmac ? read_blob(fp, &sdata_len) : NULL;
+        int complete = sdata && fread(&expires, sizeof(expires), 1, fp) == 1;
+
+        if (complete && sdata_len > 0 && (expires == 0 || expires > now)) {
+            curl_easy_ssls_import(handle, key_len ? (const char *)key : NULL,
+                                  shmac_len ? shmac : NULL, shmac_len, sdata, sdata_len);
+        }
+        free(key);
+        free(shmac);
+        free(sdata);
+        if (!complete) break;
+    }
+
+    curl_easy_cleanup(handle);
+    fclose(fp);
+}
+
+// Written next to the old file and renamed over it, readable only by us:
+// a session ticket is as good as a credential for resuming the session
+static void save_tls_sessions(void) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX + 8];
+
+    tls_session_path(path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    FILE *fp = fdopen(fd, "wb");
+    CURL *handle = curl_easy_init();
+    if (!fp || !handle) {
+        if (handle) curl_easy_cleanup(handle);
+        if (fp) fclose(fp); else close(fd);
+        unlink(tmp_path);
+        return;
+    }
+    curl_easy_setopt(handle, CURLOPT_SHARE, share);
+
+    int failed = fwrite(HTTP_TLS_SESSION_MAGIC, sizeof(HTTP_TLS_SESSION_MAGIC) - 1, 1, fp) != 1 ||
+                 curl_easy_ssls_export(handle, export_session, fp) != CURLE_OK;
+    curl_easy_cleanup(handle);
+
+    if (fclose(fp) != 0 || failed || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+    }
+}
+#endif
+
+// Keep open connections, DNS answers and TLS sessions in one place for
+// the life of the process instead of per engine, so a later engine (or a
+// later daemon request) reuses what an earlier one set up. Needs the
+// config loaded, for the cache directory the TLS sessions live in.
+int http_share_init(void) {
+    if (share) return 0;
+
+    share = curl_share_init();
+    if (!share) {
+        fprintf(stderr, "Error: Failed to initialize curl share handle\n");
+        return 1;
+    }
+
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x080c00
+    load_tls_sessions();
+#endif
+    endpoints_init();
+    return 0;
+}
+
+void http_share_cleanup(void) {
+    if (share) {
+        endpoints_save();
+#if LIBCURL_VERSION_NUM >= 0x080c00
+        save_tls_sessions();
+#endif
+        curl_share_cleanup(share);
+        share = NULL;
+    }
+}
+
+// Settings every transfer gets, whichever module drives it: the shared
+// connection/DNS/TLS cache, HTTP/2 where the server offers it (waiting
+// for a connection that can be multiplexed rather than opening another),
+// and any content encoding this libcurl can decode, with a deadline on
+// connecting and on a stalled transfer
+void http_configure(CURL *handle) {
+    curl_easy_setopt(handle, CURLOPT_USERAGENT, HTTP_USER_AGENT);
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+    if (config.request_timeout > 0) {
+        // Bulk downloads get no overall deadline, only one on stalling
+        curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, config.request_timeout);
+        curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, config.request_timeout);
+    }
+    if (share) {
+        curl_easy_setopt(handle, CURLOPT_SHARE, share);
+    }
+}
+
+int http_engine_init(HttpEngine *engine) {
+    engine->requests = NULL;
+    engine->ready = NULL;
+    engine->multi = curl_multi_init();
+    if (!engine->multi) {
+        fprintf(stderr, "Error: Failed to initialize curl multi handle\n");
+        return 1;
+    }
+
+    // Both search backends and batched info queries mostly hit the same
+    // two hosts; let curl multiplex or queue instead of opening a
+    // connection per request.
+    curl_multi_setopt(engine->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)HTTP_MAX_HOST_CONNECTIONS);
+    curl_multi_setopt(engine->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    return 0;
+}
+
+static HttpRequest *http_request_new(const char *url, HttpCallback on_done, void *userdata) {
+    HttpRequest *request = calloc(1, sizeof(HttpRequest));
+    if (!request) {
+        fprintf(stderr, "Error: Failed to allocate memory\n");
+        return NULL;
+    }
+
+    request->url = strdup(url);
+    request->handle = curl_easy_init();
+    if (!request->url || !request->handle || curl_data_init(&request->body) != 0) {
+        fprintf(stderr, "Error: Failed to initialize curl\n");
+        http_request_free(request);
+        return NULL;
+    }
+
+    request->on_done = on_done;
+    request->userdata = userdata;
+    request->trace_lane = trace_http_lane(url);
+    request->timeout = config.request_timeout;
+
+    EndpointRole role;
+    if (endpoint_match(url, &role, &request->endpoint) == 0) {
+        request->endpoint_role = role;
+        request->endpoints_tried = 1u << request->endpoint;
+    } else {
+        request->endpoint_role = -1;
+    }
+
+    curl_easy_setopt(request->handle, CURLOPT_URL, request->url);
+    curl_easy_setopt(request->handle, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(request->handle, CURLOPT_WRITEDATA, (void *)request);
+    curl_easy_setopt(request->handle, CURLOPT_PRIVATE, (void *)request);
+    http_configure(request->handle);
+
+    return request;
+}
+
+static HttpRequest *http_engine_submit(HttpEngine *engine, HttpRequest *request) {
+    if (request->headers) {
+        curl_easy_setopt(request->handle, CURLOPT_HTTPHEADER, request->headers);
+    }
+    curl_easy_setopt(request->handle, CURLOPT_TIMEOUT, request->timeout);
+
+    // Worth hedging only while there is an endpoint left to try
+    request->started = monotonic_now();
+    request->hedge_at = 0;
+    if (request->endpoint_role >= 0) {
+        unsigned all = (1u << endpoint_count(request->endpoint_role)) - 1;
+        if ((request->endpoints_tried & all) != all) {
+            request->hedge_at = request->started + endpoint_hedge_delay(request->endpoint_role, request->endpoint);
+        }
+    }
+
+    CURLMcode mc = curl_multi_add_handle(engine->multi, request->handle);
+    if (mc != CURLM_OK) {
+        fprintf(stderr, "Error: curl_multi_add_handle() failed: %s\n", curl_multi_strerror(mc));
+        http_request_free(request);
+        return NULL;
+    }
+
+    request->next = engine->requests;
+    engine->requests = request;
+    return request;
+}
+
+HttpRequest *http_engine_add(HttpEngine *engine, const char *url, HttpCallback on_done, void *userdata) {
+    HttpRequest *request = http_request_new(url, on_done, userdata);
+    if (!request) return NULL;
+
+    return http_engine_submit(engine, request);
+}
+
+static void http_add_header(HttpRequest *request, const char *name, const char *value) {
+    char header[HTTP_CACHE_MAX_HEADER];
+    snprintf(header, sizeof(header), "%s: %s", name, value);
+
+    struct curl_slist *headers = curl_slist_append(request->headers, header);
+    if (headers) request->headers = headers;
+}
+
+static void http_request_revalidate(HttpRequest *request) {
+    CacheEntry *entry = request->cache;
+
+    if (entry->exists) {
+        if (entry->etag) http_add_header(request, "If-None-Match", entry->etag);
+        if (entry->last_modified) http_add_header(request, "If-Modified-Since", entry->last_modified);
+    }
+}
+
+// Like http_engine_add, but go through the on-disk response cache. A fresh
+// entry completes without touching the network; a stale one is revalidated
+// with If-None-Match/If-Modified-Since so an unchanged resource costs a
+// 304 and no body transfer.
+HttpRequest *http_engine_add_cached(HttpEngine *engine, const char *url, HttpCallback on_done, void *userdata) {
+    HttpRequest *request = http_request_new(url, on_done, userdata);
+    if (!request) return NULL;
+
+    request->cache = malloc(sizeof(CacheEntry));
+    if (!request->cache || cache_entry_open(url, request->cache) != 0) {
+        free(request->cache);
+        request->cache = NULL;
+        return http_engine_submit(engine, request);
+    }
+
+    CacheEntry *entry = request->cache;
+    if (entry->exists && entry->fresh) {
+        char *data;
+        size_t size;
+        if (cache_entry_read_body(entry, &data, &size) == 0) {
+            curl_data_free(&request->body);
+            request->body.data = data;
+            request->body.size = size;
+            request->body.capacity = size + 1;
+            request->result = CURLE_OK;
+            request->status = 200;
+            request->from_cache = 1;
+
+            request->next = engine->ready;
+            engine->ready = request;
+            return request;
+        }
+    }
+
+    http_request_revalidate(request);
+    return http_engine_submit(engine, request);
+}
+
+// Send the same request to the fastest endpoint it has not been to yet.
+// The copy reports to the same callbacks under the same URL.
+static HttpRequest *http_request_retarget(HttpEngine *engine, HttpRequest *request) {
+    size_t size = strlen(request->url) + CONFIG_URL_MAX;
+    char *url = malloc(size);
+    if (!url) return NULL;
+
+    int index = endpoint_rewrite(request->url, request->endpoint_role, request->endpoints_tried, url, size);
+    HttpRequest *copy = index >= 0 ? http_request_new(request->url, request->on_done, request->userdata) : NULL;
+    if (!copy) {
+        free(url);
+        return NULL;
+    }
+
+    curl_easy_setopt(copy->handle, CURLOPT_URL, url);
+    free(url);
+    copy->timeout = request->timeout;
+    copy->on_chunk = request->on_chunk;
+    copy->chunk_userdata = request->chunk_userdata;
+    copy->endpoint = index;
+    copy->endpoints_tried = request->endpoints_tried | 1u << index;
+    request->endpoints_tried = copy->endpoints_tried;
+
+    if (request->cache) {
+        copy->cache = malloc(sizeof(CacheEntry));
+        if (!copy->cache || cache_entry_open(copy->url, copy->cache) != 0) {
+            free(copy->cache);
+            copy->cache = NULL;
+        } else {
+            http_request_revalidate(copy);
+        }
+    }
+
+    return http_engine_submit(engine, copy);
+}
+
+static const char *http_response_header(CURL *handle, const char *name) {
+    struct curl_header *header = NULL;
+    if (curl_easy_header(handle, name, 0, CURLH_HEADER, -1, &header) != CURLHE_OK) {
+        return NULL;
+    }
+    return header->value;
+}
+
+// Serve a 304 from the cache, or remember a fresh 200 for next time
+static void http_update_cache(HttpRequest *request) {
+    CacheEntry *entry = request->cache;
+
+    if (request->status == 304) {
+        char *data;
+        size_t size;
+        if (cache_entry_read_body(entry, &data, &size) != 0) {
+            fprintf(stderr, "Error: Failed to read cached response for %s\n", request->url);
+            request->result = CURLE_READ_ERROR;
+            return;
+        }
+
+        curl_data_free(&request->body);
+        request->body.data = data;
+        request->body.size = size;
+        request->body.capacity = size + 1;
+        request->status = 200;
+        request->from_cache = 1;
+        request->not_modified = 1;
+        cache_entry_touch(entry);
+    } else if (request->status == 200) {
+        // curl reuses its header struct between lookups, so copy the first
+        const char *etag = http_response_header(request->handle, "ETag");
+        char *etag_copy = etag ? strdup(etag) : NULL;
+        const char *last_modified = http_response_header(request->handle, "Last-Modified");
+
+        if (cache_entry_store(entry, etag_copy, last_modified, request->body.data, request->body.size) != 0) {
+            fprintf(stderr, "Warning: Failed to cache response for %s\n", request->url);
+        }
+        free(etag_copy);
+    }
+}
+
+// A body that came from the cache has not been streamed yet
+static void http_stream_body(HttpRequest *request) {
+    if (request->on_chunk && !request->chunk_done && request->from_cache && http_request_ok(request)) {
+        request->chunk_done = http_deliver(request, request->body.data, request->body.size);
+    }
+}
+
+static void http_engine_unlink(HttpEngine *engine, HttpRequest *request) {
+    HttpRequest **link = &engine->requests;
+    while (*link) {
+        if (*link == request) {
+            *link = request->next;
+            request->next = NULL;
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+// Stop the loser of a race. It took at least this long, which is worth
+// knowing when endpoints are ranked next time.
+static void http_engine_drop(HttpEngine *engine, HttpRequest *request) {
+    if (request->endpoint_role >= 0) {
+        endpoint_record(request->endpoint_role, request->endpoint, monotonic_now() - request->started);
+    }
+    curl_multi_remove_handle(engine->multi, request->handle);
+    http_engine_unlink(engine, request);
+    http_request_free(request);
+}
+
+// Returns non-zero when a duplicate is still running or a retry on
+// another endpoint was started in place of the failed request
+static int http_engine_failover(HttpEngine *engine, HttpRequest *request) {
+    if (request->twin) return 1;
+
+    if (http_request_retarget(engine, request) == NULL) return 0;
+
+    if (request->result != CURLE_OK) {
+        fprintf(stderr, "Warning: %s: %s, trying a mirror\n", request->url, curl_easy_strerror(request->result));
+    } else {
+        fprintf(stderr, "Warning: %s: HTTP %ld, trying a mirror\n", request->url, request->status);
+    }
+    return 1;
+}
+
+static void http_engine_reap(HttpEngine *engine) {
+    HttpRequest *request = engine->requests;
+    while (request) {
+        HttpRequest *next = request->next;
+        if (request->cancelled) http_engine_drop(engine, request);
+        request = next;
+    }
+}
+
+// Race a duplicate against every transfer that has waited longer for
+// its first byte than its endpoint usually takes. Returns how long the
+// engine may sleep before the next one is due, in milliseconds.
+static int http_engine_hedge(HttpEngine *engine) {
+    double now = monotonic_now();
+    int wait = 1000;
+
+    for (HttpRequest *request = engine->requests; request; request = request->next) {
+        if (request->hedge_at == 0 || request->received || request->twin || request->cancelled) continue;
+
+        if (now >= request->hedge_at) {
+            request->hedge_at = 0;
+            HttpRequest *copy = http_request_retarget(engine, request);
+            if (copy) {
+                copy->twin = request;
+                request->twin = copy;
+            }
+        } else if ((request->hedge_at - now) * 1000 < wait) {
+            wait = (int)((request->hedge_at - now) * 1000) + 1;
+        }
+    }
+    return wait;
+}
+
+// Hand every finished transfer to its callback. Returns the number of
+// requests that failed at the transport or HTTP level.
+static int http_engine_dispatch(HttpEngine *engine) {
+    CURLMsg *msg;
+    int pending;
+    int failures = 0;
+
+    while ((msg = curl_multi_info_read(engine->multi, &pending)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) continue;
+
+        // msg is invalidated by curl_multi_remove_handle, copy what we need
+        CURL *handle = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        HttpRequest *request = NULL;
+
+        curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char **)&request);
+        curl_multi_remove_handle(engine->multi, handle);
+        if (request == NULL) continue;
+
+        if (request->cancelled) {
+            http_engine_drop(engine, request);
+            continue;
+        }
+
+        // The consumer stopping the stream early is not an error
+        if (result == CURLE_WRITE_ERROR && request->chunk_done) result = CURLE_OK;
+
+        trace_transfer(handle, request->trace_lane, request->url);
+
+        request->result = result;
+        if (result == CURLE_OK) {
+            curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &request->status);
+        }
+
+        int server_failed = result != CURLE_OK || request->status >= 500;
+        if (request->endpoint_role >= 0) {
+            curl_off_t first_byte = 0;
+            curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+            if (server_failed) {
+                endpoint_failure(request->endpoint_role, request->endpoint);
+            } else {
+                endpoint_record(request->endpoint_role, request->endpoint, first_byte / 1e6);
+            }
+        }
+
+        // Nothing has reached the consumer yet, so a duplicate racing
+        // this one, or a retry on another endpoint, can still answer
+        if (server_failed && !request->received && http_engine_failover(engine, request)) {
+            http_engine_unlink(engine, request);
+            http_request_free(request);
+            continue;
+        }
+        if (request->twin) http_engine_drop(engine, request->twin);
+
+        if (result == CURLE_OK) {
+            if (request->cache) http_update_cache(request);
+        } else {
+            fprintf(stderr, "Error: curl request failed: %s\n", curl_easy_strerror(result));
+        }
+
+        if (!http_request_ok(request)) failures++;
+
+        http_engine_unlink(engine, request);
+        http_stream_body(request);
+        if (request->on_done) request->on_done(request, request->userdata);
+        http_request_free(request);
+    }
+
+    return failures;
+}
+
+// Complete requests that were answered from the cache without a transfer
+static void http_engine_dispatch_ready(HttpEngine *engine) {
+    while (engine->ready != NULL) {
+        HttpRequest *request = engine->ready;
+        engine->ready = request->next;
+        request->next = NULL;
+
+        http_stream_body(request);
+        if (request->on_done) request->on_done(request, request->userdata);
+        http_request_free(request);
+    }
+}
+
+int http_engine_run(HttpEngine *engine) {
+    int failures = 0;
+    int running = 0;
+
+    // Callbacks may queue follow-up requests, so keep going until the
+    // request list drains rather than trusting the running count.
+    while (engine->requests != NULL || engine->ready != NULL) {
+        http_engine_dispatch_ready(engine);
+        if (engine->requests == NULL) continue;
+
+        CURLMcode mc = curl_multi_perform(engine->multi, &running);
+        if (mc == CURLM_OK && running > 0) {
+            mc = curl_multi_poll(engine->multi, NULL, 0, http_engine_hedge(engine), NULL);
+        }
+
+        if (mc != CURLM_OK) {
+            fprintf(stderr, "Error: curl_multi_perform() failed: %s\n", curl_multi_strerror(mc));
+            return failures + 1;
+        }
+
+        failures += http_engine_dispatch(engine);
+        http_engine_reap(engine);
+    }
+
+    return failures;
+}
+
+void http_engine_cleanup(HttpEngine *engine) {
+    HttpRequest *request = engine->requests;
+    while (request) {
+        HttpRequest *next = request->next;
+        curl_multi_remove_handle(engine->multi, request->handle);
+        http_request_free(request);
+        request = next;
+    }
+    engine->requests = NULL;
+
+    while (engine->ready) {
+        HttpRequest *next = engine->ready->next;
+        http_request_free(engine->ready);
+        engine->ready = next;
+    }
+
+    if (engine->multi) {
+        curl_multi_cleanup(engine->multi);
+        engine->multi = NULL;
+    }
+}
+
+// Deliver the body to on_chunk instead of (only) collecting it. Call
+// before the engine runs.
+void http_request_stream(HttpRequest *request, HttpChunkCallback on_chunk, void *userdata) {
+    request->on_chunk = on_chunk;
+    request->chunk_userdata = userdata;
+}
+
+int http_request_ok(const HttpRequest *request) {
+    return request->result == CURLE_OK && request->status < 400;
+}
+
+static void http_get_done(HttpRequest *request, void *userdata) {
+    CurlData *out = (CurlData *)userdata;
+
+    if (!http_request_ok(request)) return;
+
+    // Take the body instead of copying it
+    curl_data_free(out);
+    *out = request->body;
+    request->body.data = NULL;
+    request->body.size = 0;
+    request->body.capacity = 0;
+}
+
+// Blocking single GET on top of the engine. On success out holds the
+// NUL-terminated response body and must be released with curl_data_free().
+int http_get(const char *url, CurlData *out) {
+    HttpEngine engine;
+
+    out->data = NULL;
+    out->size = 0;
+    out->capacity = 0;
+
+    if (http_engine_init(&engine) != 0) return 1;
+
+    // Used for bulk downloads, which may take longer than an API call
+    HttpRequest *request = http_request_new(url, http_get_done, out);
+    if (request) {
+        request->timeout = 0;
+        request = http_engine_submit(&engine, request);
+    }
+    if (request == NULL) {
+        http_engine_cleanup(&engine);
+        return 1;
+    }
+
+    int failures = http_engine_run(&engine);
+    http_engine_cleanup(&engine);
+
+    if (failures > 0 || out->data == NULL) {
+        curl_data_free(out);
+        return 1;
+    }
+
+    return 0;
+}
+
+// URL-encode a query argument. Caller frees with curl_free().
+char *http_escape(const char *str) {
+    return curl_easy_escape(NULL, str ? str : "", 0);
+}
@@ -0,0 +1,86 @@
+#ifndef METHAUR_HTTP_H
+#define METHAUR_HTTP_H
+
+#include <stddef.h>
+#include <curl/curl.h>
+
+#include "cache.h"
+
+#define HTTP_USER_AGENT "methaur/1.0"
+#define HTTP_MAX_HOST_CONNECTIONS 8
+#define HTTP_INITIAL_BUFFER 16384
+#define HTTP_TLS_SESSION_FILE "tls-sessions"
+#define HTTP_TLS_SESSION_MAGIC "methaur-tls 1\n"
+#define HTTP_TLS_MAX_BLOB (64 * 1024)
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} CurlData;
+
+typedef struct HttpRequest HttpRequest;
+
+// Called once per request as soon as its transfer finishes. The request
+// (and its body) is freed by the engine after the callback returns, so a
+// callback that wants to keep the body must take ownership of body.data.
+typedef void (*HttpCallback)(HttpRequest *request, void *userdata);
+
+// Receives the body of a 200 response while it arrives, or in one piece
+// when it is served from the cache. Return non-zero once no more data is
+// wanted.
+typedef int (*HttpChunkCallback)(const char *data, size_t size, void *userdata);
+
+struct HttpRequest {
+    CURL *handle;
+    char *url;
+    CurlData body;
+    CURLcode result;
+    long status;
+    int from_cache;          // body was served from the on-disk cache
+    int not_modified;        // ... after a 304 revalidation
+    CacheEntry *cache;
+    struct curl_slist *headers;
+    HttpCallback on_done;
+    void *userdata;
+    HttpChunkCallback on_chunk;
+    void *chunk_userdata;
+    int chunk_done;          // on_chunk asked to stop
+    int trace_lane;
+    long timeout;            // seconds, 0 = no deadline
+    int endpoint_role;       // EndpointRole of url, -1 when it is on none
+    int endpoint;            // endpoint this transfer actually went to
+    unsigned endpoints_tried;
+    double started;
+    double hedge_at;         // when to race a duplicate, 0 = never
+    int received;            // the response body has started arriving
+    int cancelled;           // a racing duplicate answered first
+    HttpRequest *twin;       // ... the duplicate, while both run
+    HttpRequest *next;
+};
+
+typedef struct {
+    CURLM *multi;
+    HttpRequest *requests;
+    HttpRequest *ready;      // completed without a transfer, awaiting dispatch
+} HttpEngine;
+
+int http_share_init(void);
+void http_share_cleanup(void);
+void http_configure(CURL *handle);
+
+int http_engine_init(HttpEngine *engine);
+HttpRequest *http_engine_add(HttpEngine *engine, const char *url, HttpCallback on_done, void *userdata);
+HttpRequest *http_engine_add_cached(HttpEngine *engine, const char *url, HttpCallback on_done, void *userdata);
+int http_engine_run(HttpEngine *engine);
+void http_engine_cleanup(HttpEngine *engine);
+
+void http_request_stream(HttpRequest *request, HttpChunkCallback on_chunk, void *userdata);
+int http_request_ok(const HttpRequest *request);
+int http_get(const char *url, CurlData *out);
+char *http_escape(const char *str);
+
+int curl_data_init(CurlData *data);
+void curl_data_free(CurlData *data);
+
+#endif
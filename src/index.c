@@ -0,0 +1,704 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <json-c/json.h>
+#include <zlib.h>
+
+#include "config.h"
+#include "download.h"
+#include "index.h"
+#include "jsonstream.h"
+#include "util.h"
+
+#define INDEX_MAX_TOKEN 64
+#define INDEX_MAX_QUERY_TERMS 32
+#define INFLATE_CHUNK 65536
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} StringPool;
+
+typedef struct {
+    uint32_t *slots;         // token id + 1, 0 marks an empty slot
+    uint32_t capacity;
+    uint32_t *texts;         // token id -> offset in the pool
+    uint32_t count;
+    uint32_t texts_capacity;
+} TokenTable;
+
+typedef struct {
+    IndexPackage *packages;
+    uint32_t count;
+    uint32_t capacity;
+    StringPool strings;
+    int failed;
+} IndexBuilder;
+
+static uint32_t pool_add(StringPool *pool, const char *str) {
+    size_t length = strlen(str) + 1;
+
+    if (length == 1 && pool->size > 0) return 0;   // offset 0 is always ""
+
+    if (pool->size + length > pool->capacity) {
+        size_t capacity = pool->capacity ? pool->capacity : 1 << 20;
+        while (pool->size + length > capacity) capacity *= 2;
+
+        char *data = realloc(pool->data, capacity);
+        if (!data) return UINT32_MAX;
+        pool->data = data;
+        pool->capacity = capacity;
+    }
+
+    if (pool->size + length > UINT32_MAX) return UINT32_MAX;
+
+    uint32_t offset = (uint32_t)pool->size;
+    memcpy(pool->data + pool->size, str, length);
+    pool->size += length;
+    return offset;
+}
+
+static const char *json_field(struct json_object *obj, const char *key) {
+    struct json_object *value = NULL;
+    if (!json_object_object_get_ex(obj, key, &value) || value == NULL) return "";
+
+    const char *str = json_object_get_string(value);
+    return str ? str : "";
+}
+
+static int add_dump_package(struct json_object *element, void *userdata) {
+    IndexBuilder *builder = (IndexBuilder *)userdata;
+    struct json_object *value = NULL;
+
+    if (builder->count == builder->capacity) {
+        uint32_t capacity = builder->capacity ? builder->capacity * 2 : 4096;
+        IndexPackage *packages = realloc(builder->packages, capacity * sizeof(IndexPackage));
+        if (!packages) {
+            builder->failed = 1;
+            return 1;
+        }
+        builder->packages = packages;
+        builder->capacity = capacity;
+    }
+
+    IndexPackage *package = &builder->packages[builder->count];
+    package->name = pool_add(&builder->strings, json_field(element, "Name"));
+    package->version = pool_add(&builder->strings, json_field(element, "Version"));
+    package->description = pool_add(&builder->strings, json_field(element, "Description"));
+    package->maintainer = pool_add(&builder->strings, json_field(element, "Maintainer"));
+    package->url = pool_add(&builder->strings, json_field(element, "URL"));
+    package->package_base = pool_add(&builder->strings, json_field(element, "PackageBase"));
+
+    package->votes = 0;
+    if (json_object_object_get_ex(element, "NumVotes", &value) && value) {
+        package->votes = (uint32_t)json_object_get_int(value);
+    }
+
+    package->popularity = 0;
+    if (json_object_object_get_ex(element, "Popularity", &value) && value) {
+        package->popularity = (uint32_t)(json_object_get_double(value) * 1000.0);
+    }
+
+    if (package->name == UINT32_MAX || package->version == UINT32_MAX ||
+        package->description == UINT32_MAX || package->maintainer == UINT32_MAX ||
+        package->url == UINT32_MAX || package->package_base == UINT32_MAX) {
+        builder->failed = 1;
+        return 1;
+    }
+
+    builder->count++;
+    return 0;
+}
+
+// Lowercase runs of letters and digits; anything else separates tokens
+static int next_token(const char **cursor, char *token) {
+    const char *p = *cursor;
+
+    while (*p && !isalnum((unsigned char)*p)) p++;
+    if (!*p) {
+        *cursor = p;
+        return 0;
+    }
+
+    size_t length = 0;
+    while (*p && isalnum((unsigned char)*p)) {
+        if (length + 1 < INDEX_MAX_TOKEN) {
+            token[length++] = (char)tolower((unsigned char)*p);
+        }
+        p++;
+    }
+
+    token[length] = '\0';
+    *cursor = p;
+    return 1;
+}
+
+static uint32_t hash_token(const char *str) {
+    uint32_t hash = 2166136261u;
+    for (; *str; str++) {
+        hash ^= (unsigned char)*str;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int token_table_grow(TokenTable *table, const StringPool *pool) {
+    uint32_t capacity = table->capacity ? table->capacity * 2 : 1 << 16;
+    uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+    if (!slots) return 1;
+
+    for (uint32_t id = 0; id < table->count; id++) {
+        uint32_t slot = hash_token(pool->data + table->texts[id]) & (capacity - 1);
+        while (slots[slot]) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = id + 1;
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return 0;
+}
+
+// Return the id of token, adding it to the table and pool if it is new
+static uint32_t token_table_intern(TokenTable *table, StringPool *pool, const char *token) {
+    if ((table->count + 1) * 2 > table->capacity && token_table_grow(table, pool) != 0) {
+        return UINT32_MAX;
+    }
+
+    uint32_t slot = hash_token(token) & (table->capacity - 1);
+    while (table->slots[slot]) {
+        uint32_t id = table->slots[slot] - 1;
+        if (strcmp(pool->data + table->texts[id], token) == 0) return id;
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    if (table->count == table->texts_capacity) {
+        uint32_t capacity = table->texts_capacity ? table->texts_capacity * 2 : 1 << 15;
+        uint32_t *texts = realloc(table->texts, capacity * sizeof(uint32_t));
+        if (!texts) return UINT32_MAX;
+        table->texts = texts;
+        table->texts_capacity = capacity;
+    }
+
+    uint32_t text = pool_add(pool, token);
+    if (text == UINT32_MAX) return UINT32_MAX;
+
+    table->texts[table->count] = text;
+    table->slots[slot] = table->count + 1;
+    return table->count++;
+}
+
+static const char *sort_pool;
+
+static int compare_packages(const void *a, const void *b) {
+    return strcmp(sort_pool + ((const IndexPackage *)a)->name, sort_pool + ((const IndexPackage *)b)->name);
+}
+
+static const uint32_t *sort_texts;
+
+static int compare_token_ids(const void *a, const void *b) {
+    return strcmp(sort_pool + sort_texts[*(const uint32_t *)a], sort_pool + sort_texts[*(const uint32_t *)b]);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int write_all(FILE *fp, const void *data, size_t size) {
+    return size == 0 || fwrite(data, 1, size, fp) == size ? 0 : 1;
+}
+
+// Sort the collected packages, build name/description postings and write
+// the index atomically to path.
+static int index_write(IndexBuilder *builder, const char *path, const char *source_sha256) {
+    TokenTable table = {0};
+    uint64_t *pairs = NULL;
+    size_t pair_count = 0, pair_capacity = 0;
+    uint32_t *order = NULL, *rank = NULL, *postings = NULL;
+    IndexToken *tokens = NULL;
+    int failed = 1;
+
+    sort_pool = builder->strings.data;
+    qsort(builder->packages, builder->count, sizeof(IndexPackage), compare_packages);
+
+    for (uint32_t id = 0; id < builder->count; id++) {
+        const IndexPackage *package = &builder->packages[id];
+        uint32_t fields[2] = { package->name, package->description };
+
+        for (int f = 0; f < 2; f++) {
+            char token[INDEX_MAX_TOKEN];
+            // The pool may move while tokens are added, so copy the field first
+            char *text = strdup(builder->strings.data + fields[f]);
+            if (!text) goto out_of_memory;
+
+            const char *cursor = text;
+            while (next_token(&cursor, token)) {
+                uint32_t token_id = token_table_intern(&table, &builder->strings, token);
+                if (token_id == UINT32_MAX) {
+                    free(text);
+                    goto out_of_memory;
+                }
+
+                if (pair_count == pair_capacity) {
+                    pair_capacity = pair_capacity ? pair_capacity * 2 : 1 << 20;
+                    uint64_t *grown = realloc(pairs, pair_capacity * sizeof(uint64_t));
+                    if (!grown) {
+                        free(text);
+                        goto out_of_memory;
+                    }
+                    pairs = grown;
+                }
+                pairs[pair_count++] = ((uint64_t)token_id << 32) | id;
+            }
+            free(text);
+        }
+    }
+
+    // Renumber tokens alphabetically, then group postings by the new ids
+    order = malloc((table.count ? table.count : 1) * sizeof(uint32_t));
+    rank = malloc((table.count ? table.count : 1) * sizeof(uint32_t));
+    tokens = malloc((table.count ? table.count : 1) * sizeof(IndexToken));
+    postings = malloc((pair_count ? pair_count : 1) * sizeof(uint32_t));
+    if (!order || !rank || !tokens || !postings) goto out_of_memory;
+
+    sort_pool = builder->strings.data;
+    sort_texts = table.texts;
+    for (uint32_t i = 0; i < table.count; i++) order[i] = i;
+    qsort(order, table.count, sizeof(uint32_t), compare_token_ids);
+
+    for (uint32_t i = 0; i < table.count; i++) {
+        rank[order[i]] = i;
+        tokens[i].text = table.texts[order[i]];
+        tokens[i].postings_start = 0;
+        tokens[i].postings_count = 0;
+    }
+
+    for (size_t i = 0; i < pair_count; i++) {
+        uint32_t token_id = (uint32_t)(pairs[i] >> 32);
+        pairs[i] = ((uint64_t)rank[token_id] << 32) | (uint32_t)pairs[i];
+    }
+    qsort(pairs, pair_count, sizeof(uint64_t), compare_u64);
+
+    uint32_t posting_count = 0;
+    for (size_t i = 0; i < pair_count; i++) {
+        if (i > 0 && pairs[i] == pairs[i - 1]) continue;
+
+        uint32_t token_rank = (uint32_t)(pairs[i] >> 32);
+        if (tokens[token_rank].postings_count == 0) {
+            tokens[token_rank].postings_start = posting_count;
+        }
+        tokens[token_rank].postings_count++;
+        postings[posting_count++] = (uint32_t)pairs[i];
+    }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, strlen(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.package_count = builder->count;
+    header.token_count = table.count;
+    header.posting_count = posting_count;
+    header.packages_offset = sizeof(IndexHeader);
+    header.tokens_offset = header.packages_offset + (uint64_t)builder->count * sizeof(IndexPackage);
+    header.postings_offset = header.tokens_offset + (uint64_t)table.count * sizeof(IndexToken);
+    header.strings_offset = header.postings_offset + (uint64_t)posting_count * sizeof(uint32_t);
+    header.strings_size = builder->strings.size;
+    header.generated = (int64_t)time(NULL);
+    snprintf(header.source_sha256, sizeof(header.source_sha256), "%s", source_sha256);
+
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) goto cleanup;
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Failed to create %s\n", tmp_path);
+        goto cleanup;
+    }
+
+    int write_failed = write_all(fp, &header, sizeof(header));
+    write_failed |= write_all(fp, builder->packages, builder->count * sizeof(IndexPackage));
+    write_failed |= write_all(fp, tokens, table.count * sizeof(IndexToken));
+    write_failed |= write_all(fp, postings, posting_count * sizeof(uint32_t));
+    write_failed |= write_all(fp, builder->strings.data, builder->strings.size);
+    write_failed |= fclose(fp) != 0;
+
+    if (write_failed || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Failed to write %s\n", path);
+        unlink(tmp_path);
+        goto cleanup;
+    }
+
+    printf("Indexed %u packages (%u tokens)\n", builder->count, table.count);
+    failed = 0;
+    goto cleanup;
+
+out_of_memory:
+    fprintf(stderr, "Error: Out of memory while building package index\n");
+
+cleanup:
+    free(pairs);
+    free(order);
+    free(rank);
+    free(tokens);
+    free(postings);
+    free(table.slots);
+    free(table.texts);
+    return failed;
+}
+
+// Feed a dump to the stream, inflating it first if it is gzip-compressed
+static int feed_dump(JsonStream *stream, const unsigned char *data, size_t size) {
+    if (size < 2 || data[0] != 0x1f || data[1] != 0x8b) {
+        return json_stream_feed(stream, (const char *)data, size);
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {
+        fprintf(stderr, "Error: Failed to initialize zlib\n");
+        return 1;
+    }
+
+    unsigned char *out = malloc(INFLATE_CHUNK);
+    if (!out) {
+        inflateEnd(&zs);
+        return 1;
+    }
+
+    int failed = 0;
+    int ret = Z_OK;
+    size_t offset = 0;
+
+    // Inflate to the end even once the array has closed: only the gzip
+    // trailer proves the dump arrived whole
+    while (ret != Z_STREAM_END) {
+        if (zs.avail_in == 0 && offset < size) {
+            size_t chunk = size - offset > UINT32_MAX ? UINT32_MAX : size - offset;
+            zs.next_in = (unsigned char *)data + offset;
+            zs.avail_in = (uInt)chunk;
+            offset += chunk;
+        } else if (zs.avail_in == 0 && zs.avail_out != 0) {
+            break;           // input used up and nothing left buffered
+        }
+
+        zs.next_out = out;
+        zs.avail_out = INFLATE_CHUNK;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret == Z_BUF_ERROR && zs.avail_in == 0) break;
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            fprintf(stderr, "Error: Failed to decompress metadata dump\n");
+            failed = 1;
+            break;
+        }
+
+        if (json_stream_feed(stream, (const char *)out, INFLATE_CHUNK - zs.avail_out) != 0) {
+            failed = 1;
+            break;
+        }
+    }
+
+    if (!failed && (ret != Z_STREAM_END || !stream->done)) {
+        fprintf(stderr, "Error: The metadata dump is truncated\n");
+        failed = 1;
+    }
+
+    free(out);
+    inflateEnd(&zs);
+    return failed;
+}
+
+int index_path(char *path, size_t size) {
+    return snprintf(path, size, "%s/%s", config.cache_dir, INDEX_FILE_NAME) >= (int)size;
+}
+
+// Whether the index at path was compiled from a dump with this digest
+static int index_current(const char *path, const char *source_sha256) {
+    IndexHeader header;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    int current = read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+                  memcmp(header.magic, INDEX_MAGIC, strlen(INDEX_MAGIC)) == 0 &&
+                  header.version == INDEX_VERSION &&
+                  strncmp(header.source_sha256, source_sha256, sizeof(header.source_sha256)) == 0;
+    close(fd);
+    return current;
+}
+
+// Download (or read, for a local path) the AUR metadata dump and compile
+// it into the binary index under the cache directory. A download goes to
+// <CacheDir> first, so an interrupted one is resumed by the next run.
+int index_sync(const char *source) {
+    char path[PATH_MAX];
+    char default_source[CONFIG_URL_MAX + sizeof(AUR_META_DUMP_PATH)];
+    char dump_path[PATH_MAX + sizeof(AUR_META_DUMP_PATH)];
+    char sha256[DOWNLOAD_SHA256_HEX] = "";
+    const char *file;
+    const unsigned char *data = NULL;
+    size_t size = 0;
+    void *map = NULL;
+
+    if (source == NULL) {
+        snprintf(default_source, sizeof(default_source), "%s%s", config.aur_url, AUR_META_DUMP_PATH);
+        source = default_source;
+    }
+    file = source;
+
+    if (index_path(path, sizeof(path)) != 0 || mkdir_p(config.cache_dir, 0755) != 0) {
+        fprintf(stderr, "Error: Failed to create cache directory %s\n", config.cache_dir);
+        return 1;
+    }
+
+    printf("Synchronizing AUR package index from %s...\n", source);
+
+    if (strstr(source, "://") != NULL) {
+        snprintf(dump_path, sizeof(dump_path), "%s%s", config.cache_dir, AUR_META_DUMP_PATH);
+        if (download_file(source, dump_path, NULL, sha256) != 0) return 1;
+
+        if (index_current(path, sha256)) {
+            printf("The AUR package index is already up to date\n");
+            // Its age counts from the last sync, not the last change
+            utime(path, NULL);
+            unlink(dump_path);
+            return 0;
+        }
+        file = dump_path;
+    }
+
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Failed to open %s\n", file);
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    size = (size_t)st.st_size;
+    if (size > 0) {
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (size == 0 || map == MAP_FAILED) {
+        fprintf(stderr, "Error: Failed to read %s\n", file);
+        if (file != source) unlink(file);
+        return 1;
+    }
+    data = map;
+
+    IndexBuilder builder = {0};
+    JsonStream stream;
+    int failed = json_stream_init(&stream, NULL, add_dump_package, &builder);
+
+    // Reserve offset 0 of the pool for the empty string
+    if (!failed && pool_add(&builder.strings, "") == UINT32_MAX) failed = 1;
+    if (!failed) failed = feed_dump(&stream, data, size);
+    // A dump that stops inside the array would silently lose packages
+    if (!failed && (builder.failed || stream.array_depth == 0 || !stream.done)) {
+        fprintf(stderr, "Error: %s is not a valid AUR metadata dump\n", source);
+        failed = 1;
+    }
+    json_stream_free(&stream);
+
+    munmap(map, size);
+    if (file != source) unlink(file);
+
+    if (!failed) failed = index_write(&builder, path, sha256);
+
+    free(builder.packages);
+    free(builder.strings.data);
+    return failed;
+}
+
+// Map the index read-only and check that every section lies within the
+// file. Returns non-zero if there is no usable index.
+int index_open(PackageIndex *index) {
+    char path[PATH_MAX];
+    struct stat st;
+
+    memset(index, 0, sizeof(PackageIndex));
+    if (index_path(path, sizeof(path)) != 0) return 1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return 1;
+    }
+
+    // An old index would hide every package and version published since
+    long age = (long)(time(NULL) - st.st_mtime) / 86400;
+    if (config.index_max_age > 0 && age >= config.index_max_age) {
+        fprintf(stderr, "Warning: The package index is %ld days old, searching the AUR instead "
+                        "(refresh it with --sync-index)\n", age);
+        close(fd);
+        return 1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 1;
+
+    const IndexHeader *header = map;
+    uint64_t size = (uint64_t)st.st_size;
+    int valid = memcmp(header->magic, INDEX_MAGIC, strlen(INDEX_MAGIC)) == 0 &&
+                header->version == INDEX_VERSION &&
+                header->packages_offset + (uint64_t)header->package_count * sizeof(IndexPackage) <= size &&
+                header->tokens_offset + (uint64_t)header->token_count * sizeof(IndexToken) <= size &&
+                header->postings_offset + (uint64_t)header->posting_count * sizeof(uint32_t) <= size &&
+                header->strings_offset + header->strings_size <= size &&
+                header->strings_size > 0 &&
+                ((const char *)map)[header->strings_offset + header->strings_size - 1] == '\0';
+
+    if (!valid) {
+        fprintf(stderr, "Warning: Ignoring invalid package index %s, run --sync-index\n", path);
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    index->map = map;
+    index->size = (size_t)st.st_size;
+    index->header = header;
+    index->packages = (const IndexPackage *)((const char *)map + header->packages_offset);
+    index->tokens = (const IndexToken *)((const char *)map + header->tokens_offset);
+    index->postings = (const uint32_t *)((const char *)map + header->postings_offset);
+    index->strings = (const char *)map + header->strings_offset;
+    return 0;
+}
+
+const char *index_string(const PackageIndex *index, uint32_t offset) {
+    if (offset >= index->header->strings_size) return "";
+    return index->strings + offset;
+}
+
+// First token that is >= prefix
+static uint32_t index_lower_bound(const PackageIndex *index, const char *prefix) {
+    uint32_t lo = 0, hi = index->header->token_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (strcmp(index_string(index, index->tokens[mid].text), prefix) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Packages are sorted by name, so an exact match is a binary search
+static uint32_t index_find_name(const PackageIndex *index, const char *name) {
+    uint32_t lo = 0, hi = index->header->package_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(index_string(index, index->packages[mid].name), name);
+        if (cmp == 0) return mid;
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static const PackageIndex *rank_index;
+static uint32_t rank_exact;
+
+// Exact name match first, then by votes, then alphabetically (by id)
+static int compare_ranked(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    const IndexPackage *px = &rank_index->packages[x];
+    const IndexPackage *py = &rank_index->packages[y];
+
+    if ((x == rank_exact) != (y == rank_exact)) return x == rank_exact ? -1 : 1;
+    if (px->votes != py->votes) return px->votes < py->votes ? 1 : -1;
+    return (x > y) - (x < y);
+}
+
+// Every query term must prefix-match a token of the package's name or
+// description. ids receives the matching package ids, best first.
+int index_search(const PackageIndex *index, const char *query, uint32_t **ids, int *count) {
+    char terms[INDEX_MAX_QUERY_TERMS][INDEX_MAX_TOKEN];
+    int term_count = 0;
+    const char *cursor = query;
+
+    *ids = NULL;
+    *count = 0;
+
+    while (term_count < INDEX_MAX_QUERY_TERMS && next_token(&cursor, terms[term_count])) {
+        term_count++;
+    }
+    if (term_count == 0 || index->header->package_count == 0) return 0;
+
+    uint8_t *marks = calloc(index->header->package_count, 1);
+    uint32_t *candidates = NULL;
+    uint32_t candidate_count = 0, candidate_capacity = 0;
+    if (!marks) return 1;
+
+    for (int t = 0; t < term_count; t++) {
+        size_t prefix_length = strlen(terms[t]);
+
+        for (uint32_t i = index_lower_bound(index, terms[t]); i < index->header->token_count; i++) {
+            const IndexToken *token = &index->tokens[i];
+            if (strncmp(index_string(index, token->text), terms[t], prefix_length) != 0) break;
+            if ((uint64_t)token->postings_start + token->postings_count > index->header->posting_count) continue;
+
+            for (uint32_t p = 0; p < token->postings_count; p++) {
+                uint32_t id = index->postings[token->postings_start + p];
+                if (id >= index->header->package_count || marks[id] != t) continue;
+
+                marks[id] = (uint8_t)(t + 1);
+                if (t > 0) continue;
+
+                if (candidate_count == candidate_capacity) {
+                    candidate_capacity = candidate_capacity ? candidate_capacity * 2 : 256;
+                    uint32_t *grown = realloc(candidates, candidate_capacity * sizeof(uint32_t));
+                    if (!grown) {
+                        free(candidates);
+                        free(marks);
+                        return 1;
+                    }
+                    candidates = grown;
+                }
+                candidates[candidate_count++] = id;
+            }
+        }
+    }
+
+    uint32_t matched = 0;
+    for (uint32_t i = 0; i < candidate_count; i++) {
+        if (marks[candidates[i]] == term_count) {
+            candidates[matched++] = candidates[i];
+        }
+    }
+    free(marks);
+
+    rank_index = index;
+    rank_exact = index_find_name(index, query);
+    qsort(candidates, matched, sizeof(uint32_t), compare_ranked);
+
+    if (matched == 0) {
+        free(candidates);
+        candidates = NULL;
+    }
+
+    *ids = candidates;
+    *count = (int)matched;
+    return 0;
+}
+
+void index_close(PackageIndex *index) {
+    if (index->map) {
+        munmap(index->map, index->size);
+    }
+    memset(index, 0, sizeof(PackageIndex));
+}
@@ -0,0 +1,65 @@
+#ifndef METHAUR_INDEX_H
+#define METHAUR_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AUR_META_DUMP_PATH "/packages-meta-ext-v1.json.gz"
+#define INDEX_FILE_NAME "aur.idx"
+#define INDEX_MAGIC "MAURIDX"
+#define INDEX_VERSION 2
+
+// On-disk layout; every offset is relative to the start of the file and
+// strings are NUL-terminated entries in the string pool.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t package_count;
+    uint32_t token_count;
+    uint32_t posting_count;
+    uint64_t packages_offset;
+    uint64_t tokens_offset;
+    uint64_t postings_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    int64_t generated;
+    char source_sha256[65];  // hex digest of the dump it was built from
+} IndexHeader;
+
+// Packages are sorted by name, so ids double as alphabetical order
+typedef struct {
+    uint32_t name;
+    uint32_t version;
+    uint32_t description;
+    uint32_t maintainer;
+    uint32_t url;
+    uint32_t package_base;
+    uint32_t votes;
+    uint32_t popularity;     // Popularity * 1000
+} IndexPackage;
+
+// Tokens are sorted, so a prefix is a contiguous range
+typedef struct {
+    uint32_t text;
+    uint32_t postings_start;
+    uint32_t postings_count;
+} IndexToken;
+
+typedef struct {
+    void *map;
+    size_t size;
+    const IndexHeader *header;
+    const IndexPackage *packages;
+    const IndexToken *tokens;
+    const uint32_t *postings;
+    const char *strings;
+} PackageIndex;
+
+int index_path(char *path, size_t size);
+int index_sync(const char *source);
+int index_open(PackageIndex *index);
+int index_search(const PackageIndex *index, const char *query, uint32_t **ids, int *count);
+const char *index_string(const PackageIndex *index, uint32_t offset);
+void index_close(PackageIndex *index);
+
+#endif
@@ -0,0 +1,330 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "journal.h"
+#include "util.h"
+
+typedef struct {
+    char *name;
+    int planned;
+    JournalState state;
+    char **files;            // kept under <CacheDir>/upgrade/<name>
+    int file_count;
+} JournalEntry;
+
+static const char *state_names[] = { "plan", "fetched", "built", "installed" };
+
+static int journal_fd = -1;
+static JournalEntry *entries = NULL;
+static int entry_count = 0;
+
+static int journal_dir(char *path, size_t size) {
+    return snprintf(path, size, "%s/%s", config.cache_dir, JOURNAL_DIR) >= (int)size;
+}
+
+static int journal_path(char *path, size_t size) {
+    return snprintf(path, size, "%s/%s/%s", config.cache_dir, JOURNAL_DIR, JOURNAL_FILE) >= (int)size;
+}
+
+// Make a rename or a new file in dir survive a crash
+static void sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+static JournalEntry *find_entry(const char *name, int create) {
+    for (int i = 0; i < entry_count; i++) {
+        if (strcmp(entries[i].name, name) == 0) return &entries[i];
+    }
+    if (!create) return NULL;
+
+    JournalEntry *grown = realloc(entries, (entry_count + 1) * sizeof(JournalEntry));
+    if (!grown) return NULL;
+    entries = grown;
+
+    JournalEntry *entry = &entries[entry_count];
+    memset(entry, 0, sizeof(JournalEntry));
+    entry->name = strdup(name);
+    if (!entry->name) return NULL;
+    entry_count++;
+    return entry;
+}
+
+static void free_entries(void) {
+    for (int i = 0; i < entry_count; i++) {
+        free(entries[i].name);
+        free_string_list(entries[i].files, entries[i].file_count);
+    }
+    free(entries);
+    entries = NULL;
+    entry_count = 0;
+}
+
+// Apply one "<state>\t<name>[\t<file>...]" line
+static void apply_line(char *line) {
+    char *saveptr = NULL;
+    char *state = strtok_r(line, "\t", &saveptr);
+    char *name = strtok_r(NULL, "\t", &saveptr);
+    if (!state || !name) return;
+
+    for (int s = JOURNAL_PLANNED; s <= JOURNAL_INSTALLED; s++) {
+        if (strcmp(state, state_names[s]) != 0) continue;
+
+        JournalEntry *entry = find_entry(name, 1);
+        if (!entry) return;
+
+        if (s == JOURNAL_PLANNED) {
+            entry->planned = 1;
+            return;
+        }
+        entry->state = s;
+        if (s != JOURNAL_BUILT) return;
+
+        free_string_list(entry->files, entry->file_count);
+        entry->files = NULL;
+        entry->file_count = 0;
+        for (char *file = strtok_r(NULL, "\t", &saveptr); file; file = strtok_r(NULL, "\t", &saveptr)) {
+            char **grown = realloc(entry->files, (entry->file_count + 1) * sizeof(char *));
+            if (!grown) return;
+            entry->files = grown;
+            entry->files[entry->file_count++] = strdup(file);
+        }
+        return;
+    }
+}
+
+static int append_line(const char *line) {
+    size_t length = strlen(line);
+
+    for (size_t done = 0; done < length; ) {
+        ssize_t n = write(journal_fd, line + done, length - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        done += (size_t)n;
+    }
+    return fsync(journal_fd) != 0;
+}
+
+int journal_pending(void) {
+    char path[PATH_MAX];
+    return journal_path(path, sizeof(path)) == 0 && access(path, F_OK) == 0;
+}
+
+// The plan goes into a new file that is renamed over any old journal, so
+// there is always either the old journal or the complete new plan
+int journal_begin(const char **targets, int count) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX + 4];
+
+    journal_finish(1);
+    if (journal_dir(dir, sizeof(dir)) != 0 || journal_path(path, sizeof(path)) != 0 ||
+        mkdir_p(dir, 0755) != 0) {
+        fprintf(stderr, "Warning: Failed to create the upgrade journal\n");
+        return 1;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Warning: Failed to create the upgrade journal\n");
+        return 1;
+    }
+
+    fprintf(fp, "%s\n", JOURNAL_MAGIC);
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "%s\t%s\n", state_names[JOURNAL_PLANNED], targets[i]);
+        JournalEntry *entry = find_entry(targets[i], 1);
+        if (entry) entry->planned = 1;
+    }
+
+    int failed = fflush(fp) != 0 || fsync(fileno(fp)) != 0;
+    if (fclose(fp) != 0 || failed || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Warning: Failed to write the upgrade journal\n");
+        unlink(tmp_path);
+        free_entries();
+        return 1;
+    }
+    sync_dir(dir);
+
+    journal_fd = open(path, O_WRONLY | O_APPEND);
+    if (journal_fd < 0) {
+        free_entries();
+        return 1;
+    }
+    return 0;
+}
+
+int journal_resume(char ***targets, int *count) {
+    char path[PATH_MAX];
+    char line[PATH_MAX * 4];
+
+    *targets = NULL;
+    *count = 0;
+
+    journal_finish(0);
+    if (journal_path(path, sizeof(path)) != 0) return 1;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return 1;
+
+    if (!fgets(line, sizeof(line), fp) || strncmp(line, JOURNAL_MAGIC "\n", sizeof(JOURNAL_MAGIC)) != 0) {
+        fprintf(stderr, "Error: %s is not an upgrade journal\n", path);
+        fclose(fp);
+        return 1;
+    }
+
+    // A line without its newline was cut short by the crash
+    while (fgets(line, sizeof(line), fp)) {
+        size_t length = strlen(line);
+        if (length == 0 || line[length - 1] != '\n') break;
+        line[length - 1] = '\0';
+        apply_line(line);
+    }
+    fclose(fp);
+
+    for (int i = 0; i < entry_count; i++) {
+        if (!entries[i].planned || entries[i].state == JOURNAL_INSTALLED) continue;
+
+        char **grown = realloc(*targets, (*count + 1) * sizeof(char *));
+        if (!grown) break;
+        *targets = grown;
+        (*targets)[(*count)++] = strdup(entries[i].name);
+    }
+
+    journal_fd = open(path, O_WRONLY | O_APPEND);
+    if (journal_fd < 0) {
+        fprintf(stderr, "Error: Failed to open %s\n", path);
+        free_string_list(*targets, *count);
+        *targets = NULL;
+        *count = 0;
+        free_entries();
+        return 1;
+    }
+    return 0;
+}
+
+// Built packages that nothing else keeps are copied next to the journal,
+// since the build directory does not survive a resume (or a reboot)
+static int keep_files(JournalEntry *entry, char **files, int file_count) {
+    char dir[PATH_MAX];
+    char dest[PATH_MAX];
+
+    free_string_list(entry->files, entry->file_count);
+    entry->files = calloc(file_count, sizeof(char *));
+    entry->file_count = 0;
+    if (!entry->files) return 1;
+
+    if (snprintf(dir, sizeof(dir), "%s/%s/%s", config.cache_dir, JOURNAL_DIR, entry->name) >= (int)sizeof(dir) ||
+        mkdir_p(dir, 0755) != 0) {
+        return 1;
+    }
+
+    for (int i = 0; i < file_count; i++) {
+        const char *base = strrchr(files[i], '/');
+        base = base ? base + 1 : files[i];
+
+        if (snprintf(dest, sizeof(dest), "%s/%s", dir, base) >= (int)sizeof(dest)) return 1;
+        unlink(dest);
+        if (copy_file(files[i], dest, 1) != 0) return 1;
+        entry->files[entry->file_count++] = strdup(dest);
+    }
+
+    sync_dir(dir);
+    return 0;
+}
+
+// Once a package is installed its kept copies are no longer needed
+static void drop_files(JournalEntry *entry) {
+    for (int i = 0; i < entry->file_count; i++) {
+        unlink(entry->files[i]);
+    }
+    if (entry->file_count > 0) {
+        char *slash = strrchr(entry->files[0], '/');
+        *slash = '\0';
+        rmdir(entry->files[0]);
+    }
+    free_string_list(entry->files, entry->file_count);
+    entry->files = NULL;
+    entry->file_count = 0;
+}
+
+void journal_record(const char *package_name, JournalState state, char **files, int file_count) {
+    char line[PATH_MAX * 4];
+    int length;
+
+    if (journal_fd < 0) return;
+
+    JournalEntry *entry = find_entry(package_name, 1);
+    if (!entry) return;
+
+    entry->state = state;
+    if (state == JOURNAL_BUILT && file_count > 0 && keep_files(entry, files, file_count) != 0) {
+        // Resuming will have to build it again
+        fprintf(stderr, "Warning: Failed to keep the built packages of %s for --resume\n", package_name);
+        free_string_list(entry->files, entry->file_count);
+        entry->files = NULL;
+        entry->file_count = 0;
+    }
+
+    length = snprintf(line, sizeof(line), "%s\t%s", state_names[state], package_name);
+    for (int i = 0; state == JOURNAL_BUILT && i < entry->file_count && length < (int)sizeof(line); i++) {
+        length += snprintf(line + length, sizeof(line) - length, "\t%s", entry->files[i]);
+    }
+    if (length + 1 >= (int)sizeof(line)) return;
+    line[length++] = '\n';
+    line[length] = '\0';
+
+    if (append_line(line) != 0) {
+        fprintf(stderr, "Warning: Failed to write the upgrade journal\n");
+    } else if (state == JOURNAL_INSTALLED) {
+        drop_files(entry);
+    }
+}
+
+int journal_built_files(const char *package_name, char ***files, int *count) {
+    JournalEntry *entry = find_entry(package_name, 0);
+
+    *files = NULL;
+    *count = 0;
+    if (!entry || entry->state != JOURNAL_BUILT || entry->file_count == 0) return 1;
+
+    for (int i = 0; i < entry->file_count; i++) {
+        if (access(entry->files[i], R_OK) != 0) return 1;
+    }
+
+    *files = calloc(entry->file_count, sizeof(char *));
+    if (!*files) return 1;
+    for (int i = 0; i < entry->file_count; i++) {
+        (*files)[i] = strdup(entry->files[i]);
+    }
+    *count = entry->file_count;
+    return 0;
+}
+
+void journal_finish(int complete) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+
+    if (journal_fd >= 0) close(journal_fd);
+    journal_fd = -1;
+
+    if (complete && journal_dir(dir, sizeof(dir)) == 0 && journal_path(path, sizeof(path)) == 0 &&
+        access(path, F_OK) == 0) {
+        // The journal goes first: kept files without it are just garbage
+        unlink(path);
+        sync_dir(dir);
+        char *argv[] = { "rm", "-rf", dir, NULL };
+        run_command(argv, NULL);
+    }
+    free_entries();
+}
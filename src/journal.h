@@ -0,0 +1,34 @@
+#ifndef METHAUR_JOURNAL_H
+#define METHAUR_JOURNAL_H
+
+#define JOURNAL_DIR "upgrade"
+#define JOURNAL_FILE "journal"
+#define JOURNAL_MAGIC "methaur-journal 1"
+
+typedef enum {
+    JOURNAL_PLANNED,
+    JOURNAL_FETCHED,         // upstream sources downloaded
+    JOURNAL_BUILT,
+    JOURNAL_INSTALLED
+} JournalState;
+
+// The journal of a -Ufull run lives in <CacheDir>/upgrade/journal: the
+// packages it set out to upgrade, then one line per state change of any
+// package it builds. Every line is fsync-ed before the run goes on, so
+// after a crash or reboot the journal says how far it got.
+//
+// Records are only written between journal_begin()/journal_resume() and
+// journal_finish(); otherwise journal_record() is a no-op.
+int journal_begin(const char **targets, int count);
+// Reopen the journal of an interrupted run. targets receives the planned
+// packages not installed yet. Returns non-zero if there is no journal.
+int journal_resume(char ***targets, int *count);
+int journal_pending(void);
+void journal_record(const char *package_name, JournalState state, char **files, int file_count);
+// Package files the interrupted run built for package_name but did not
+// install. Returns non-zero unless all of them are still there.
+int journal_built_files(const char *package_name, char ***files, int *count);
+// Close the journal, and delete it with its files once nothing is left
+void journal_finish(int complete);
+
+#endif
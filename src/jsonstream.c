@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "jsonstream.h"
+
+// array_key names the member of the top-level object that holds the array
+// ("results" for RPC and archweb responses); NULL streams a bare array.
+int json_stream_init(JsonStream *stream, const char *array_key, JsonElementCallback on_element, void *userdata) {
+    memset(stream, 0, sizeof(JsonStream));
+
+    if (array_key) {
+        snprintf(stream->array_key, sizeof(stream->array_key), "%s", array_key);
+    }
+
+    stream->on_element = on_element;
+    stream->userdata = userdata;
+    stream->tokener = json_tokener_new();
+    if (!stream->tokener) {
+        fprintf(stderr, "Error: Failed to allocate JSON tokener\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int json_stream_is_target(const JsonStream *stream) {
+    if (stream->array_key[0] == '\0') {
+        return stream->depth == 0;
+    }
+
+    return stream->depth == 1 && strcmp(stream->key, stream->array_key) == 0;
+}
+
+// Hand the completed element in data[start, end) to the tokener and the
+// callback. Returns non-zero when the stream should stop.
+static int json_stream_finish_element(JsonStream *stream, const char *data, size_t start, size_t end) {
+    struct json_object *element = json_tokener_parse_ex(stream->tokener, data + start, (int)(end - start));
+    if (element == NULL) {
+        fprintf(stderr, "Error: Failed to parse JSON element: %s\n",
+                json_tokener_error_desc(json_tokener_get_error(stream->tokener)));
+        stream->failed = 1;
+        return 1;
+    }
+
+    int stop = stream->on_element(element, stream->userdata);
+    json_object_put(element);
+
+    if (stop) stream->done = 1;
+    return stop;
+}
+
+// Scan a chunk for structure only; element bytes are passed to json-c
+// untouched. Returns non-zero on a parse error. Once the target array has
+// closed (or the callback asked to stop) further input is ignored.
+int json_stream_feed(JsonStream *stream, const char *data, size_t size) {
+    size_t span_start = 0;
+
+    if (stream->done || stream->failed) return stream->failed;
+
+    for (size_t i = 0; i < size; i++) {
+        char c = data[i];
+
+        if (stream->in_string) {
+            if (stream->escaped) {
+                stream->escaped = 0;
+            } else if (c == '\\') {
+                stream->escaped = 1;
+            } else if (c == '"') {
+                if (stream->capture_key && strcmp(stream->key, "error") == 0) stream->error_found = 1;
+                stream->in_string = 0;
+                stream->capture_key = 0;
+                continue;
+            }
+
+            if (stream->capture_key) {
+                if (stream->key_length + 1 < sizeof(stream->key)) {
+                    stream->key[stream->key_length++] = c;
+                    stream->key[stream->key_length] = '\0';
+                } else {
+                    stream->key[0] = '\0';
+                    stream->capture_key = 0;
+                }
+            }
+            continue;
+        }
+
+        switch (c) {
+        case '"':
+            stream->in_string = 1;
+            if (!stream->element_open && stream->array_depth == 0 && stream->depth == 1) {
+                stream->capture_key = 1;
+                stream->key_length = 0;
+                stream->key[0] = '\0';
+            }
+            break;
+        case '{':
+        case '[':
+            if (stream->array_depth == 0) {
+                int is_target = (c == '[') && json_stream_is_target(stream);
+                stream->depth++;
+                if (is_target) {
+                    stream->array_depth = stream->depth;
+                    stream->array_found = 1;
+                }
+                break;
+            }
+
+            if (!stream->element_open && stream->depth == stream->array_depth) {
+                stream->element_open = 1;
+                span_start = i;
+                json_tokener_reset(stream->tokener);
+            }
+            stream->depth++;
+            break;
+        case '}':
+        case ']':
+            stream->depth--;
+            if (stream->element_open && stream->depth == stream->array_depth) {
+                stream->element_open = 0;
+                if (json_stream_finish_element(stream, data, span_start, i + 1)) {
+                    return stream->failed;
+                }
+            } else if (stream->array_depth > 0 && stream->depth < stream->array_depth) {
+                // Only scalar members can follow; aurweb puts its error
+                // message after an empty results array
+                if (memmem(data + i, size - i, "\"error\"", 7) != NULL) stream->error_found = 1;
+                stream->done = 1;
+                return 0;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Pass the unfinished tail of an element on; json-c keeps its state
+    if (stream->element_open && span_start < size) {
+        json_tokener_parse_ex(stream->tokener, data + span_start, (int)(size - span_start));
+        if (json_tokener_get_error(stream->tokener) != json_tokener_continue) {
+            fprintf(stderr, "Error: Failed to parse JSON element: %s\n",
+                    json_tokener_error_desc(json_tokener_get_error(stream->tokener)));
+            stream->failed = 1;
+        }
+    }
+
+    return stream->failed;
+}
+
+void json_stream_free(JsonStream *stream) {
+    if (stream->tokener) {
+        json_tokener_free(stream->tokener);
+        stream->tokener = NULL;
+    }
+}
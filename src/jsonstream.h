@@ -0,0 +1,40 @@
+#ifndef METHAUR_JSONSTREAM_H
+#define METHAUR_JSONSTREAM_H
+
+#include <stddef.h>
+#include <json-c/json.h>
+
+#define JSON_STREAM_MAX_KEY 64
+
+// Return non-zero to stop the stream early; the element is released by
+// the stream after the callback returns unless the callback takes a
+// reference with json_object_get().
+typedef int (*JsonElementCallback)(struct json_object *element, void *userdata);
+
+// Incremental splitter for a JSON array of objects. Bytes can be fed in
+// arbitrary chunks; each element is parsed on its own as soon as its
+// closing brace arrives, so the whole document is never held as one DOM.
+typedef struct {
+    char array_key[JSON_STREAM_MAX_KEY];   // empty: the document itself is the array
+    JsonElementCallback on_element;
+    void *userdata;
+    json_tokener *tokener;
+    int depth;
+    int in_string;
+    int escaped;
+    int array_depth;                       // depth inside the target array, 0 until found
+    int array_found;
+    int element_open;
+    int capture_key;
+    size_t key_length;
+    char key[JSON_STREAM_MAX_KEY];
+    int done;
+    int failed;
+    int error_found;                       // the document has a top-level "error" member
+} JsonStream;
+
+int json_stream_init(JsonStream *stream, const char *array_key, JsonElementCallback on_element, void *userdata);
+int json_stream_feed(JsonStream *stream, const char *data, size_t size);
+void json_stream_free(JsonStream *stream);
+
+#endif
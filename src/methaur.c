@@ -5,389 +5,34 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <curl/curl.h>
-#include <json-c/json.h>
 #include <sys/stat.h>
 
-#define MAX_PACKAGES 50
-#define MAX_BUFFER 8192
-#define AUR_RPC_URL "https://aur.archlinux.org/rpc/?v=5&type=search&arg="
-#define AUR_PKG_URL "https://aur.archlinux.org/cgit/aur.git/snapshot/"
-#define ARCH_SEARCH_URL "https://archlinux.org/packages/search/json/?q="
-#define TMP_DIR "/tmp/methaur/"
+#include "aur.h"
+#include "build.h"
+#include "config.h"
+#include "daemon.h"
+#include "http.h"
+#include "index.h"
+#include "journal.h"
+#include "pacdb.h"
+#include "resolve.h"
+#include "search.h"
+#include "trace.h"
+#include "util.h"
+#include "vcs.h"
 
-typedef struct {
-    char *name;
-    char *version;
-    char *description;
-    int votes;
-    char *maintainer;
-    char *url;
-    char *repo;      
-} Package;
-
-typedef struct {
-    char *data;
-    size_t size;
-} CurlData;
-
-static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp);
-void search_aur(const char *query, Package **results, int *count);
-void search_arch_repos(const char *query, Package **results, int *count);
-void search_packages(const char *query, Package **results, int *count);
-void display_search_results(Package *results, int count);
 int install_package(const char *package_name, const char *repo);
 int remove_package(const char *package_name);
-void free_package_data(Package *packages, int count);
 int download_and_build_package(const char *package_name);
 void create_directories();
 void print_usage();
-char *safe_strdup(const char *str);
 int update_package(const char *package_name);
 int update_system(int full_upgrade);
 
-char *safe_strdup(const char *str) {
-    return str ? strdup(str) : strdup("");
-}
-
-static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
-    size_t real_size = size * nmemb;
-    CurlData *mem = (CurlData *)userp;
-    
-    if (mem == NULL) return 0;
-    
-    char *ptr = realloc(mem->data, mem->size + real_size + 1);
-    if (!ptr) {
-        fprintf(stderr, "Error: Out of memory\n");
-        return 0;
-    }
-    
-    mem->data = ptr;
-    memcpy(&(mem->data[mem->size]), contents, real_size);
-    mem->size += real_size;
-    mem->data[mem->size] = 0;
-    
-    return real_size;
-}
-
-CurlData* init_curl_data() {
-    CurlData* chunk = malloc(sizeof(CurlData));
-    if (!chunk) return NULL;
-    
-    chunk->data = malloc(1);
-    if (!chunk->data) {
-        free(chunk);
-        return NULL;
-    }
-    
-    chunk->size = 0;
-    chunk->data[0] = '\0';
-    return chunk;
-}
-
-void search_aur(const char *query, Package **results, int *count) {
-    CURL *curl;
-    CURLcode res;
-    char url[MAX_BUFFER];
-    
-    CurlData* chunk = init_curl_data();
-    if (!chunk) {
-        fprintf(stderr, "Error: Failed to allocate memory\n");
-        return;
-    }
-    
-    curl = curl_easy_init();
-    if (!curl) {
-        fprintf(stderr, "Error: Failed to initialize curl\n");
-        free(chunk->data);
-        free(chunk);
-        return;
-    }
-    
-    snprintf(url, MAX_BUFFER, "%s%s", AUR_RPC_URL, query);
-    
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "methaur/1.0");
-    
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        fprintf(stderr, "Error: curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-        free(chunk->data);
-        free(chunk);
-        curl_easy_cleanup(curl);
-        return;
-    }
-    
-    struct json_object *root = NULL, *results_obj = NULL;
-    
-    enum json_tokener_error jerr = json_tokener_success;
-    root = json_tokener_parse_verbose(chunk->data, &jerr);
-    
-    if (root == NULL || jerr != json_tokener_success) {
-        fprintf(stderr, "Error: Failed to parse JSON response\n");
-        free(chunk->data);
-        free(chunk);
-        curl_easy_cleanup(curl);
-        return;
-    }
-    
-    if (!json_object_object_get_ex(root, "results", &results_obj) || results_obj == NULL) {
-        fprintf(stderr, "Error: No results found in JSON response\n");
-        json_object_put(root);
-        free(chunk->data);
-        free(chunk);
-        curl_easy_cleanup(curl);
-        return;
-    }
-    
-    int num_results = json_object_array_length(results_obj);
-    if (num_results <= 0) {
-        *count = 0;
-        json_object_put(root);
-        free(chunk->data);
-        free(chunk);
-        curl_easy_cleanup(curl);
-        return;
-    }
-    
-    *count = (num_results > MAX_PACKAGES) ? MAX_PACKAGES : num_results;
-    
-    *results = (Package *)calloc(*count, sizeof(Package));
-    if (*results == NULL) {
-        fprintf(stderr, "Error: Failed to allocate memory for results\n");
-        *count = 0;
-        json_object_put(root);
-        free(chunk->data);
-        free(chunk);
-        curl_easy_cleanup(curl);
-        return;
-    }
-    
-    for (int i = 0; i < *count; i++) {
-        struct json_object *package_obj = json_object_array_get_idx(results_obj, i);
-        if (package_obj == NULL) continue;
-        
-        struct json_object *name_obj = NULL, *version_obj = NULL, *desc_obj = NULL;
-        struct json_object *votes_obj = NULL, *maintainer_obj = NULL, *url_obj = NULL;
-        
-        json_object_object_get_ex(package_obj, "Name", &name_obj);
-        json_object_object_get_ex(package_obj, "Version", &version_obj);
-        json_object_object_get_ex(package_obj, "Description", &desc_obj);
-        json_object_object_get_ex(package_obj, "NumVotes", &votes_obj);
-        json_object_object_get_ex(package_obj, "Maintainer", &maintainer_obj);
-        json_object_object_get_ex(package_obj, "URL", &url_obj);
-        
-        (*results)[i].name = name_obj ? safe_strdup(json_object_get_string(name_obj)) : safe_strdup("");
-        (*results)[i].version = version_obj ? safe_strdup(json_object_get_string(version_obj)) : safe_strdup("");
-        (*results)[i].description = desc_obj ? safe_strdup(json_object_get_string(desc_obj)) : safe_strdup("");
-        (*results)[i].votes = votes_obj ? json_object_get_int(votes_obj) : 0;
-        (*results)[i].maintainer = maintainer_obj ? safe_strdup(json_object_get_string(maintainer_obj)) : safe_strdup("None");
-        (*results)[i].url = url_obj ? safe_strdup(json_object_get_string(url_obj)) : safe_strdup("");
-        (*results)[i].repo = safe_strdup("aur");
-    }
-    
-    json_object_put(root);
-    curl_easy_cleanup(curl);
-    free(chunk->data);
-    free(chunk);
-}
-
-// Search Arch repos
-void search_arch_repos(const char *query, Package **results, int *count) {
-    CURL *curl;
-    CURLcode res;
-    char url[MAX_BUFFER];
-    
-    CurlData* chunk = init_curl_data();
-    if (!chunk) {
-        fprintf(stderr, "Error: Failed to allocate memory\n");
-        return;
-    }
-    
-    curl = curl_easy_init();
-    if (!curl) {
-        fprintf(stderr, "Error: Failed to initialize curl\n");
-        free(chunk->data);
-        free(chunk);
-        return;
-    }
-    
-    snprintf(url, MAX_BUFFER, "%s%s", ARCH_SEARCH_URL, query);
-    
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "methaur/1.0");
-    
-    res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        fprintf(stderr, "Error: curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-        free(chunk->data);
-        free(chunk);
-        curl_easy_cleanup(curl);
-        return;
-    }
-    
-    struct json_object *root = NULL, *results_obj = NULL;
-    
-    enum json_tokener_error jerr = json_tokener_success;
-    root = json_tokener_parse_verbose(chunk->data, &jerr);
-    
-    if (root == NULL || jerr != json_tokener_success) {
-        fprintf(stderr, "Error: Failed to parse JSON response\n");
-        free(chunk->data);
-        free(chunk);
-        curl_easy_cleanup(curl);
-        return;
-    }
-    
-    if (!json_object_object_get_ex(root, "results", &results_obj) || results_obj == NULL) {
-        *count = 0;
-        json_object_put(root);
-        free(chunk->data);
-        free(chunk);
-        curl_easy_cleanup(curl);
-        return;
-    }
-    
-    int num_results = json_object_array_length(results_obj);
-    if (num_results <= 0) {
-        *count = 0;
-        json_object_put(root);
-        free(chunk->data);
-        free(chunk);
-        curl_easy_cleanup(curl);
-        return;
-    }
-    
-    *count = (num_results > MAX_PACKAGES) ? MAX_PACKAGES : num_results;
-    
-    *results = (Package *)calloc(*count, sizeof(Package));
-    if (*results == NULL) {
-        fprintf(stderr, "Error: Failed to allocate memory for results\n");
-        *count = 0;
-        json_object_put(root);
-        free(chunk->data);
-        free(chunk);
-        curl_easy_cleanup(curl);
-        return;
-    }
-    
-    for (int i = 0; i < *count; i++) {
-        struct json_object *package_obj = json_object_array_get_idx(results_obj, i);
-        if (package_obj == NULL) continue;
-        
-        struct json_object *name_obj = NULL, *version_obj = NULL, *desc_obj = NULL;
-        struct json_object *repo_obj = NULL, *url_obj = NULL;
-        
-        json_object_object_get_ex(package_obj, "pkgname", &name_obj);
-        json_object_object_get_ex(package_obj, "pkgver", &version_obj);
-        json_object_object_get_ex(package_obj, "pkgdesc", &desc_obj);
-        json_object_object_get_ex(package_obj, "repo", &repo_obj);
-        json_object_object_get_ex(package_obj, "url", &url_obj);
-        
-        (*results)[i].name = name_obj ? safe_strdup(json_object_get_string(name_obj)) : safe_strdup("");
-        (*results)[i].version = version_obj ? safe_strdup(json_object_get_string(version_obj)) : safe_strdup("");
-        (*results)[i].description = desc_obj ? safe_strdup(json_object_get_string(desc_obj)) : safe_strdup("");
-        (*results)[i].votes = 0; // Official repos don't have votes
-        (*results)[i].maintainer = safe_strdup("Arch Linux");
-        (*results)[i].url = url_obj ? safe_strdup(json_object_get_string(url_obj)) : safe_strdup("");
-        (*results)[i].repo = repo_obj ? safe_strdup(json_object_get_string(repo_obj)) : safe_strdup("unknown");
-    }
-    
-    json_object_put(root);
-    curl_easy_cleanup(curl);
-    free(chunk->data);
-    free(chunk);
-}
-
-void search_packages(const char *query, Package **results, int *count) {
-    Package *aur_results = NULL;
-    Package *arch_results = NULL;
-    int aur_count = 0;
-    int arch_count = 0;
-    
-    search_arch_repos(query, &arch_results, &arch_count);
-    
-    search_aur(query, &aur_results, &aur_count);
-    
-    int total_count = aur_count + arch_count;
-    if (total_count == 0) {
-        *count = 0;
-        *results = NULL;
-        return;
-    }
-    
-    if (total_count > MAX_PACKAGES) {
-        total_count = MAX_PACKAGES;
-    }
-    
-    *results = (Package *)calloc(total_count, sizeof(Package));
-    if (*results == NULL) {
-        fprintf(stderr, "Error: Failed to allocate memory for combined results\n");
-        free_package_data(aur_results, aur_count);
-        free_package_data(arch_results, arch_count);
-        *count = 0;
-        return;
-    }
-    
-    int result_index = 0;
-    for (int i = 0; i < arch_count && result_index < total_count; i++) {
-        (*results)[result_index].name = safe_strdup(arch_results[i].name);
-        (*results)[result_index].version = safe_strdup(arch_results[i].version);
-        (*results)[result_index].description = safe_strdup(arch_results[i].description);
-        (*results)[result_index].votes = arch_results[i].votes;
-        (*results)[result_index].maintainer = safe_strdup(arch_results[i].maintainer);
-        (*results)[result_index].url = safe_strdup(arch_results[i].url);
-        (*results)[result_index].repo = safe_strdup(arch_results[i].repo);
-        result_index++;
-    }
-    
-    for (int i = 0; i < aur_count && result_index < total_count; i++) {
-        (*results)[result_index].name = safe_strdup(aur_results[i].name);
-        (*results)[result_index].version = safe_strdup(aur_results[i].version);
-        (*results)[result_index].description = safe_strdup(aur_results[i].description);
-        (*results)[result_index].votes = aur_results[i].votes;
-        (*results)[result_index].maintainer = safe_strdup(aur_results[i].maintainer);
-        (*results)[result_index].url = safe_strdup(aur_results[i].url);
-        (*results)[result_index].repo = safe_strdup(aur_results[i].repo);
-        result_index++;
-    }
-    
-    *count = result_index;
-    
-    free_package_data(aur_results, aur_count);
-    free_package_data(arch_results, arch_count);
-}
-
-void display_search_results(Package *results, int count) {
-    if (results == NULL || count <= 0) {
-        printf("No results to display.\n");
-        return;
-    }
-    
-    printf("\n");
-    printf("%-3s %-20s %-12s %-8s %-8s %-15s %s\n", "ID", "Name", "Version", "Repo", "Votes", "Maintainer", "Description");
-    printf("---------------------------------------------------------------------------------------------------------------\n");
-    
-    for (int i = 0; i < count; i++) {
-        printf("%-3d %-20s %-12s %-8s %-8d %-15.15s %.50s\n", 
-               i + 1, 
-               results[i].name ? results[i].name : "", 
-               results[i].version ? results[i].version : "",
-               results[i].repo ? results[i].repo : "",
-               results[i].votes,
-               results[i].maintainer ? results[i].maintainer : "None", 
-               results[i].description ? results[i].description : "");
-    }
-    printf("\n");
-}
-
 void create_directories() {
-    char command[MAX_BUFFER];
-    snprintf(command, MAX_BUFFER, "mkdir -p %s", TMP_DIR);
-    system(command);
+    if (mkdir_p(TMP_DIR, 0755) != 0) {
+        fprintf(stderr, "Error: Failed to create directory %s\n", TMP_DIR);
+    }
 }
 
 int download_and_build_package(const char *package_name) {
@@ -396,47 +41,7 @@ int download_and_build_package(const char *package_name) {
         return 1;
     }
     
-    char command[MAX_BUFFER];
-    int status;
-    
-    if (chdir(TMP_DIR) != 0) {
-        fprintf(stderr, "Error: Failed to change to directory %s\n", TMP_DIR);
-        return 1;
-    }
-    
-    // Download package
-    printf("Downloading %s from AUR...\n", package_name);
-    snprintf(command, MAX_BUFFER, "curl -s %s%s.tar.gz -o %s.tar.gz", AUR_PKG_URL, package_name, package_name);
-    status = system(command);
-    if (status != 0) {
-        fprintf(stderr, "Error: Failed to download package %s\n", package_name);
-        return 1;
-    }
-    
-    // Extract package
-    printf("Extracting %s...\n", package_name);
-    snprintf(command, MAX_BUFFER, "tar -xzf %s.tar.gz", package_name);
-    status = system(command);
-    if (status != 0) {
-        fprintf(stderr, "Error: Failed to extract package %s\n", package_name);
-        return 1;
-    }
-    
-    // Build package
-    printf("Building and installing %s...\n", package_name);
-    snprintf(command, MAX_BUFFER, "cd %s && makepkg -si --noconfirm", package_name);
-    status = system(command);
-    if (status != 0) {
-        fprintf(stderr, "Error: Failed to build/install package %s\n", package_name);
-        return 1;
-    }
-    
-    // Clean up
-    printf("Cleaning up...\n");
-    snprintf(command, MAX_BUFFER, "rm -rf %s%s*", TMP_DIR, package_name);
-    system(command);
-    
-    return 0;
+    return build_aur_packages(&package_name, 1, NULL);
 }
 
 // Install package
@@ -451,14 +56,12 @@ int install_package(const char *package_name, const char *repo) {
     if (strcmp(repo, "aur") == 0) {
         return download_and_build_package(package_name);
     } else {
-        if (system("which sudo > /dev/null 2>&1") != 0) {
-            fprintf(stderr, "Error: sudo is required but not found\n");
+        if (require_sudo() != 0) {
             return 1;
         }
         
-        char command[MAX_BUFFER];
-        snprintf(command, MAX_BUFFER, "sudo pacman -S --noconfirm %s", package_name);
-        return system(command);
+        char *argv[] = { "sudo", "pacman", "-S", "--noconfirm", (char *)package_name, NULL };
+        return run_command(argv, NULL);
     }
 }
 
@@ -471,15 +74,12 @@ int remove_package(const char *package_name) {
     printf("Removing %s...\n", package_name);
     
     // Check for sudo
-    if (system("which sudo > /dev/null 2>&1") != 0) {
-        fprintf(stderr, "Error: sudo is required but not found\n");
+    if (require_sudo() != 0) {
         return 1;
     }
     
-    char command[MAX_BUFFER];
-    snprintf(command, MAX_BUFFER, "sudo pacman -R --noconfirm %s", package_name);
-    
-    return system(command);
+    char *argv[] = { "sudo", "pacman", "-R", "--noconfirm", (char *)package_name, NULL };
+    return run_command(argv, NULL);
 }
 
 int update_package(const char *package_name) {
@@ -491,25 +91,25 @@ int update_package(const char *package_name) {
     printf("Updating %s...\n", package_name);
     
     // Check if package exists in official repositories
-    char check_cmd[MAX_BUFFER];
-    snprintf(check_cmd, MAX_BUFFER, "pacman -Ss ^%s$ > /dev/null 2>&1", package_name);
-    int is_official = (system(check_cmd) == 0);
+    int is_official = (pacdb_repo_of(package_name) != NULL);
     
     if (is_official) {
         // Update official package
-        if (system("which sudo > /dev/null 2>&1") != 0) {
-            fprintf(stderr, "Error: sudo is required but not found\n");
+        if (require_sudo() != 0) {
             return 1;
         }
         
-        char command[MAX_BUFFER];
-        snprintf(command, MAX_BUFFER, "sudo pacman -Sy --noconfirm %s", package_name);
-        return system(command);
+        char *argv[] = { "sudo", "pacman", "-Sy", "--noconfirm", (char *)package_name, NULL };
+        return run_command(argv, NULL);
     } else {
         // Check if package exists in AUR
-        char aur_check_cmd[MAX_BUFFER];
-        snprintf(aur_check_cmd, MAX_BUFFER, "curl -s 'https://aur.archlinux.org/rpc/?v=5&type=info&arg=%s' | grep -q '\"ResultCount\":1'", package_name);
-        int is_aur = (system(aur_check_cmd) == 0);
+        AurInfo *info = NULL;
+        int info_count = 0;
+        if (daemon_info(&package_name, 1, &info, &info_count) != 0) {
+            aur_info_query(&package_name, 1, &info, &info_count);
+        }
+        int is_aur = aur_info_find(info, info_count, package_name) != NULL;
+        free_aur_info(info, info_count);
         
         if (is_aur) {
             // Update AUR package by reinstalling it
@@ -522,16 +122,20 @@ int update_package(const char *package_name) {
 }
 
 int update_system(int full_upgrade) {
+    if (full_upgrade && journal_pending()) {
+        fprintf(stderr, "Warning: Starting over; use methaur -Ufull --resume to continue the interrupted upgrade\n");
+    }
+
     printf("Updating package databases...\n");
     
     // Check for sudo
-    if (system("which sudo > /dev/null 2>&1") != 0) {
-        fprintf(stderr, "Error: sudo is required but not found\n");
+    if (require_sudo() != 0) {
         return 1;
     }
     
     // Update package database first
-    int status = system("sudo pacman -Sy");
+    char *sync_argv[] = { "sudo", "pacman", "-Sy", NULL };
+    int status = run_command(sync_argv, NULL);
     if (status != 0) {
         fprintf(stderr, "Error: Failed to update package database\n");
         return status;
@@ -539,7 +143,8 @@ int update_system(int full_upgrade) {
     
     if (full_upgrade) {
         printf("Performing full system upgrade...\n");
-        status = system("sudo pacman -Su --noconfirm");
+        char *upgrade_argv[] = { "sudo", "pacman", "-Su", "--noconfirm", NULL };
+        status = run_command(upgrade_argv, NULL);
         if (status != 0) {
             fprintf(stderr, "Error: Failed to upgrade system\n");
             return status;
@@ -548,51 +153,82 @@ int update_system(int full_upgrade) {
         // Check for installed AUR packages
         printf("Checking for AUR package updates...\n");
         
-        // Create a simple script to find foreign packages (typically AUR)
-        char tmp_script[MAX_BUFFER];
-        snprintf(tmp_script, MAX_BUFFER, "%saur_packages.sh", TMP_DIR);
-        
-        FILE *fp = fopen(tmp_script, "w");
-        if (fp == NULL) {
-            fprintf(stderr, "Error: Failed to create temporary script\n");
+        // A running methaurd answers from its warm caches
+        double check_start = trace_now();
+        AurUpgrade *upgrades = NULL;
+        int upgrade_count = 0;
+        if (daemon_upgrades(&upgrades, &upgrade_count) != 0 &&
+            aur_check_upgrades(&upgrades, &upgrade_count) != 0) {
             return 1;
         }
         
-        fprintf(fp, "#!/bin/bash\n");
-        fprintf(fp, "pacman -Qm | cut -d' ' -f1\n");
-        fclose(fp);
-        
-        // Make script executable
-        chmod(tmp_script, 0755);
-        
-        // Execute the script and capture output to process AUR packages
-        FILE *packages = popen(tmp_script, "r");
-        if (packages == NULL) {
-            fprintf(stderr, "Error: Failed to get list of AUR packages\n");
+        // Collect the outdated AUR packages; they are built as one graph
+        // so shared dependencies are resolved once
+        const char **outdated = malloc((upgrade_count > 0 ? upgrade_count : 1) * sizeof(char *));
+        const char **vcs = malloc((upgrade_count > 0 ? upgrade_count : 1) * sizeof(char *));
+        int outdated_count = 0;
+        int vcs_count = 0;
+        int aur_updates = 0;
+        if (outdated == NULL || vcs == NULL) {
+            fprintf(stderr, "Error: Failed to allocate memory\n");
+            free(outdated);
+            free(vcs);
+            free_aur_upgrades(upgrades, upgrade_count);
             return 1;
         }
-        
-        // Update each AUR package
-        char package_name[256];
-        int aur_updates = 0;
-        while (fgets(package_name, sizeof(package_name), packages) != NULL) {
-            // Remove trailing newline
-            size_t len = strlen(package_name);
-            if (len > 0 && package_name[len - 1] == '\n') {
-                package_name[len - 1] = '\0';
+        for (int i = 0; i < upgrade_count; i++) {
+            if (upgrades[i].available == NULL) {
+                printf("Skipping %s: not found in AUR\n", upgrades[i].name);
+                continue;
             }
             
-            if (strlen(package_name) > 0) {
-                printf("Updating AUR package: %s\n", package_name);
-                status = download_and_build_package(package_name);
-                if (status == 0) {
-                    aur_updates++;
-                }
+            if (vcs_package(upgrades[i].name)) {
+                vcs[vcs_count++] = upgrades[i].name;
+            }
+            
+            if (!upgrades[i].outdated) {
+                continue;
             }
+            
+            printf("Updating AUR package: %s (%s -> %s)\n", upgrades[i].name, upgrades[i].installed, upgrades[i].available);
+            outdated[outdated_count++] = upgrades[i].name;
         }
         
-        pclose(packages);
-        unlink(tmp_script);
+        // The AUR version of a VCS package stays put while upstream moves
+        // on, so ask upstream directly
+        char **changed = NULL;
+        int changed_count = 0;
+        if (vcs_count > 0 && vcs_check_updates(vcs, vcs_count, &changed, &changed_count) != 0) {
+            fprintf(stderr, "Warning: Failed to check VCS packages for new commits\n");
+        }
+        for (int i = 0; i < changed_count; i++) {
+            int listed = 0;
+            for (int j = 0; j < outdated_count && !listed; j++) {
+                listed = strcmp(outdated[j], changed[i]) == 0;
+            }
+            if (listed) continue;
+            
+            printf("Updating VCS package: %s (new upstream commits)\n", changed[i]);
+            outdated[outdated_count++] = changed[i];
+        }
+        free(vcs);
+        
+        trace_end("phase", "upgrade check", NULL, check_start);
+
+        if (outdated_count == 0) {
+            printf("All %d AUR package(s) are up to date\n", upgrade_count);
+        } else {
+            // From here on the journal lets --resume pick up after a crash
+            journal_begin(outdated, outdated_count);
+            int failed = build_aur_packages(outdated, outdated_count, &aur_updates) != 0;
+            if (failed) {
+                fprintf(stderr, "Warning: %d AUR package(s) failed to update\n", outdated_count - aur_updates);
+            }
+            journal_finish(!failed);
+        }
+        free(outdated);
+        free_string_list(changed, changed_count);
+        free_aur_upgrades(upgrades, upgrade_count);
         
         printf("System upgrade complete: %d AUR package(s) updated\n", aur_updates);
     }
@@ -600,21 +236,35 @@ int update_system(int full_upgrade) {
     return 0;
 }
 
-void free_package_data(Package *packages, int count) {
-    if (packages == NULL) {
-        return;
+// Continue an -Ufull run that was interrupted while building. The journal
+// is only written once the repository upgrade is done, so the pacman
+// steps and the upgrade check are not repeated.
+int resume_upgrade(void) {
+    char **targets = NULL;
+    int count = 0;
+    int aur_updates = 0;
+
+    if (journal_resume(&targets, &count) != 0) {
+        fprintf(stderr, "Error: There is no interrupted upgrade to resume\n");
+        return 1;
     }
-    
-    for (int i = 0; i < count; i++) {
-        free(packages[i].name);
-        free(packages[i].version);
-        free(packages[i].description);
-        free(packages[i].maintainer);
-        free(packages[i].url);
-        free(packages[i].repo);
+
+    if (count == 0) {
+        printf("The interrupted upgrade had already finished\n");
+        journal_finish(1);
+        return 0;
     }
-    
-    free(packages);
+
+    printf("Resuming the interrupted upgrade: %d AUR package(s) left\n", count);
+    int failed = build_aur_packages((const char **)targets, count, &aur_updates) != 0;
+    if (failed) {
+        fprintf(stderr, "Warning: %d AUR package(s) failed to update\n", count - aur_updates);
+    }
+    journal_finish(!failed);
+    free_string_list(targets, count);
+
+    printf("System upgrade complete: %d AUR package(s) updated\n", aur_updates);
+    return 0;
 }
 
 void print_usage() {
@@ -624,6 +274,11 @@ void print_usage() {
     printf("  -R, --remove     Remove package\n");
     printf("  -U, --update     Update specific package(s) or system\n");
     printf("                   Use -Ufull for full system upgrade\n");
+    printf("  -Ufull --resume  Continue an interrupted full system upgrade\n");
+    printf("  --sync-index [file|url]\n");
+    printf("                   Build the local AUR search index from the metadata dump\n");
+    printf("  --timings        Print how long each phase took on exit\n");
+    printf("  --trace=FILE     Also write the phases as a Chrome trace to FILE\n");
     printf("  -h, --help       Show this help message\n");
     printf("\n");
     printf("Examples:\n");
@@ -632,16 +287,49 @@ void print_usage() {
     printf("  methaur -R firefox  Remove firefox package\n");
     printf("  methaur -U firefox  Update firefox package\n");
     printf("  methaur -Ufull      Full system upgrade (packages from repos and AUR)\n");
+    printf("  methaur -Ufull --resume\n");
+    printf("                      Pick up where an interrupted -Ufull stopped\n");
+}
+
+// Take --timings and --trace=FILE out of argv, wherever they appear,
+// and start recording if either was given
+static int parse_trace_options(int *argc, char *argv[]) {
+    const char *trace_path = NULL;
+    int timings = 0;
+    int kept = 1;
+
+    for (int i = 1; i < *argc; i++) {
+        if (strcmp(argv[i], "--timings") == 0) {
+            timings = 1;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_path = argv[i] + 8;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    *argc = kept;
+    argv[kept] = NULL;
+
+    if (!timings && trace_path == NULL) return 0;
+    return trace_open(trace_path);
 }
 
 int main(int argc, char *argv[]) {
+    if (parse_trace_options(&argc, argv) != 0) {
+        return 1;
+    }
+
     // Initialize curl
     curl_global_init(CURL_GLOBAL_DEFAULT);
     
+    load_config();
+    http_share_init();
     create_directories();
     
     if (argc < 2) {
         print_usage();
+        trace_close();
+        http_share_cleanup();
         curl_global_cleanup();
         return 1;
     }
@@ -664,8 +352,13 @@ int main(int argc, char *argv[]) {
         } else {
             ret = update_package(argv[2]);
         }
+    } else if (strcmp(argv[1], "--resume") == 0 ||
+               (strcmp(argv[1], "-Ufull") == 0 && argc >= 3 && strcmp(argv[2], "--resume") == 0)) {
+        ret = resume_upgrade();
     } else if (strcmp(argv[1], "-Ufull") == 0) {
         ret = update_system(1);
+    } else if (strcmp(argv[1], "--sync-index") == 0) {
+        ret = index_sync(argc >= 3 ? argv[2] : NULL);
     } else {
         const char *query;
         
@@ -673,6 +366,8 @@ int main(int argc, char *argv[]) {
         if (strcmp(argv[1], "-S") == 0 || strcmp(argv[1], "--sync") == 0) {
             if (argc < 3) {
                 fprintf(stderr, "Error: No package specified for installation\n");
+                trace_close();
+                http_share_cleanup();
                 curl_global_cleanup();
                 return 1;
             }
@@ -681,35 +376,55 @@ int main(int argc, char *argv[]) {
             query = argv[1];
         }
         
-        Package *results = NULL;
-        int count = 0;
-        
-        search_packages(query, &results, &count);
+        ResultSet results;
+        double search_start = trace_now();
+        int search_failed = daemon_search(query, &results) != 0 && search_packages(query, &results) != 0;
+        trace_end("phase", "search", query, search_start);
         
-        if (count == 0 || results == NULL) {
+        if (search_failed) {
+            ret = 1;
+        } else if (results.count == 0) {
             printf("No packages found for '%s'\n", query);
+            result_set_free(&results);
             ret = 1;
         } else {
-            display_search_results(results, count);
-            
             int selection = 0;
+            int shown = 0;
             char input[32];
-            printf("Enter package number to install (1-%d), or 0 to cancel: ", count);
-            if (fgets(input, sizeof(input), stdin) != NULL) {
+
+            // Page through the ranking until a number is picked
+            for (;;) {
+                shown += display_search_results(&results, shown, SEARCH_PAGE_SIZE);
+
+                if (shown < results.count) {
+                    printf("Enter package number to install (1-%d), n for more (%d left), or 0 to cancel: ",
+                           shown, results.count - shown);
+                } else {
+                    printf("Enter package number to install (1-%d), or 0 to cancel: ", shown);
+                }
+
+                if (fgets(input, sizeof(input), stdin) == NULL) break;
+                if (input[0] == 'n' && shown < results.count) continue;
+
                 selection = atoi(input);
                 if (selection < 0) selection = 0;
+                break;
             }
             
-            if (selection <= 0 || selection > count) {
+            if (selection <= 0 || selection > shown) {
                 printf("Installation cancelled.\n");
             } else {
-                ret = install_package(results[selection - 1].name, results[selection - 1].repo);
+                const Package *package = result_set_get(&results, selection - 1);
+                ret = install_package(package->name, package->repo);
             }
             
-            free_package_data(results, count);
+            result_set_free(&results);
         }
     }
     
+    trace_close();
+    pacdb_close();
+    http_share_cleanup();
     curl_global_cleanup();
     
     return ret;
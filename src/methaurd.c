@@ -0,0 +1,465 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <curl/curl.h>
+
+#include "aur.h"
+#include "config.h"
+#include "daemon.h"
+#include "endpoint.h"
+#include "http.h"
+#include "pacdb.h"
+#include "search.h"
+#include "util.h"
+
+#define SEARCH_CACHE_SIZE 32
+#define REQUEST_TIMEOUT 5            // seconds to wait for a client's request
+#define MAX_INFO_NAMES 100000
+
+// What the AUR said about one name; version is NULL for names it does
+// not have
+typedef struct {
+    char *name;
+    char *version;
+    char *package_base;
+    time_t checked;
+} InfoEntry;
+
+typedef struct {
+    ResultSet set;
+    time_t fetched;
+    int used;
+} SearchEntry;
+
+static InfoEntry *info_cache = NULL;
+static int info_count = 0;
+static int info_sorted = 0;               // info_cache[0, info_sorted) is sorted by name
+static int info_capacity = 0;
+static SearchEntry search_cache[SEARCH_CACHE_SIZE];
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static int fresh(time_t stamp) {
+    return time(NULL) - stamp < config.cache_ttl;
+}
+
+static int compare_info_entry(const void *a, const void *b) {
+    return strcmp(((const InfoEntry *)a)->name, ((const InfoEntry *)b)->name);
+}
+
+static int compare_name(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static int compare_aur_info(const void *a, const void *b) {
+    return strcmp(((const AurInfo *)a)->name, ((const AurInfo *)b)->name);
+}
+
+static InfoEntry *info_lookup(const char *name) {
+    InfoEntry key = { .name = (char *)name };
+    if (info_sorted == 0) return NULL;
+    return bsearch(&key, info_cache, info_sorted, sizeof(InfoEntry), compare_info_entry);
+}
+
+static void info_store(const char *name, const AurInfo *remote, time_t now) {
+    InfoEntry *entry = info_lookup(name);
+
+    if (entry == NULL) {
+        if (info_count == info_capacity) {
+            int capacity = info_capacity ? info_capacity * 2 : 256;
+            InfoEntry *grown = realloc(info_cache, capacity * sizeof(InfoEntry));
+            if (grown == NULL) return;
+            info_cache = grown;
+            info_capacity = capacity;
+        }
+        entry = &info_cache[info_count];
+        entry->name = strdup(name);
+        entry->version = NULL;
+        entry->package_base = NULL;
+        if (entry->name == NULL) return;
+        info_count++;
+    }
+
+    free(entry->version);
+    free(entry->package_base);
+    entry->version = remote ? strdup(remote->version) : NULL;
+    entry->package_base = remote ? strdup(remote->package_base) : NULL;
+    entry->checked = now;
+}
+
+// Bring the cached info for names up to date with one batched query
+// for whatever is missing or stale
+static void info_refresh(const char **names, int count) {
+    const char **stale = malloc((count > 0 ? count : 1) * sizeof(char *));
+    int stale_count = 0;
+    time_t now = time(NULL);
+
+    if (stale == NULL) return;
+
+    for (int i = 0; i < count; i++) {
+        const InfoEntry *entry = info_lookup(names[i]);
+        if (entry == NULL || !fresh(entry->checked)) stale[stale_count++] = names[i];
+    }
+
+    // New entries are appended past info_sorted, where lookups do not
+    // see them, so each name may only be stored once
+    qsort(stale, stale_count, sizeof(char *), compare_name);
+    int unique = 0;
+    for (int i = 0; i < stale_count; i++) {
+        if (unique == 0 || strcmp(stale[unique - 1], stale[i]) != 0) stale[unique++] = stale[i];
+    }
+    stale_count = unique;
+
+    if (stale_count > 0) {
+        AurInfo *info = NULL;
+        int found = 0;
+        int failed = aur_info_query(stale, stale_count, &info, &found);
+
+        // Absence only means something if every query got through
+        for (int i = 0; i < stale_count; i++) {
+            const AurInfo *remote = aur_info_find(info, found, stale[i]);
+            if (remote || !failed) info_store(stale[i], remote, now);
+        }
+        qsort(info_cache, info_count, sizeof(InfoEntry), compare_info_entry);
+        info_sorted = info_count;
+        free_aur_info(info, found);
+    }
+
+    free(stale);
+}
+
+static void free_info_cache(void) {
+    for (int i = 0; i < info_count; i++) {
+        free(info_cache[i].name);
+        free(info_cache[i].version);
+        free(info_cache[i].package_base);
+    }
+    free(info_cache);
+}
+
+static void send_status(FILE *out, int count) {
+    char number[16];
+    const char *fields[] = { "ok", number };
+
+    snprintf(number, sizeof(number), "%d", count);
+    daemon_write_record(out, fields, 2);
+}
+
+static void send_error(FILE *out, const char *message) {
+    const char *fields[] = { "error", message };
+    daemon_write_record(out, fields, 2);
+}
+
+static ResultSet *cached_search(const char *query) {
+    SearchEntry *slot = &search_cache[0];
+
+    for (int i = 0; i < SEARCH_CACHE_SIZE; i++) {
+        SearchEntry *entry = &search_cache[i];
+        if (entry->used && strcmp(entry->set.query, query) == 0) {
+            if (fresh(entry->fetched)) return &entry->set;
+            slot = entry;
+            break;
+        }
+        if (!entry->used || (slot->used && entry->fetched < slot->fetched)) slot = entry;
+    }
+
+    if (slot->used) {
+        result_set_free(&slot->set);
+        slot->used = 0;
+    }
+    if (search_packages(query, &slot->set) != 0) return NULL;
+
+    // An empty answer is as likely a network failure as a real miss;
+    // do not hold on to it
+    slot->used = slot->set.count > 0;
+    slot->fetched = time(NULL);
+    return &slot->set;
+}
+
+static void serve_search(FILE *out, const char *query) {
+    char votes[16];
+    char popularity[32];
+
+    ResultSet *set = cached_search(query);
+    if (set == NULL) {
+        send_error(out, "search failed");
+        return;
+    }
+
+    send_status(out, set->count);
+    for (int i = 0; i < set->count; i++) {
+        const Package *package = &set->items[i];
+        const char *fields[] = {
+            package->name, package->repo, package->version, package->description,
+            package->maintainer, package->url, votes, popularity,
+        };
+        snprintf(votes, sizeof(votes), "%d", package->votes);
+        snprintf(popularity, sizeof(popularity), "%.6f", package->popularity);
+        daemon_write_record(out, fields, 8);
+    }
+
+    if (!set->count) result_set_free(set);
+}
+
+static int compare_entry_pointer(const void *a, const void *b) {
+    return strcmp((*(InfoEntry *const *)a)->name, (*(InfoEntry *const *)b)->name);
+}
+
+static void serve_info(FILE *in, FILE *out, int count, char **line, size_t *size) {
+    char *fields[1];
+    char **names = calloc(count > 0 ? count : 1, sizeof(char *));
+    int read = 0;
+
+    if (names == NULL) {
+        send_error(out, "out of memory");
+        return;
+    }
+    while (read < count && daemon_read_record(in, line, size, fields, 1) == 1) {
+        if ((names[read] = strdup(fields[0])) == NULL) break;
+        read++;
+    }
+    if (read < count) {
+        send_error(out, "truncated request");
+        free_string_list(names, read);
+        return;
+    }
+
+    info_refresh((const char **)names, count);
+
+    // Entries move while info_refresh inserts, so collect them only now
+    InfoEntry **hits = malloc((count > 0 ? count : 1) * sizeof(InfoEntry *));
+    int hit_count = 0;
+    for (int i = 0; hits && i < count; i++) {
+        InfoEntry *entry = info_lookup(names[i]);
+        if (entry && entry->version && entry->package_base) hits[hit_count++] = entry;
+    }
+    free_string_list(names, count);
+    if (hits == NULL) {
+        send_error(out, "out of memory");
+        return;
+    }
+
+    qsort(hits, hit_count, sizeof(InfoEntry *), compare_entry_pointer);
+    int unique = 0;
+    for (int i = 0; i < hit_count; i++) {
+        if (unique == 0 || hits[unique - 1] != hits[i]) hits[unique++] = hits[i];
+    }
+
+    send_status(out, unique);
+    for (int i = 0; i < unique; i++) {
+        const char *record[] = { hits[i]->name, hits[i]->version, hits[i]->package_base };
+        daemon_write_record(out, record, 3);
+    }
+    free(hits);
+}
+
+static void serve_upgrades(FILE *out) {
+    InstalledPackage *installed = NULL;
+    int installed_count = 0;
+    AurUpgrade *upgrades = NULL;
+
+    // A pacman transaction since the last request invalidates the handle
+    pacdb_refresh();
+    if (pacdb_foreign_packages(&installed, &installed_count) != 0) {
+        send_error(out, "failed to read the local package database");
+        return;
+    }
+
+    const char **names = malloc((installed_count > 0 ? installed_count : 1) * sizeof(char *));
+    AurInfo *info = calloc(installed_count > 0 ? installed_count : 1, sizeof(AurInfo));
+    int found = 0;
+    if (names == NULL || info == NULL) {
+        send_error(out, "out of memory");
+        goto done;
+    }
+
+    for (int i = 0; i < installed_count; i++) {
+        names[i] = installed[i].name;
+    }
+    info_refresh(names, installed_count);
+
+    // Borrowed from the cache, sorted the way aur_info_find wants
+    for (int i = 0; i < installed_count; i++) {
+        const InfoEntry *entry = info_lookup(installed[i].name);
+        if (entry && entry->version) {
+            info[found].name = entry->name;
+            info[found].version = entry->version;
+            info[found].package_base = entry->package_base;
+            found++;
+        }
+    }
+    qsort(info, found, sizeof(AurInfo), compare_aur_info);
+
+    if (aur_compare_installed(installed, installed_count, info, found, &upgrades) != 0) {
+        send_error(out, "out of memory");
+        goto done;
+    }
+
+    send_status(out, installed_count);
+    for (int i = 0; i < installed_count; i++) {
+        const char *fields[] = {
+            upgrades[i].name, upgrades[i].installed, upgrades[i].available, upgrades[i].outdated ? "1" : "0",
+        };
+        daemon_write_record(out, fields, 4);
+    }
+    free_aur_upgrades(upgrades, installed_count);
+
+done:
+    free(info);
+    free(names);
+    free_installed_packages(installed, installed_count);
+}
+
+static void serve(int fd) {
+    struct timeval timeout = { REQUEST_TIMEOUT, 0 };
+    char *line = NULL;
+    size_t size = 0;
+    char *fields[2];
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    timeout.tv_sec = DAEMON_TIMEOUT;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    int out_fd = dup(fd);
+    FILE *in = fdopen(fd, "r");
+    FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+    if (!in || !out) {
+        if (in) fclose(in); else close(fd);
+        if (out) fclose(out); else if (out_fd >= 0) close(out_fd);
+        return;
+    }
+
+    int count = daemon_read_record(in, &line, &size, fields, 2);
+    if (count == 2 && strcmp(fields[0], "search") == 0) {
+        serve_search(out, fields[1]);
+    } else if (count == 2 && strcmp(fields[0], "info") == 0) {
+        int names = atoi(fields[1]);
+        if (names < 0 || names > MAX_INFO_NAMES) {
+            send_error(out, "too many names");
+        } else {
+            serve_info(in, out, names, &line, &size);
+        }
+    } else if (count == 1 && strcmp(fields[0], "upgrades") == 0) {
+        serve_upgrades(out);
+    } else if (count > 0) {
+        send_error(out, "unknown request");
+    }
+
+    free(line);
+    fclose(out);
+    fclose(in);
+}
+
+// Refuse to start twice, but take over the socket of a daemon that died
+static int listen_socket(const char *path) {
+    struct sockaddr_un address;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+        fprintf(stderr, "Error: methaurd is already running on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    unlink(path);
+
+    mode_t mask = umask(077);
+    int status = bind(fd, (struct sockaddr *)&address, sizeof(address));
+    umask(mask);
+    if (status != 0 || listen(fd, 16) != 0) {
+        fprintf(stderr, "Error: Failed to listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void print_usage(void) {
+    printf("Usage: methaurd\n");
+    printf("Keep search results, AUR package info, connections and the pacman\n");
+    printf("database warm for methaur, which uses the daemon whenever it runs.\n");
+}
+
+int main(int argc, char *argv[]) {
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    struct sigaction action;
+
+    if (argc > 1) {
+        print_usage();
+        return strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0 ? 0 : 1;
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    load_config();
+
+    if (daemon_socket_path(path, sizeof(path), 1) != 0 || http_share_init() != 0) {
+        curl_global_cleanup();
+        return 1;
+    }
+
+    int listen_fd = listen_socket(path);
+    if (listen_fd < 0) {
+        http_share_cleanup();
+        curl_global_cleanup();
+        return 1;
+    }
+
+    // No SA_RESTART: a signal has to interrupt accept()
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("methaurd: listening on %s\n", path);
+    fflush(stdout);
+
+    // One request at a time: every request is short, and the caches need
+    // no locking this way
+    while (!stopping) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            break;
+        }
+        // Mirrors are probed again once the last probe is out of date
+        endpoints_refresh();
+        serve(fd);
+    }
+
+    close(listen_fd);
+    unlink(path);
+
+    for (int i = 0; i < SEARCH_CACHE_SIZE; i++) {
+        if (search_cache[i].used) result_set_free(&search_cache[i].set);
+    }
+    free_info_cache();
+    pacdb_close();
+    http_share_cleanup();
+    curl_global_cleanup();
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include <alpm.h>
+#include <alpm_list.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "pacdb.h"
+
+static alpm_handle_t *handle = NULL;
+static char opened_dbpath[PATH_MAX];
+static struct timespec local_mtime;
+static struct timespec sync_mtime;
+
+static char *trim(char *str) {
+    while (isspace((unsigned char)*str)) str++;
+
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+
+    return str;
+}
+
+// Everything but [options] in pacman.conf is a repository. Only the
+// names matter here: the sync databases are read, never downloaded.
+static int read_pacman_conf(char *root, char *dbpath, size_t size, char ***repos, int *repo_count) {
+    FILE *fp = fopen(PACMAN_CONF, "r");
+    char line[PATH_MAX + 64];
+    int in_options = 0;
+
+    snprintf(root, size, "%s", PACMAN_ROOT_DIR);
+    snprintf(dbpath, size, "%s", PACMAN_DB_PATH);
+    *repos = NULL;
+    *repo_count = 0;
+
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Failed to open %s\n", PACMAN_CONF);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char *key = trim(line);
+        if (*key == '\0') continue;
+
+        if (*key == '[') {
+            char *end = strchr(key, ']');
+            if (end == NULL) continue;
+            *end = '\0';
+            key++;
+
+            in_options = strcmp(key, "options") == 0;
+            if (in_options) continue;
+
+            char **grown = realloc(*repos, (*repo_count + 1) * sizeof(char *));
+            if (grown == NULL) break;
+            *repos = grown;
+            (*repos)[(*repo_count)++] = strdup(key);
+            continue;
+        }
+
+        char *value = strchr(key, '=');
+        if (!in_options || value == NULL) continue;
+
+        *value++ = '\0';
+        key = trim(key);
+        value = trim(value);
+        if (strcmp(key, "RootDir") == 0) {
+            snprintf(root, size, "%s", value);
+        } else if (strcmp(key, "DBPath") == 0) {
+            snprintf(dbpath, size, "%s", value);
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+// pacman adds and removes entries under local/ on every transaction and
+// renames fresh files into sync/ on every -Sy, so the two directory
+// mtimes tell whether anything changed
+static void db_mtimes(struct timespec *local, struct timespec *sync) {
+    char path[PATH_MAX + 8];
+    struct stat st;
+
+    memset(local, 0, sizeof(*local));
+    memset(sync, 0, sizeof(*sync));
+
+    snprintf(path, sizeof(path), "%s/local", opened_dbpath);
+    if (stat(path, &st) == 0) *local = st.st_mtim;
+    snprintf(path, sizeof(path), "%s/sync", opened_dbpath);
+    if (stat(path, &st) == 0) *sync = st.st_mtim;
+}
+
+// Open the local and sync databases once per run. Every query opens
+// them on demand, so commands that never look at pacman's state pay
+// nothing. The databases are read lazily by libalpm, which means the
+// first query after a `pacman -Sy` still sees the fresh sync files.
+int pacdb_open(void) {
+    char root[PATH_MAX];
+    char dbpath[PATH_MAX];
+    char **repos = NULL;
+    int repo_count = 0;
+    alpm_errno_t err;
+
+    if (handle != NULL) return 0;
+
+    if (read_pacman_conf(root, dbpath, sizeof(root), &repos, &repo_count) != 0) {
+        return 1;
+    }
+
+    handle = alpm_initialize(root, dbpath, &err);
+    if (handle == NULL) {
+        fprintf(stderr, "Error: Failed to open pacman database %s: %s\n", dbpath, alpm_strerror(err));
+        for (int i = 0; i < repo_count; i++) free(repos[i]);
+        free(repos);
+        return 1;
+    }
+
+    for (int i = 0; i < repo_count; i++) {
+        if (repos[i] && alpm_register_syncdb(handle, repos[i], ALPM_SIG_USE_DEFAULT) == NULL) {
+            fprintf(stderr, "Warning: Failed to register repository %s: %s\n",
+                    repos[i], alpm_strerror(alpm_errno(handle)));
+        }
+        free(repos[i]);
+    }
+    free(repos);
+
+    snprintf(opened_dbpath, sizeof(opened_dbpath), "%s", dbpath);
+    db_mtimes(&local_mtime, &sync_mtime);
+    return 0;
+}
+
+void pacdb_close(void) {
+    if (handle != NULL) {
+        alpm_release(handle);
+        handle = NULL;
+    }
+}
+
+// For long-running processes: drop the handle if pacman touched the
+// databases since they were opened, so the next query reads them afresh
+void pacdb_refresh(void) {
+    struct timespec local, sync;
+
+    if (handle == NULL) return;
+
+    db_mtimes(&local, &sync);
+    if (local.tv_sec != local_mtime.tv_sec || local.tv_nsec != local_mtime.tv_nsec ||
+        sync.tv_sec != sync_mtime.tv_sec || sync.tv_nsec != sync_mtime.tv_nsec) {
+        pacdb_close();
+    }
+}
+
+static int in_sync_dbs(const char *name) {
+    for (alpm_list_t *i = alpm_get_syncdbs(handle); i; i = alpm_list_next(i)) {
+        if (alpm_db_get_pkg(i->data, name) != NULL) return 1;
+    }
+    return 0;
+}
+
+void free_installed_packages(InstalledPackage *packages, int count) {
+    if (packages == NULL) return;
+
+    for (int i = 0; i < count; i++) {
+        free(packages[i].name);
+        free(packages[i].version);
+    }
+
+    free(packages);
+}
+
+// Installed packages that no sync database provides, like pacman -Qm
+int pacdb_foreign_packages(InstalledPackage **packages, int *count) {
+    int capacity = 0;
+
+    *packages = NULL;
+    *count = 0;
+
+    if (pacdb_open() != 0) return 1;
+
+    alpm_db_t *local = alpm_get_localdb(handle);
+    for (alpm_list_t *i = alpm_db_get_pkgcache(local); i; i = alpm_list_next(i)) {
+        alpm_pkg_t *pkg = i->data;
+        if (in_sync_dbs(alpm_pkg_get_name(pkg))) continue;
+
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            InstalledPackage *grown = realloc(*packages, capacity * sizeof(InstalledPackage));
+            if (grown == NULL) {
+                fprintf(stderr, "Error: Failed to allocate memory\n");
+                free_installed_packages(*packages, *count);
+                *packages = NULL;
+                *count = 0;
+                return 1;
+            }
+            *packages = grown;
+        }
+
+        (*packages)[*count].name = strdup(alpm_pkg_get_name(pkg));
+        (*packages)[*count].version = strdup(alpm_pkg_get_version(pkg));
+        (*count)++;
+    }
+
+    return 0;
+}
+
+// Whether a package called exactly name is installed
+int pacdb_installed(const char *name) {
+    if (pacdb_open() != 0) return 0;
+    return alpm_db_get_pkg(alpm_get_localdb(handle), name) != NULL;
+}
+
+// Whether an installed package satisfies dep ("name", "name>=1.0" or a
+// provision), like pacman -T
+int pacdb_installed_satisfies(const char *dep) {
+    if (pacdb_open() != 0) return 0;
+    return alpm_find_satisfier(alpm_db_get_pkgcache(alpm_get_localdb(handle)), dep) != NULL;
+}
+
+// The repository that can satisfy dep, or NULL if none can
+const char *pacdb_repo_satisfier(const char *dep) {
+    if (pacdb_open() != 0) return NULL;
+
+    alpm_pkg_t *pkg = alpm_find_dbs_satisfier(handle, alpm_get_syncdbs(handle), dep);
+    return pkg ? alpm_db_get_name(alpm_pkg_get_db(pkg)) : NULL;
+}
+
+// The repository that has a package called exactly name, or NULL
+const char *pacdb_repo_of(const char *name) {
+    if (pacdb_open() != 0) return NULL;
+
+    for (alpm_list_t *i = alpm_get_syncdbs(handle); i; i = alpm_list_next(i)) {
+        if (alpm_db_get_pkg(i->data, name) != NULL) return alpm_db_get_name(i->data);
+    }
+    return NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef METHAUR_PACDB_H
+#define METHAUR_PACDB_H
+
+#define PACMAN_CONF "/etc/pacman.conf"
+#define PACMAN_ROOT_DIR "/"
+#define PACMAN_DB_PATH "/var/lib/pacman/"
+
+typedef struct {
+    char *name;
+    char *version;
+} InstalledPackage;
+
+int pacdb_open(void);
+void pacdb_close(void);
+void pacdb_refresh(void);
+
+int pacdb_foreign_packages(InstalledPackage **packages, int *count);
+void free_installed_packages(InstalledPackage *packages, int count);
+
+int pacdb_installed(const char *name);
+int pacdb_installed_satisfies(const char *dep);
+const char *pacdb_repo_satisfier(const char *dep);
+const char *pacdb_repo_of(const char *name);
+
+#endif
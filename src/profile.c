@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/statfs.h>
+#include <linux/magic.h>
+
+#include "build.h"
+#include "config.h"
+#include "profile.h"
+#include "util.h"
+
+static char profile_path[PATH_MAX];
+static int prepared = 0;
+
+static long long mem_available(void) {
+    FILE *fp = fopen("/proc/meminfo", "r");
+    char line[128];
+    long long kib = -1;
+
+    if (fp == NULL) return -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "MemAvailable: %lld kB", &kib) == 1) break;
+    }
+    fclose(fp);
+    return kib < 0 ? -1 : kib << 10;
+}
+
+// makepkg.conf is sourced by bash; quote values so nothing in them expands
+static void write_shell_word(FILE *fp, const char *str) {
+    putc('\'', fp);
+    for (; *str; str++) {
+        if (*str == '\'') {
+            fputs("'\\''", fp);
+        } else {
+            putc(*str, fp);
+        }
+    }
+    putc('\'', fp);
+}
+
+// Build in /dev/shm when it is a tmpfs with room to spare and the machine
+// has the memory to back it
+static int ram_build_dir(char *dir, size_t size) {
+    struct statfs st;
+
+    if (statfs("/dev/shm", &st) != 0 || st.f_type != TMPFS_MAGIC) return 1;
+    if ((long long)st.f_bavail * st.f_bsize < PROFILE_RAM_MIN_FREE) return 1;
+    if (mem_available() < PROFILE_RAM_MIN_AVAILABLE) return 1;
+
+    return snprintf(dir, size, "/dev/shm/methaur-%u", (unsigned)getuid()) >= (int)size;
+}
+
+// One make job per CPU, but no more than memory can feed. The load limit
+// keeps several makepkg runs at once from oversubscribing the machine.
+static void auto_make_flags(char *flags, size_t size) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long long memory = mem_available();
+    long jobs = cpus > 0 ? cpus : 1;
+
+    if (memory > 0 && memory / PROFILE_MEMORY_PER_JOB < jobs) {
+        jobs = memory / PROFILE_MEMORY_PER_JOB > 0 ? (long)(memory / PROFILE_MEMORY_PER_JOB) : 1;
+    }
+    snprintf(flags, size, "-j%ld -l%ld", jobs, cpus > 0 ? cpus : 1);
+}
+
+static int write_profile(FILE *fp) {
+    char build_dir[PATH_MAX];
+    char make_flags[CONFIG_FLAGS_MAX];
+    int ccache = 0, sccache = 0;
+    const char *compression = "makepkg.conf";
+
+    if (config.build_dir[0]) {
+        snprintf(build_dir, sizeof(build_dir), "%s", config.build_dir);
+    } else if (ram_build_dir(build_dir, sizeof(build_dir)) != 0) {
+        build_dir[0] = '\0';
+    }
+    if (build_dir[0] && mkdir_p(build_dir, 0700) != 0) {
+        fprintf(stderr, "Warning: Failed to create build directory %s\n", build_dir);
+        build_dir[0] = '\0';
+    }
+
+    if (config.make_flags[0]) {
+        snprintf(make_flags, sizeof(make_flags), "%s", config.make_flags);
+    } else {
+        auto_make_flags(make_flags, sizeof(make_flags));
+    }
+
+    switch (config.compiler_cache) {
+        case COMPILER_CACHE_AUTO:
+            ccache = find_program("ccache");
+            sccache = find_program("sccache");
+            break;
+        case COMPILER_CACHE_CCACHE:
+            ccache = 1;
+            break;
+        case COMPILER_CACHE_SCCACHE:
+            sccache = 1;
+            break;
+        case COMPILER_CACHE_NONE:
+            break;
+    }
+
+    // The system configuration first, including makepkg.conf.d, which
+    // makepkg only reads next to the file given with --config
+    fprintf(fp, "# Written by methaur for every makepkg run\n");
+    fprintf(fp, "source %s\n", MAKEPKG_CONF);
+    fprintf(fp, "for conf in %s.d/*.conf; do [[ -r $conf ]] && source \"$conf\"; done\n", MAKEPKG_CONF);
+
+    if (build_dir[0]) {
+        fprintf(fp, "BUILDDIR=");
+        write_shell_word(fp, build_dir);
+        putc('\n', fp);
+    }
+
+    fprintf(fp, "MAKEFLAGS=");
+    write_shell_word(fp, make_flags);
+    putc('\n', fp);
+
+    if (ccache) {
+        fprintf(fp, "BUILDENV=(\"${BUILDENV[@]/#!ccache/ccache}\")\n");
+        fprintf(fp, "[[ \" ${BUILDENV[*]} \" == *\" ccache \"* ]] || BUILDENV+=(ccache)\n");
+    }
+    if (sccache) {
+        // cargo picks this up; C and C++ are left to ccache
+        fprintf(fp, "export RUSTC_WRAPPER=sccache\n");
+    }
+
+    // Built packages are installed right away, so packing them small
+    // matters less than packing them fast
+    if (config.compression == COMPRESSION_FAST) {
+        fprintf(fp, "COMPRESSZST=(zstd -c -T0 --fast -)\n");
+        fprintf(fp, "PKGEXT='.pkg.tar.zst'\n");
+        compression = "zstd -T0 --fast";
+    } else if (config.compression == COMPRESSION_NONE) {
+        fprintf(fp, "PKGEXT='.pkg.tar'\n");
+        compression = "none";
+    }
+
+    printf("Build profile: BUILDDIR %s, MAKEFLAGS %s, compiler cache %s, compression %s\n",
+           build_dir[0] ? build_dir : "unchanged", make_flags,
+           ccache && sccache ? "ccache+sccache" : ccache ? "ccache" : sccache ? "sccache" : "none",
+           compression);
+
+    return ferror(fp) ? 1 : 0;
+}
+
+// The makepkg.conf that every makepkg run is pointed at with --config,
+// written on first use. NULL means makepkg runs with its own config.
+// ~/.config/pacman/makepkg.conf is still read after it and wins.
+const char *build_profile_config(void) {
+    if (prepared) return profile_path[0] ? profile_path : NULL;
+    prepared = 1;
+
+    if (access(MAKEPKG_CONF, R_OK) != 0 ||
+        snprintf(profile_path, sizeof(profile_path), "%s%s", TMP_DIR, PROFILE_CONF_NAME) >= (int)sizeof(profile_path) ||
+        mkdir_p(TMP_DIR, 0755) != 0) {
+        profile_path[0] = '\0';
+        return NULL;
+    }
+
+    FILE *fp = fopen(profile_path, "w");
+    if (fp == NULL || write_profile(fp) != 0) {
+        fprintf(stderr, "Warning: Failed to write %s, building with the default makepkg settings\n", profile_path);
+        if (fp) fclose(fp);
+        unlink(profile_path);
+        profile_path[0] = '\0';
+        return NULL;
+    }
+
+    fclose(fp);
+    return profile_path;
+}
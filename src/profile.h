@@ -0,0 +1,12 @@
+#ifndef METHAUR_PROFILE_H
+#define METHAUR_PROFILE_H
+
+#define MAKEPKG_CONF "/etc/makepkg.conf"
+#define PROFILE_CONF_NAME ".makepkg.conf"   // no pkgname starts with a dot
+#define PROFILE_RAM_MIN_AVAILABLE (4LL << 30)   // MemAvailable needed to build in RAM
+#define PROFILE_RAM_MIN_FREE (2LL << 30)        // free space needed in /dev/shm
+#define PROFILE_MEMORY_PER_JOB (2LL << 30)      // a heavy C++ compile needs about this much
+
+const char *build_profile_config(void);
+
+#endif
@@ -0,0 +1,986 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+#include "artifact.h"
+#include "aur.h"
+#include "build.h"
+#include "chroot.h"
+#include "config.h"
+#include "journal.h"
+#include "pacdb.h"
+#include "resolve.h"
+#include "trace.h"
+#include "util.h"
+#include "vcs.h"
+
+#define SRCINFO_LINE 4096
+
+typedef struct {
+    char **items;
+    int count;
+} StringList;
+
+static int string_list_find(const StringList *list, const char *str) {
+    for (int i = 0; i < list->count; i++) {
+        if (strcmp(list->items[i], str) == 0) return i;
+    }
+    return -1;
+}
+
+static int string_list_add(StringList *list, const char *str, int unique) {
+    if (unique && string_list_find(list, str) >= 0) return 0;
+
+    char **items = realloc(list->items, (list->count + 1) * sizeof(char *));
+    if (!items) return 1;
+    list->items = items;
+
+    list->items[list->count] = strdup(str);
+    if (!list->items[list->count]) return 1;
+    list->count++;
+    return 0;
+}
+
+static void string_list_free(StringList *list) {
+    free_string_list(list->items, list->count);
+    list->items = NULL;
+    list->count = 0;
+}
+
+// "foo>=1.2" -> "foo"
+static void dep_name(const char *dep, char *name, size_t size) {
+    size_t length = strcspn(dep, "<>=");
+    if (length >= size) length = size - 1;
+    memcpy(name, dep, length);
+    name[length] = '\0';
+}
+
+static int find_node(const BuildGraph *graph, const char *name) {
+    for (int i = 0; i < graph->count; i++) {
+        if (strcmp(graph->nodes[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// The node whose recipe builds package_name
+static int find_package(const BuildGraph *graph, const char *package_name) {
+    for (int i = 0; i < graph->count; i++) {
+        const StringList packages = { graph->nodes[i].packages, graph->nodes[i].package_count };
+        if (string_list_find(&packages, package_name) >= 0) return i;
+    }
+    return -1;
+}
+
+static int add_package(BuildNode *node, const char *package_name) {
+    StringList packages = { node->packages, node->package_count };
+    int failed = string_list_add(&packages, package_name, 1);
+    node->packages = packages.items;
+    node->package_count = packages.count;
+    return failed;
+}
+
+// Split packages of one pkgbase share a node, so the recipe is built once
+static int add_node(BuildGraph *graph, const char *pkgbase, const char *package_name, int explicit) {
+    int existing = find_node(graph, pkgbase);
+    if (existing >= 0) {
+        graph->nodes[existing].explicit |= explicit;
+        return add_package(&graph->nodes[existing], package_name) != 0 ? -1 : existing;
+    }
+
+    if (graph->count == graph->capacity) {
+        int capacity = graph->capacity ? graph->capacity * 2 : 16;
+        BuildNode *nodes = realloc(graph->nodes, capacity * sizeof(BuildNode));
+        if (!nodes) return -1;
+        graph->nodes = nodes;
+        graph->capacity = capacity;
+    }
+
+    BuildNode *node = &graph->nodes[graph->count];
+    memset(node, 0, sizeof(BuildNode));
+    node->name = strdup(pkgbase);
+    if (!node->name || add_package(node, package_name) != 0) {
+        free(node->name);
+        free(node->packages);
+        return -1;
+    }
+    node->explicit = explicit;
+    node->state = NODE_PENDING;
+    node->pid = -1;
+    node->source_pid = -1;
+    return graph->count++;
+}
+
+static int append_index(int **list, int *count, int value) {
+    for (int i = 0; i < *count; i++) {
+        if ((*list)[i] == value) return 0;
+    }
+
+    int *grown = realloc(*list, (*count + 1) * sizeof(int));
+    if (!grown) return 1;
+    *list = grown;
+    (*list)[(*count)++] = value;
+    return 0;
+}
+
+static int add_edge(BuildGraph *graph, int from, int to, DepKind kind) {
+    if (from == to) return 0;
+
+    BuildNode *node = &graph->nodes[from];
+    for (int d = 0; d < node->dep_count; d++) {
+        if (node->deps[d] != to) continue;
+        if (kind < node->dep_kinds[d]) node->dep_kinds[d] = kind;
+        return 0;
+    }
+
+    int *deps = realloc(node->deps, (node->dep_count + 1) * sizeof(int));
+    if (!deps) return 1;
+    node->deps = deps;
+    DepKind *kinds = realloc(node->dep_kinds, (node->dep_count + 1) * sizeof(DepKind));
+    if (!kinds) return 1;
+    node->dep_kinds = kinds;
+
+    node->deps[node->dep_count] = to;
+    node->dep_kinds[node->dep_count] = kind;
+    node->dep_count++;
+    node->blocked++;
+    return append_index(&graph->nodes[to].dependents, &graph->nodes[to].dependent_count, from);
+}
+
+// Collect depends, makedepends and checkdepends (including the variants
+// for this architecture) from every section of the package's .SRCINFO,
+// one list per DepKind.
+static int read_srcinfo_deps(const char *package_name, StringList deps[DEP_KIND_COUNT]) {
+    char path[PATH_MAX];
+    char line[SRCINFO_LINE];
+    char arch_suffix[80];
+    struct utsname uts;
+
+    if (package_build_dir(package_name, path, sizeof(path)) != 0 ||
+        strlen(path) + strlen("/.SRCINFO") >= sizeof(path)) {
+        return 1;
+    }
+    strcat(path, "/.SRCINFO");
+
+    if (uname(&uts) != 0) {
+        snprintf(uts.machine, sizeof(uts.machine), "x86_64");
+    }
+    snprintf(arch_suffix, sizeof(arch_suffix), "_%s", uts.machine);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: %s has no .SRCINFO\n", package_name);
+        return 1;
+    }
+
+    static const char *keys[DEP_KIND_COUNT] = { "depends", "makedepends", "checkdepends" };
+    int failed = 0;
+
+    while (!failed && fgets(line, sizeof(line), fp) != NULL) {
+        char *key = line;
+        while (*key == ' ' || *key == '\t') key++;
+
+        char *value = strstr(key, " = ");
+        if (value == NULL) continue;
+        *value = '\0';
+        value += 3;
+        value[strcspn(value, "\r\n")] = '\0';
+        if (*value == '\0') continue;
+
+        for (int k = 0; k < DEP_KIND_COUNT; k++) {
+            size_t length = strlen(keys[k]);
+            if (strncmp(key, keys[k], length) != 0) continue;
+
+            if (key[length] == '\0' || strcmp(key + length, arch_suffix) == 0) {
+                failed = string_list_add(&deps[k], value, 1);
+            }
+            break;
+        }
+    }
+
+    fclose(fp);
+    return failed;
+}
+
+// Fetch and inspect every node in [first, graph->count), discovering the
+// next layer of AUR dependencies. Fetches and checks are batched per layer.
+static int resolve_layer(BuildGraph *graph, int first) {
+    int last = graph->count;
+    StringList (*node_deps)[DEP_KIND_COUNT] = calloc(last - first, sizeof(*node_deps));
+    StringList unknown = {0}, missing = {0}, aur_names = {0};
+    AurInfo *info = NULL;
+    int info_count = 0;
+    int failed = 0;
+
+    if (!node_deps) return 1;
+
+    const char **names = malloc((last - first) * sizeof(char *));
+    if (!names) {
+        free(node_deps);
+        return 1;
+    }
+    for (int i = first; i < last; i++) {
+        names[i - first] = graph->nodes[i].name;
+    }
+    failed = fetch_aur_sources(names, last - first) != 0;
+    free(names);
+
+    for (int i = first; i < last && !failed; i++) {
+        failed = read_srcinfo_deps(graph->nodes[i].name, node_deps[i - first]) != 0;
+    }
+
+    // Dependencies on packages already in the graph are plain edges;
+    // everything else still has to be classified
+    for (int i = first; i < last && !failed; i++) {
+        for (int k = 0; k < DEP_KIND_COUNT; k++) {
+            const StringList *deps = &node_deps[i - first][k];
+            for (int d = 0; d < deps->count && !failed; d++) {
+                char name[256];
+                dep_name(deps->items[d], name, sizeof(name));
+                if (find_package(graph, name) < 0) {
+                    failed = string_list_add(&unknown, deps->items[d], 1);
+                }
+            }
+        }
+    }
+
+    // A clean build sees nothing the host has installed, only the
+    // repositories and what this run builds
+    for (int u = 0; u < unknown.count && !failed; u++) {
+        int satisfied = config.clean_build ? pacdb_repo_satisfier(unknown.items[u]) != NULL
+                                           : pacdb_installed_satisfies(unknown.items[u]);
+        if (!satisfied) {
+            failed = string_list_add(&missing, unknown.items[u], 1);
+        }
+    }
+
+    for (int m = 0; m < missing.count && !failed; m++) {
+        if (pacdb_repo_satisfier(missing.items[m]) != NULL) {
+            StringList repo = { graph->repo_deps, graph->repo_dep_count };
+            failed = string_list_add(&repo, missing.items[m], 1);
+            graph->repo_deps = repo.items;
+            graph->repo_dep_count = repo.count;
+        } else {
+            char name[256];
+            dep_name(missing.items[m], name, sizeof(name));
+            failed = string_list_add(&aur_names, name, 1);
+        }
+    }
+
+    if (!failed && aur_names.count > 0) {
+        failed = aur_info_query((const char **)aur_names.items, aur_names.count, &info, &info_count) != 0;
+    }
+
+    // A dependency on a split package of a recipe already in the graph
+    // joins that node instead of starting a new one
+    for (int a = 0; a < aur_names.count && !failed; a++) {
+        const AurInfo *remote = aur_info_find(info, info_count, aur_names.items[a]);
+        if (remote == NULL) {
+            fprintf(stderr, "Error: Dependency %s not found in repositories or AUR\n", aur_names.items[a]);
+            failed = 1;
+        } else if (add_node(graph, remote->package_base, aur_names.items[a], 0) < 0) {
+            failed = 1;
+        }
+    }
+
+    for (int i = first; i < last && !failed; i++) {
+        for (int k = 0; k < DEP_KIND_COUNT; k++) {
+            const StringList *deps = &node_deps[i - first][k];
+            for (int d = 0; d < deps->count && !failed; d++) {
+                char name[256];
+                dep_name(deps->items[d], name, sizeof(name));
+                int target = find_package(graph, name);
+                if (target >= 0) failed = add_edge(graph, i, target, (DepKind)k);
+            }
+        }
+    }
+
+    for (int i = 0; i < last - first; i++) {
+        for (int k = 0; k < DEP_KIND_COUNT; k++) {
+            string_list_free(&node_deps[i][k]);
+        }
+    }
+    free(node_deps);
+    string_list_free(&unknown);
+    string_list_free(&missing);
+    string_list_free(&aur_names);
+    free_aur_info(info, info_count);
+    return failed;
+}
+
+// What the installed targets need at run time; the rest of the graph is
+// only needed to build them
+static void mark_runtime(BuildGraph *graph, int index) {
+    BuildNode *node = &graph->nodes[index];
+
+    if (node->runtime) return;
+    node->runtime = 1;
+    for (int d = 0; d < node->dep_count; d++) {
+        if (node->dep_kinds[d] == DEP_RUNTIME) mark_runtime(graph, node->deps[d]);
+    }
+}
+
+// Fetch the targets and, layer by layer, every AUR package they need to
+// build. Targets are package names; the graph is made of their pkgbases.
+// Repo-satisfiable dependencies end up in graph->repo_deps.
+int resolve_build_graph(const char **targets, int count, BuildGraph *graph) {
+    AurInfo *info = NULL;
+    int info_count = 0;
+    int failed;
+
+    memset(graph, 0, sizeof(BuildGraph));
+
+    failed = aur_info_query(targets, count, &info, &info_count) != 0;
+    for (int i = 0; i < count && !failed; i++) {
+        const AurInfo *remote = aur_info_find(info, info_count, targets[i]);
+        if (remote == NULL) {
+            fprintf(stderr, "Error: Package %s not found in AUR\n", targets[i]);
+            failed = 1;
+        } else if (add_node(graph, remote->package_base, targets[i], 1) < 0) {
+            failed = 1;
+        }
+    }
+    free_aur_info(info, info_count);
+    if (failed) return 1;
+
+    printf("Resolving dependencies...\n");
+
+    int first = 0;
+    while (first < graph->count) {
+        int last = graph->count;
+        if (resolve_layer(graph, first) != 0) return 1;
+        first = last;
+    }
+
+    for (int i = 0; i < graph->count; i++) {
+        if (graph->nodes[i].explicit) mark_runtime(graph, i);
+    }
+    return 0;
+}
+
+static void skip_dependents(BuildGraph *graph, int index) {
+    BuildNode *node = &graph->nodes[index];
+
+    for (int i = 0; i < node->dependent_count; i++) {
+        BuildNode *dependent = &graph->nodes[node->dependents[i]];
+        if (dependent->state != NODE_PENDING) continue;
+
+        fprintf(stderr, "Skipping %s: dependency %s failed\n", dependent->name, node->name);
+        dependent->state = NODE_SKIPPED;
+        skip_dependents(graph, node->dependents[i]);
+    }
+}
+
+static void mark_built(BuildGraph *graph, int index) {
+    BuildNode *node = &graph->nodes[index];
+
+    node->state = NODE_BUILT;
+    for (int d = 0; d < node->dependent_count; d++) {
+        graph->nodes[node->dependents[d]].blocked--;
+    }
+}
+
+// "/x/foo-docs-1:2.0-1-x86_64.pkg.tar.zst" -> "foo-docs"
+static int package_file_name(const char *path, char *name, size_t size) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+
+    const char *end = strstr(base, ".pkg.tar");
+    if (end == NULL) return 1;
+
+    // Drop -pkgver, -pkgrel and -arch
+    for (int field = 0; field < 3; field++) {
+        while (end > base && end[-1] != '-') end--;
+        if (end == base) return 1;
+        end--;
+    }
+
+    if ((size_t)(end - base) >= size) return 1;
+    memcpy(name, base, end - base);
+    name[end - base] = '\0';
+    return 0;
+}
+
+// A recipe builds all of its split packages. Keep the files of the wanted
+// ones and, for a target, of siblings that are installed already so they
+// stay in step; a dependency's siblings are left alone.
+static void select_package_files(const BuildNode *node, char **files, int *file_count) {
+    const StringList packages = { node->packages, node->package_count };
+    char name[256];
+    int kept = 0;
+
+    for (int i = 0; i < *file_count; i++) {
+        int wanted = package_file_name(files[i], name, sizeof(name)) == 0 &&
+                     (string_list_find(&packages, name) >= 0 || (node->explicit && pacdb_installed(name)));
+        if (wanted) {
+            files[kept++] = files[i];
+        } else {
+            free(files[i]);
+        }
+    }
+    *file_count = kept;
+}
+
+// The journal and the VCS records are kept per package name
+static void record_installed(const BuildNode *node, char **files, int file_count) {
+    char name[256];
+
+    journal_record(node->name, JOURNAL_INSTALLED, NULL, 0);
+    for (int i = 0; i < file_count; i++) {
+        if (package_file_name(files[i], name, sizeof(name)) != 0) continue;
+        if (strcmp(name, node->name) != 0) journal_record(name, JOURNAL_INSTALLED, NULL, 0);
+        vcs_record_build(node->name, name);
+    }
+}
+
+// Dependents install these into their chroot before they build. Files
+// from the artifact cache or the journal are linked (or copied) into the
+// build directory, which stays until the graph is done, so neither an
+// eviction nor the journal dropping its copy pulls them away.
+static int keep_chroot_files(BuildNode *node, char **files, int file_count) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+
+    if (package_build_dir(node->name, dir, sizeof(dir)) != 0) return 1;
+    node->chroot_files = calloc(file_count, sizeof(char *));
+    if (!node->chroot_files) return 1;
+
+    for (int i = 0; i < file_count; i++) {
+        const char *base = strrchr(files[i], '/');
+        base = base ? base + 1 : files[i];
+
+        if (snprintf(path, sizeof(path), "%s/%s", dir, base) >= (int)sizeof(path)) return 1;
+        if (strcmp(path, files[i]) != 0) {
+            unlink(path);
+            if (link(files[i], path) != 0 && copy_file(files[i], path, 0) != 0) {
+                fprintf(stderr, "Error: Failed to keep %s for the clean builds of its dependents\n", base);
+                return 1;
+            }
+        }
+
+        node->chroot_files[i] = strdup(path);
+        if (!node->chroot_files[i]) return 1;
+        node->chroot_file_count++;
+    }
+    return 0;
+}
+
+static void drop_installed_files(char **files, int *file_count) {
+    char name[256];
+    int kept = 0;
+
+    for (int i = 0; i < *file_count; i++) {
+        if (package_file_name(files[i], name, sizeof(name)) == 0 && pacdb_installed(name)) {
+            free(files[i]);
+        } else {
+            files[kept++] = files[i];
+        }
+    }
+    *file_count = kept;
+}
+
+// Only what other nodes need has to be installed before the graph is
+// done. Targets nothing depends on keep their package files until the
+// end, when they all go into one pacman transaction and every hook runs
+// once. Takes ownership of files.
+static int install_built(BuildGraph *graph, int index, char **files, int file_count) {
+    BuildNode *node = &graph->nodes[index];
+
+    select_package_files(node, files, &file_count);
+    if (file_count == 0) {
+        fprintf(stderr, "Error: Building %s produced none of its wanted packages\n", node->name);
+        free(files);
+        return 1;
+    }
+
+    if (node->explicit && node->dependent_count == 0) {
+        node->files = files;
+        node->file_count = file_count;
+        return 0;
+    }
+
+    if (config.clean_build) {
+        if (keep_chroot_files(node, files, file_count) != 0) {
+            free_string_list(files, file_count);
+            return 1;
+        }
+        // The host only needs what the targets run with, and only what it
+        // does not have yet; build-only dependencies stay in the chroots
+        if (!node->runtime) {
+            free_string_list(files, file_count);
+            return 0;
+        }
+        if (!node->explicit) drop_installed_files(files, &file_count);
+        if (file_count == 0) {
+            free(files);
+            return 0;
+        }
+    }
+
+    printf("Installing %s...\n", node->name);
+    int status = install_package_files(files, file_count, !node->explicit);
+    if (status != 0) {
+        fprintf(stderr, "Error: Failed to install package %s\n", node->name);
+        free_string_list(files, file_count);
+        return 1;
+    }
+
+    record_installed(node, files, file_count);
+    free_string_list(files, file_count);
+    // The kept copies may live in the build directory
+    if (node->chroot_file_count == 0) clean_build_files(node->name);
+    return 0;
+}
+
+static int install_held_back(BuildGraph *graph) {
+    char **files = NULL;
+    int file_count = 0;
+    int status = 0;
+
+    for (int i = 0; i < graph->count; i++) {
+        BuildNode *node = &graph->nodes[i];
+        if (node->file_count == 0) continue;
+
+        char **grown = realloc(files, (file_count + node->file_count) * sizeof(char *));
+        if (grown == NULL) {
+            status = 1;
+            break;
+        }
+        files = grown;
+        memcpy(files + file_count, node->files, node->file_count * sizeof(char *));
+        file_count += node->file_count;
+    }
+
+    if (status == 0 && file_count > 0) {
+        printf("Installing %d package%s in one transaction...\n", file_count, file_count == 1 ? "" : "s");
+        status = install_package_files(files, file_count, 0);
+    }
+    free(files);
+
+    for (int i = 0; i < graph->count; i++) {
+        BuildNode *node = &graph->nodes[i];
+        if (node->file_count == 0) continue;
+
+        if (status != 0) {
+            fprintf(stderr, "Error: Failed to install package %s\n", node->name);
+            node->state = NODE_FAILED;
+        } else {
+            record_installed(node, node->files, node->file_count);
+        }
+        clean_build_files(node->name);
+        free_string_list(node->files, node->file_count);
+        node->files = NULL;
+        node->file_count = 0;
+    }
+
+    return status;
+}
+
+// Install a node straight from the artifact cache, or with what an
+// interrupted upgrade built for it. Returns 0 when it was installed (or
+// held back), 1 on a cache miss and -1 if the cached files failed to
+// install.
+static int install_cached(BuildGraph *graph, int index) {
+    BuildNode *node = &graph->nodes[index];
+    char key[PATH_MAX];
+    char **files = NULL;
+    int file_count = 0;
+
+    // The scheduler asks again on every pass while the sources download;
+    // a miss stays a miss for the rest of the run
+    if (node->cache_checked) return 1;
+
+    if (journal_built_files(node->name, &files, &file_count) == 0) {
+        printf("Using %s built by the interrupted upgrade\n", node->name);
+        return install_built(graph, index, files, file_count) != 0 ? -1 : 0;
+    }
+
+    if (artifact_key(node->name, key, sizeof(key)) != 0 ||
+        artifact_lookup(key, &files, &file_count) != 0) {
+        node->cache_checked = 1;
+        return 1;
+    }
+
+    printf("Using %s from the build cache\n", node->name);
+    return install_built(graph, index, files, file_count) != 0 ? -1 : 0;
+}
+
+// Add the kept files of every node the one at index depends on, each
+// once. Below the first level only depends count: installing a package
+// does not need what it was built with.
+static int collect_chroot_files(const BuildGraph *graph, int index, int runtime_only, char *seen,
+                                char ***files, int *count) {
+    const BuildNode *node = &graph->nodes[index];
+
+    for (int d = 0; d < node->dep_count; d++) {
+        int dep_index = node->deps[d];
+        const BuildNode *dep = &graph->nodes[dep_index];
+        if (seen[dep_index] || (runtime_only && node->dep_kinds[d] != DEP_RUNTIME)) continue;
+        seen[dep_index] = 1;
+
+        // Deepest first, so every package comes after what it needs
+        if (collect_chroot_files(graph, dep_index, 1, seen, files, count) != 0) return 1;
+        if (dep->chroot_file_count > 0) {
+            char **grown = realloc(*files, (*count + dep->chroot_file_count) * sizeof(char *));
+            if (!grown) return 1;
+            *files = grown;
+            memcpy(*files + *count, dep->chroot_files, dep->chroot_file_count * sizeof(char *));
+            *count += dep->chroot_file_count;
+        }
+    }
+    return 0;
+}
+
+// The chroot has none of the AUR dependencies, so the ones built (or
+// taken from the cache) in this run are handed to it, along with what
+// they depend on in turn
+static pid_t start_clean_build(const BuildGraph *graph, int index, const char *log) {
+    char **dep_files = NULL;
+    int dep_count = 0;
+    char *seen = calloc(graph->count, 1);
+
+    if (!seen || collect_chroot_files(graph, index, 0, seen, &dep_files, &dep_count) != 0) {
+        free(seen);
+        free(dep_files);
+        return -1;
+    }
+
+    pid_t pid = chroot_start_build(graph->nodes[index].name, dep_files, dep_count, log);
+    free(seen);
+    free(dep_files);
+    return pid;
+}
+
+static int start_build(BuildGraph *graph, int index, int jobs) {
+    BuildNode *node = &graph->nodes[index];
+    char log_path[PATH_MAX];
+    const char *log = NULL;
+
+    // Interleaved makepkg output is unreadable, so parallel builds log to files
+    if (jobs > 1 && graph->count > 1) {
+        snprintf(log_path, sizeof(log_path), "%s%s.log", TMP_DIR, node->name);
+        log = log_path;
+        printf("Building %s (log: %s)...\n", node->name, log_path);
+    } else {
+        printf("Building %s...\n", node->name);
+    }
+
+    if (config.clean_build) {
+        node->pid = start_clean_build(graph, index, log);
+    } else {
+        node->pid = start_makepkg(node->name, log);
+    }
+    if (node->pid < 0) {
+        node->state = NODE_FAILED;
+        return 1;
+    }
+
+    node->state = NODE_BUILDING;
+    return 0;
+}
+
+static int finish_build(BuildGraph *graph, int index, int status) {
+    BuildNode *node = &graph->nodes[index];
+    char **files = NULL;
+    int file_count = 0;
+
+    node->pid = -1;
+    // makechrootpkg has copied the packages out of the overlay by now
+    if (config.clean_build) chroot_finish_build(node->name);
+    if (status != 0) {
+        fprintf(stderr, "Error: Failed to build package %s\n", node->name);
+        return 1;
+    }
+
+    if (list_built_packages(node->name, &files, &file_count) != 0) {
+        fprintf(stderr, "Error: Failed to install package %s\n", node->name);
+        free_string_list(files, file_count);
+        return 1;
+    }
+
+    // The journal only needs its own copy of what the cache does not keep
+    char key[PATH_MAX];
+    if (artifact_key(node->name, key, sizeof(key)) == 0 && artifact_store(key, files, file_count) == 0) {
+        journal_record(node->name, JOURNAL_BUILT, NULL, 0);
+    } else {
+        journal_record(node->name, JOURNAL_BUILT, files, file_count);
+    }
+
+    return install_built(graph, index, files, file_count);
+}
+
+// Sources are downloaded into the build directory, so a package that
+// will come out of the artifact cache (or the journal) has nothing to fetch
+static int needs_sources(BuildNode *node) {
+    char key[PATH_MAX];
+    char **files = NULL;
+    int file_count = 0;
+
+    if (node->cache_checked) return 1;
+    if (journal_built_files(node->name, &files, &file_count) == 0) {
+        free_string_list(files, file_count);
+        return 0;
+    }
+
+    if (artifact_key(node->name, key, sizeof(key)) != 0 ||
+        artifact_lookup(key, &files, &file_count) != 0) {
+        node->cache_checked = 1;
+        return 1;
+    }
+    free_string_list(files, file_count);
+    return 0;
+}
+
+static int start_source_fetch(BuildGraph *graph, int index) {
+    BuildNode *node = &graph->nodes[index];
+    char log_path[PATH_MAX];
+
+    if (!needs_sources(node)) {
+        node->sources_ready = 1;
+        return 0;
+    }
+
+    // Always logged: downloads run alongside whatever is building
+    snprintf(log_path, sizeof(log_path), "%s%s-sources.log", TMP_DIR, node->name);
+    printf("Downloading sources for %s...\n", node->name);
+
+    node->source_pid = start_source_download(node->name, log_path);
+    if (node->source_pid < 0) {
+        fprintf(stderr, "Error: Failed to download sources for %s\n", node->name);
+        node->state = NODE_FAILED;
+        skip_dependents(graph, index);
+        return 1;
+    }
+
+    trace_process_label(node->source_pid, "sources", node->name);
+    return 0;
+}
+
+// Keep up to SOURCE_MAX_JOBS downloads going. Packages that could build
+// right now come first and are always allowed; beyond those, at most
+// prefetch packages still waiting on dependencies get their sources early.
+static void start_source_fetches(BuildGraph *graph, int prefetch, int *fetching) {
+    int ahead = 0;
+
+    for (int i = 0; i < graph->count; i++) {
+        const BuildNode *node = &graph->nodes[i];
+        if (node->state == NODE_PENDING && node->blocked > 0 &&
+            (node->sources_ready || node->source_pid > 0)) {
+            ahead++;
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < graph->count && *fetching < SOURCE_MAX_JOBS; i++) {
+            BuildNode *node = &graph->nodes[i];
+            if (node->state != NODE_PENDING || node->sources_ready || node->source_pid > 0) continue;
+            if (pass == 0 && node->blocked > 0) continue;
+            if (pass == 1 && ahead >= prefetch) return;
+
+            if (start_source_fetch(graph, i) == 0 && node->source_pid > 0) {
+                (*fetching)++;
+                if (pass == 1) ahead++;
+            }
+        }
+    }
+}
+
+// Build the graph in topological order with up to jobs makepkg processes
+// at once. A dependency is installed as soon as it is built (or found in
+// the artifact cache) so that its dependents can start; the targets are
+// installed together once everything is built. With prefetch > 0 the
+// upstream sources are downloaded in a separate stage that runs ahead of
+// the builds, so downloads overlap with compiling instead of alternating
+// with it. Returns the number of packages not built.
+int build_graph_run(BuildGraph *graph, int jobs, int prefetch) {
+    int running = 0;
+    int fetching = 0;
+    int unfinished = 0;
+
+    if (jobs < 1) jobs = 1;
+
+    // Without prefetching makepkg downloads the sources itself
+    for (int i = 0; i < graph->count; i++) {
+        graph->nodes[i].sources_ready = prefetch <= 0;
+    }
+
+    for (;;) {
+        for (int i = 0; i < graph->count && running < jobs; i++) {
+            BuildNode *node = &graph->nodes[i];
+            if (node->state != NODE_PENDING || node->blocked > 0) continue;
+
+            int cached = install_cached(graph, i);
+            if (cached == 0) {
+                // Dependents may have become ready; rescan from the start
+                mark_built(graph, i);
+                i = -1;
+                continue;
+            } else if (cached < 0) {
+                node->state = NODE_FAILED;
+                skip_dependents(graph, i);
+            } else if (!node->sources_ready) {
+                continue;
+            } else if (start_build(graph, i, jobs) == 0) {
+                running++;
+            } else {
+                skip_dependents(graph, i);
+            }
+        }
+
+        if (prefetch > 0) {
+            start_source_fetches(graph, prefetch, &fetching);
+        }
+
+        if (running == 0 && fetching == 0) break;
+
+        struct rusage usage;
+        int status;
+        pid_t pid = wait4(-1, &status, 0, &usage);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        trace_process_end(pid, &usage);
+
+        int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        for (int i = 0; i < graph->count; i++) {
+            BuildNode *node = &graph->nodes[i];
+
+            if (node->source_pid == pid) {
+                fetching--;
+                node->source_pid = -1;
+                if (exit_code == 0) {
+                    node->sources_ready = 1;
+                    journal_record(node->name, JOURNAL_FETCHED, NULL, 0);
+                } else if (node->state == NODE_PENDING) {
+                    fprintf(stderr, "Error: Failed to download sources for %s (log: %s%s-sources.log)\n",
+                            node->name, TMP_DIR, node->name);
+                    node->state = NODE_FAILED;
+                    skip_dependents(graph, i);
+                }
+                break;
+            }
+
+            if (node->state != NODE_BUILDING || node->pid != pid) continue;
+
+            running--;
+            if (finish_build(graph, i, exit_code) == 0) {
+                mark_built(graph, i);
+            } else {
+                node->state = NODE_FAILED;
+                skip_dependents(graph, i);
+            }
+            break;
+        }
+    }
+
+    double start = trace_now();
+    install_held_back(graph);
+    trace_end("phase", "install", NULL, start);
+
+    for (int i = 0; i < graph->count; i++) {
+        if (graph->nodes[i].chroot_file_count > 0) clean_build_files(graph->nodes[i].name);
+    }
+
+    for (int i = 0; i < graph->count; i++) {
+        if (graph->nodes[i].state == NODE_PENDING) {
+            fprintf(stderr, "Error: Dependency cycle involving %s\n", graph->nodes[i].name);
+        }
+        if (graph->nodes[i].state != NODE_BUILT) unfinished++;
+    }
+
+    return unfinished;
+}
+
+void free_build_graph(BuildGraph *graph) {
+    for (int i = 0; i < graph->count; i++) {
+        free(graph->nodes[i].name);
+        free_string_list(graph->nodes[i].packages, graph->nodes[i].package_count);
+        free(graph->nodes[i].deps);
+        free(graph->nodes[i].dep_kinds);
+        free(graph->nodes[i].dependents);
+        free_string_list(graph->nodes[i].files, graph->nodes[i].file_count);
+        free_string_list(graph->nodes[i].chroot_files, graph->nodes[i].chroot_file_count);
+    }
+    free(graph->nodes);
+    free_string_list(graph->repo_deps, graph->repo_dep_count);
+    memset(graph, 0, sizeof(BuildGraph));
+}
+
+static int install_repo_deps(const BuildGraph *graph) {
+    if (graph->repo_dep_count == 0) return 0;
+
+    char **argv = calloc(graph->repo_dep_count + 7, sizeof(char *));
+    if (!argv) return 1;
+
+    int argc = 0;
+    argv[argc++] = "sudo";
+    argv[argc++] = "pacman";
+    argv[argc++] = "-S";
+    argv[argc++] = "--needed";
+    argv[argc++] = "--asdeps";
+    argv[argc++] = "--noconfirm";
+    for (int i = 0; i < graph->repo_dep_count; i++) {
+        argv[argc++] = graph->repo_deps[i];
+    }
+
+    printf("Installing %d repository dependenc%s...\n", graph->repo_dep_count,
+           graph->repo_dep_count == 1 ? "y" : "ies");
+    int status = run_command(argv, NULL);
+    free(argv);
+    return status;
+}
+
+// Resolve, install repo dependencies in one transaction, then build the
+// AUR packages in parallel. built_targets (optional) receives how many of
+// the requested targets were built and installed.
+int build_aur_packages(const char **targets, int count, int *built_targets) {
+    BuildGraph graph;
+    int jobs = config.build_jobs;
+
+    if (built_targets) *built_targets = 0;
+    if (count <= 0) return 0;
+    if (require_sudo() != 0) return 1;
+
+    if (jobs <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (int)cpus : 1;
+    }
+
+    double start = trace_now();
+    if (resolve_build_graph(targets, count, &graph) != 0) {
+        fprintf(stderr, "Error: Failed to resolve dependencies\n");
+        free_build_graph(&graph);
+        return 1;
+    }
+    trace_end("phase", "resolve", targets[0], start);
+
+    // Clean builds install their repository dependencies in the chroot,
+    // and pacman -U pulls in whatever the host needs to run the packages
+    start = trace_now();
+    if (!config.clean_build && install_repo_deps(&graph) != 0) {
+        fprintf(stderr, "Error: Failed to install repository dependencies\n");
+        free_build_graph(&graph);
+        return 1;
+    }
+    trace_end("phase", "repo deps", NULL, start);
+
+    start = trace_now();
+    int unfinished = build_graph_run(&graph, jobs, config.prefetch_depth);
+    trace_end("phase", "build", NULL, start);
+
+    if (built_targets) {
+        for (int i = 0; i < count; i++) {
+            int node = find_package(&graph, targets[i]);
+            if (node >= 0 && graph.nodes[node].state == NODE_BUILT) (*built_targets)++;
+        }
+    }
+
+    free_build_graph(&graph);
+    return unfinished > 0;
+}
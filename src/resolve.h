@@ -0,0 +1,64 @@
+#ifndef METHAUR_RESOLVE_H
+#define METHAUR_RESOLVE_H
+
+#include <sys/types.h>
+
+typedef enum {
+    NODE_PENDING,
+    NODE_BUILDING,
+    NODE_BUILT,
+    NODE_FAILED,
+    NODE_SKIPPED
+} NodeState;
+
+// What an edge came from in the .SRCINFO; an edge declared more than
+// once keeps the first kind in this order
+typedef enum {
+    DEP_RUNTIME,             // depends
+    DEP_MAKE,                // makedepends
+    DEP_CHECK,               // checkdepends
+    DEP_KIND_COUNT
+} DepKind;
+
+// One AUR recipe to build, named by its pkgbase; packages are the names
+// of its (split) packages that are wanted. deps and dependents are
+// indices into the graph's node array, and dep_kinds says why each dep is
+// needed; blocked counts deps that are not built yet.
+typedef struct {
+    char *name;
+    char **packages;
+    int package_count;
+    int explicit;
+    int runtime;             // a target, or reachable from one through depends alone
+    int *deps;
+    DepKind *dep_kinds;
+    int dep_count;
+    int *dependents;
+    int dependent_count;
+    int blocked;
+    NodeState state;
+    pid_t pid;
+    int cache_checked;       // not in the journal or the artifact cache, so it has to be built
+    int sources_ready;       // upstream sources downloaded, or nothing to download
+    pid_t source_pid;        // makepkg --verifysource in flight, or -1
+    char **files;            // built but held back for the final transaction
+    int file_count;
+    char **chroot_files;     // with CleanBuild, what its dependents install into their chroot
+    int chroot_file_count;
+} BuildNode;
+
+typedef struct {
+    BuildNode *nodes;
+    int count;
+    int capacity;
+    char **repo_deps;
+    int repo_dep_count;
+} BuildGraph;
+
+int resolve_build_graph(const char **targets, int count, BuildGraph *graph);
+int build_graph_run(BuildGraph *graph, int jobs, int prefetch);
+void free_build_graph(BuildGraph *graph);
+
+int build_aur_packages(const char **targets, int count, int *built_targets);
+
+#endif
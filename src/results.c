@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "results.h"
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+static char *arena_alloc(ResultSet *set, size_t size) {
+    ArenaBlock *block = set->blocks;
+
+    if (block == NULL || block->used + size > block->size) {
+        size_t block_size = size > RESULT_ARENA_BLOCK ? size : RESULT_ARENA_BLOCK;
+        block = malloc(sizeof(ArenaBlock) + block_size);
+        if (!block) return NULL;
+
+        block->next = set->blocks;
+        block->used = 0;
+        block->size = block_size;
+        set->blocks = block;
+    }
+
+    char *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+static uint64_t hash_string(const char *str) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (; *str; str++) {
+        hash ^= (unsigned char)*str;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Interned names are unique, so their address is their identity
+static uint64_t hash_pointer(const void *ptr) {
+    return (uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ULL;
+}
+
+static int grow_strings(ResultSet *set) {
+    size_t capacity = set->string_capacity ? set->string_capacity * 2 : 1024;
+    const char **strings = calloc(capacity, sizeof(char *));
+    if (!strings) return 1;
+
+    for (size_t i = 0; i < set->string_capacity; i++) {
+        const char *str = set->strings[i];
+        if (!str) continue;
+
+        size_t slot = hash_string(str) & (capacity - 1);
+        while (strings[slot]) slot = (slot + 1) & (capacity - 1);
+        strings[slot] = str;
+    }
+
+    free(set->strings);
+    set->strings = strings;
+    set->string_capacity = capacity;
+    return 0;
+}
+
+static int grow_names(ResultSet *set) {
+    size_t capacity = set->name_capacity ? set->name_capacity * 2 : 256;
+    int *by_name = malloc(capacity * sizeof(int));
+    if (!by_name) return 1;
+
+    memset(by_name, -1, capacity * sizeof(int));
+    for (int i = 0; i < set->count; i++) {
+        size_t slot = hash_pointer(set->items[i].name) & (capacity - 1);
+        while (by_name[slot] >= 0) slot = (slot + 1) & (capacity - 1);
+        by_name[slot] = i;
+    }
+
+    free(set->by_name);
+    set->by_name = by_name;
+    set->name_capacity = capacity;
+    return 0;
+}
+
+int result_set_init(ResultSet *set, const char *query) {
+    memset(set, 0, sizeof(ResultSet));
+    set->heap_size = -1;
+
+    set->query = strdup(query ? query : "");
+    if (!set->query || grow_strings(set) != 0 || grow_names(set) != 0) {
+        fprintf(stderr, "Error: Failed to allocate memory for results\n");
+        result_set_free(set);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Return the set's copy of str, storing it on first sight. Repeated
+// values (repo names, maintainers, versions) are kept once.
+const char *result_set_intern(ResultSet *set, const char *str) {
+    if (str == NULL) str = "";
+
+    if ((set->string_count + 1) * 10 > set->string_capacity * 7 && grow_strings(set) != 0) {
+        return NULL;
+    }
+
+    size_t slot = hash_string(str) & (set->string_capacity - 1);
+    while (set->strings[slot]) {
+        if (strcmp(set->strings[slot], str) == 0) return set->strings[slot];
+        slot = (slot + 1) & (set->string_capacity - 1);
+    }
+
+    size_t length = strlen(str) + 1;
+    char *copy = arena_alloc(set, length);
+    if (!copy) return NULL;
+
+    memcpy(copy, str, length);
+    set->strings[slot] = copy;
+    set->string_count++;
+    return copy;
+}
+
+// Exact name match first, then prefix and substring matches, each word
+// of a multi-word query counting its share; official repositories ahead
+// of the AUR; votes and popularity break the rest.
+static double score_package(const char *query, const Package *package) {
+    double score = 0;
+
+    if (strcasecmp(package->name, query) == 0) {
+        score += 1000;
+    } else {
+        char term[128];
+        double matched = 0;
+        int terms = 0;
+
+        for (const char *cursor = query; *cursor;) {
+            size_t skip = strspn(cursor, " \t");
+            size_t length = strcspn(cursor + skip, " \t");
+            if (length == 0) break;
+
+            snprintf(term, sizeof(term), "%.*s", (int)length, cursor + skip);
+            cursor += skip + length;
+            terms++;
+
+            if (strncasecmp(package->name, term, strlen(term)) == 0) {
+                matched += 100;
+            } else if (strcasestr(package->name, term) != NULL) {
+                matched += 50;
+            }
+        }
+        if (terms > 0) score += matched / terms;
+    }
+
+    if (strcmp(package->repo, "aur") != 0) score += 20;
+
+    score += 10 * log1p(package->votes > 0 ? package->votes : 0);
+    score += 10 * log1p(package->popularity > 0 ? package->popularity : 0);
+    return score;
+}
+
+// A repository package shadows an AUR package of the same name; within
+// the same kind of source the better-scored entry wins
+static int replaces(const Package *candidate, const Package *existing) {
+    int candidate_official = strcmp(candidate->repo, "aur") != 0;
+    int existing_official = strcmp(existing->repo, "aur") != 0;
+
+    if (candidate_official != existing_official) return candidate_official;
+    return candidate->score > existing->score;
+}
+
+// Add a hit; its strings are interned, so the caller's copies may be
+// transient. Must not be called once ranking has started.
+int result_set_add(ResultSet *set, const Package *package) {
+    Package entry;
+
+    if (set->heap_size >= 0) return 1;
+
+    entry.name = result_set_intern(set, package->name);
+    entry.version = result_set_intern(set, package->version);
+    entry.description = result_set_intern(set, package->description);
+    entry.maintainer = result_set_intern(set, package->maintainer);
+    entry.url = result_set_intern(set, package->url);
+    entry.repo = result_set_intern(set, package->repo);
+    if (!entry.name || !entry.version || !entry.description || !entry.maintainer || !entry.url || !entry.repo) {
+        fprintf(stderr, "Error: Failed to allocate memory for results\n");
+        return 1;
+    }
+    entry.votes = package->votes;
+    entry.popularity = package->popularity;
+    entry.score = score_package(set->query, &entry);
+
+    // Grown before probing: a full table would never end the probe loops
+    if ((size_t)(set->count + 1) * 10 > set->name_capacity * 7 && grow_names(set) != 0) {
+        fprintf(stderr, "Error: Failed to allocate memory for results\n");
+        return 1;
+    }
+
+    size_t slot = hash_pointer(entry.name) & (set->name_capacity - 1);
+    while (set->by_name[slot] >= 0) {
+        Package *existing = &set->items[set->by_name[slot]];
+        if (existing->name == entry.name) {
+            if (replaces(&entry, existing)) *existing = entry;
+            return 0;
+        }
+        slot = (slot + 1) & (set->name_capacity - 1);
+    }
+
+    if (set->count == set->capacity) {
+        int capacity = set->capacity ? set->capacity * 2 : 64;
+        Package *items = realloc(set->items, capacity * sizeof(Package));
+        if (!items) {
+            fprintf(stderr, "Error: Failed to allocate memory for results\n");
+            return 1;
+        }
+        set->items = items;
+        set->capacity = capacity;
+    }
+
+    set->items[set->count] = entry;
+    set->by_name[slot] = set->count;
+    set->count++;
+    return 0;
+}
+
+// The hit called name, or NULL. A lookup on the intern table and the
+// name map; name itself is not interned. Only valid before ranking.
+const Package *result_set_find(const ResultSet *set, const char *name) {
+    const char *interned = NULL;
+
+    size_t slot = hash_string(name) & (set->string_capacity - 1);
+    while (set->strings[slot]) {
+        if (strcmp(set->strings[slot], name) == 0) {
+            interned = set->strings[slot];
+            break;
+        }
+        slot = (slot + 1) & (set->string_capacity - 1);
+    }
+    if (interned == NULL || set->heap_size >= 0) return NULL;
+
+    slot = hash_pointer(interned) & (set->name_capacity - 1);
+    while (set->by_name[slot] >= 0) {
+        const Package *existing = &set->items[set->by_name[slot]];
+        if (existing->name == interned) return existing;
+        slot = (slot + 1) & (set->name_capacity - 1);
+    }
+    return NULL;
+}
+
+static int ranks_before(const Package *a, const Package *b) {
+    if (a->score != b->score) return a->score > b->score;
+    return strcmp(a->name, b->name) < 0;
+}
+
+static void sift_down(Package *heap, int size, int index) {
+    for (;;) {
+        int best = index;
+        int left = index * 2 + 1;
+        int right = left + 1;
+
+        if (left < size && ranks_before(&heap[left], &heap[best])) best = left;
+        if (right < size && ranks_before(&heap[right], &heap[best])) best = right;
+        if (best == index) return;
+
+        Package tmp = heap[index];
+        heap[index] = heap[best];
+        heap[best] = tmp;
+        index = best;
+    }
+}
+
+// The hit at rank (0 = best), or NULL past the end. Building the heap is
+// linear and each further rank costs one pop, so showing the first page
+// of a huge result set never sorts the rest.
+const Package *result_set_get(ResultSet *set, int rank) {
+    if (rank < 0 || rank >= set->count) return NULL;
+
+    if (set->heap_size < 0) {
+        set->heap_size = set->count;
+        for (int i = set->count / 2 - 1; i >= 0; i--) {
+            sift_down(set->items, set->heap_size, i);
+        }
+    }
+
+    // Popped hits collect at the end of the array, best last
+    while (set->count - set->heap_size <= rank) {
+        Package top = set->items[0];
+        set->heap_size--;
+        set->items[0] = set->items[set->heap_size];
+        set->items[set->heap_size] = top;
+        sift_down(set->items, set->heap_size, 0);
+    }
+
+    return &set->items[set->count - 1 - rank];
+}
+
+void result_set_free(ResultSet *set) {
+    ArenaBlock *block = set->blocks;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(set->query);
+    free(set->strings);
+    free(set->by_name);
+    free(set->items);
+    memset(set, 0, sizeof(ResultSet));
+}
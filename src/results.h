@@ -0,0 +1,47 @@
+#ifndef METHAUR_RESULTS_H
+#define METHAUR_RESULTS_H
+
+#include <stddef.h>
+
+#define RESULT_ARENA_BLOCK (64 * 1024)
+
+// A search hit. The strings are interned in the owning ResultSet and
+// live exactly as long as it does.
+typedef struct {
+    const char *name;
+    const char *version;
+    const char *description;
+    const char *maintainer;
+    const char *url;
+    const char *repo;
+    int votes;
+    double popularity;
+    double score;
+} Package;
+
+typedef struct ArenaBlock ArenaBlock;
+
+// All hits of one search, deduplicated by name. Ranking is lazy: the
+// best remaining hit is popped off a heap only when it is displayed.
+typedef struct {
+    char *query;
+    ArenaBlock *blocks;
+    const char **strings;        // intern table, open addressing
+    size_t string_capacity;
+    size_t string_count;
+    int *by_name;                // name -> index into items, open addressing
+    size_t name_capacity;
+    Package *items;
+    int count;
+    int capacity;
+    int heap_size;               // items[0, heap_size) is the unranked heap
+} ResultSet;
+
+int result_set_init(ResultSet *set, const char *query);
+const char *result_set_intern(ResultSet *set, const char *str);
+int result_set_add(ResultSet *set, const Package *package);
+const Package *result_set_find(const ResultSet *set, const char *name);
+const Package *result_set_get(ResultSet *set, int rank);
+void result_set_free(ResultSet *set);
+
+#endif
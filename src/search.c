@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <json-c/json.h>
+
+#include "config.h"
+#include "http.h"
+#include "index.h"
+#include "jsonstream.h"
+#include "search.h"
+
+#define MAX_BUFFER 8192
+#define AUR_SEARCH_PATH "/rpc/?v=5&type=search&arg="
+#define ARCH_SEARCH_PATH "/packages/search/json/?q="
+
+typedef int (*PackageConverter)(struct json_object *package_obj, ResultSet *set);
+
+// Parse state of one queued search. Records are added to the shared
+// result set as soon as they arrive.
+typedef struct {
+    ResultSet *set;
+    int count;
+    int limit;
+    PackageConverter convert;
+    JsonStream stream;
+    int *complete;           // optional: set when the full hit list arrived
+} SearchTarget;
+
+// The hits for one word of a multi-word query, from one backend
+typedef struct {
+    char term[SEARCH_MAX_TERM];
+    ResultSet set;
+    int complete;
+} TermSearch;
+
+static const char *json_string_field(struct json_object *obj, const char *key, const char *fallback) {
+    struct json_object *field = NULL;
+    if (!json_object_object_get_ex(obj, key, &field) || field == NULL) return fallback;
+    return json_object_get_string(field);
+}
+
+// The strings only need to outlive result_set_add, which interns them
+static int convert_aur_package(struct json_object *package_obj, ResultSet *set) {
+    struct json_object *votes_obj = NULL;
+    struct json_object *popularity_obj = NULL;
+    Package package;
+
+    json_object_object_get_ex(package_obj, "NumVotes", &votes_obj);
+    json_object_object_get_ex(package_obj, "Popularity", &popularity_obj);
+
+    package.name = json_string_field(package_obj, "Name", "");
+    package.version = json_string_field(package_obj, "Version", "");
+    package.description = json_string_field(package_obj, "Description", "");
+    package.maintainer = json_string_field(package_obj, "Maintainer", "None");
+    package.url = json_string_field(package_obj, "URL", "");
+    package.repo = "aur";
+    package.votes = votes_obj ? json_object_get_int(votes_obj) : 0;
+    package.popularity = popularity_obj ? json_object_get_double(popularity_obj) : 0;
+
+    return result_set_add(set, &package);
+}
+
+static int convert_arch_package(struct json_object *package_obj, ResultSet *set) {
+    Package package;
+
+    package.name = json_string_field(package_obj, "pkgname", "");
+    package.version = json_string_field(package_obj, "pkgver", "");
+    package.description = json_string_field(package_obj, "pkgdesc", "");
+    package.maintainer = "Arch Linux";
+    package.url = json_string_field(package_obj, "url", "");
+    package.repo = json_string_field(package_obj, "repo", "unknown");
+    package.votes = 0; // Official repos don't have votes
+    package.popularity = 0;
+
+    return result_set_add(set, &package);
+}
+
+// One element of the "results" array. Ranking needs every hit, so the
+// limit is only a guard against runaway responses.
+static int search_element(struct json_object *package_obj, void *userdata) {
+    SearchTarget *target = (SearchTarget *)userdata;
+
+    if (target->convert(package_obj, target->set) != 0) return 1;
+    target->count++;
+
+    return target->count >= target->limit;
+}
+
+static int search_chunk(const char *data, size_t size, void *userdata) {
+    SearchTarget *target = (SearchTarget *)userdata;
+    return json_stream_feed(&target->stream, data, size) != 0 || target->stream.done;
+}
+
+static void search_done(HttpRequest *request, void *userdata) {
+    SearchTarget *target = (SearchTarget *)userdata;
+
+    if (!http_request_ok(request)) {
+        if (request->result == CURLE_OK) {
+            fprintf(stderr, "Error: %s returned HTTP %ld\n", request->url, request->status);
+        }
+    } else if (target->stream.failed) {
+        fprintf(stderr, "Error: Failed to parse JSON response\n");
+    } else if (!target->stream.array_found) {
+        fprintf(stderr, "Error: No results found in JSON response\n");
+    } else if (target->stream.error_found) {
+        // Typically "Too many package results"; a multi-word search
+        // falls back to matching this word locally
+        if (!target->complete) fprintf(stderr, "Error: %s returned an error instead of results\n", request->url);
+    } else if (target->count >= target->limit) {
+        fprintf(stderr, "Warning: Only the first %d results from %s were used\n", target->limit, request->url);
+    } else if (target->complete) {
+        *target->complete = 1;
+    }
+
+    json_stream_free(&target->stream);
+    free(target);
+}
+
+// Queue a search on the engine; hits are added to set when the engine
+// runs and the transfer completes.
+static void queue_search(HttpEngine *engine, const char *base_url, const char *path, const char *query,
+                         PackageConverter convert, ResultSet *set, int *complete) {
+    char url[MAX_BUFFER];
+
+    SearchTarget *target = calloc(1, sizeof(SearchTarget));
+    char *escaped = http_escape(query);
+    if (!target || !escaped) {
+        fprintf(stderr, "Error: Failed to allocate memory\n");
+        free(target);
+        curl_free(escaped);
+        return;
+    }
+
+    target->set = set;
+    target->limit = MAX_SEARCH_RESULTS;
+    target->convert = convert;
+    target->complete = complete;
+    if (json_stream_init(&target->stream, "results", search_element, target) != 0) {
+        free(target);
+        curl_free(escaped);
+        return;
+    }
+
+    snprintf(url, MAX_BUFFER, "%s%s%s", base_url, path, escaped);
+    curl_free(escaped);
+
+    HttpRequest *request = http_engine_add_cached(engine, url, search_done, target);
+    if (request == NULL) {
+        json_stream_free(&target->stream);
+        free(target);
+        return;
+    }
+    http_request_stream(request, search_chunk, target);
+}
+
+void search_aur(HttpEngine *engine, const char *query, ResultSet *set) {
+    queue_search(engine, config.aur_url, AUR_SEARCH_PATH, query, convert_aur_package, set, NULL);
+}
+
+// Search Arch repos
+void search_arch_repos(HttpEngine *engine, const char *query, ResultSet *set) {
+    queue_search(engine, config.arch_url, ARCH_SEARCH_PATH, query, convert_arch_package, set, NULL);
+}
+
+// Query the local AUR index built by --sync-index. No network and no cap
+// on the number of results; the index strings are interned as they are
+// added.
+static void search_index(const PackageIndex *index, const char *query, ResultSet *set) {
+    uint32_t *ids = NULL;
+    int num_results = 0;
+
+    if (index_search(index, query, &ids, &num_results) != 0) {
+        fprintf(stderr, "Error: Failed to search package index\n");
+        return;
+    }
+
+    for (int i = 0; i < num_results; i++) {
+        const IndexPackage *entry = &index->packages[ids[i]];
+        const char *maintainer = index_string(index, entry->maintainer);
+        Package package;
+
+        package.name = index_string(index, entry->name);
+        package.version = index_string(index, entry->version);
+        package.description = index_string(index, entry->description);
+        package.maintainer = *maintainer ? maintainer : "None";
+        package.url = index_string(index, entry->url);
+        package.repo = "aur";
+        package.votes = (int)entry->votes;
+        package.popularity = entry->popularity / 1000.0;
+
+        if (result_set_add(set, &package) != 0) break;
+    }
+
+    free(ids);
+}
+
+static int split_terms(const char *query, char terms[][SEARCH_MAX_TERM]) {
+    int count = 0;
+
+    for (const char *cursor = query; *cursor && count < SEARCH_MAX_TERMS;) {
+        size_t skip = strspn(cursor, " \t");
+        size_t length = strcspn(cursor + skip, " \t");
+        if (length == 0) break;
+
+        snprintf(terms[count++], SEARCH_MAX_TERM, "%.*s", (int)length, cursor + skip);
+        cursor += skip + length;
+    }
+    return count;
+}
+
+static int matches_term(const Package *package, const char *term) {
+    return strcasestr(package->name, term) != NULL || strcasestr(package->description, term) != NULL;
+}
+
+// Keep the hits that every word found: walk the smallest complete hit
+// list and probe the others by name. A word whose search came back
+// incomplete (too many results, an error) is matched against the name
+// and description instead. If no word came back complete, the largest
+// partial list is walked.
+static void intersect_terms(TermSearch *searches, int count, const char *backend, ResultSet *set) {
+    int driver = -1;
+
+    for (int t = 0; t < count; t++) {
+        if (searches[t].complete && (driver < 0 || searches[t].set.count < searches[driver].set.count)) {
+            driver = t;
+        }
+    }
+    if (driver < 0) {
+        for (int t = 0; t < count; t++) {
+            if (driver < 0 || searches[t].set.count > searches[driver].set.count) driver = t;
+        }
+        // The per-word errors are not shown for a multi-word query
+        if (searches[driver].set.count == 0) {
+            fprintf(stderr, "Warning: Every word matched too many %s packages, refine the query\n", backend);
+            return;
+        }
+    }
+
+    for (int i = 0; i < searches[driver].set.count; i++) {
+        const Package *package = &searches[driver].set.items[i];
+        int keep = 1;
+
+        for (int t = 0; t < count && keep; t++) {
+            if (t == driver) continue;
+            keep = searches[t].complete ? result_set_find(&searches[t].set, package->name) != NULL
+                                        : matches_term(package, searches[t].term);
+        }
+        if (keep && result_set_add(set, package) != 0) return;
+    }
+}
+
+static void free_term_searches(TermSearch *searches, int count) {
+    if (searches == NULL) return;
+
+    for (int t = 0; t < count; t++) {
+        result_set_free(&searches[t].set);
+    }
+    free(searches);
+}
+
+// One request per word and backend, all in flight at once
+static TermSearch *queue_term_searches(HttpEngine *engine, char terms[][SEARCH_MAX_TERM], int count,
+                                       const char *base_url, const char *path, PackageConverter convert) {
+    TermSearch *searches = calloc(count, sizeof(TermSearch));
+    if (searches == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory\n");
+        return NULL;
+    }
+
+    for (int t = 0; t < count; t++) {
+        snprintf(searches[t].term, sizeof(searches[t].term), "%s", terms[t]);
+        if (result_set_init(&searches[t].set, terms[t]) != 0) {
+            free_term_searches(searches, t);
+            return NULL;
+        }
+    }
+    for (int t = 0; t < count; t++) {
+        queue_search(engine, base_url, path, terms[t], convert, &searches[t].set, &searches[t].complete);
+    }
+    return searches;
+}
+
+// Collect the hits of both backends into set, deduplicated by name.
+// Each word of a multi-word query is searched separately, and only
+// packages that match every word are kept. Returns non-zero if the set
+// could not be created.
+int search_packages(const char *query, ResultSet *set) {
+    HttpEngine engine;
+    PackageIndex index;
+    char terms[SEARCH_MAX_TERMS][SEARCH_MAX_TERM];
+    TermSearch *arch = NULL, *aur = NULL;
+    int have_index;
+
+    if (result_set_init(set, query) != 0) {
+        return 1;
+    }
+
+    if (http_engine_init(&engine) != 0) {
+        return 0;
+    }
+
+    // Both backends are in flight at once; each is parsed as soon as its
+    // own transfer completes. With a local index the AUR side needs no
+    // request at all, and the index intersects words by itself.
+    int term_count = split_terms(query, terms);
+    have_index = index_open(&index) == 0;
+
+    if (term_count > 1) {
+        arch = queue_term_searches(&engine, terms, term_count, config.arch_url, ARCH_SEARCH_PATH,
+                                   convert_arch_package);
+    } else {
+        search_arch_repos(&engine, query, set);
+    }
+
+    if (have_index) {
+        search_index(&index, query, set);
+        index_close(&index);
+    } else if (term_count > 1) {
+        aur = queue_term_searches(&engine, terms, term_count, config.aur_url, AUR_SEARCH_PATH,
+                                  convert_aur_package);
+    } else {
+        search_aur(&engine, query, set);
+    }
+
+    http_engine_run(&engine);
+    http_engine_cleanup(&engine);
+
+    if (arch) intersect_terms(arch, term_count, "official", set);
+    if (aur) intersect_terms(aur, term_count, "AUR", set);
+    free_term_searches(arch, term_count);
+    free_term_searches(aur, term_count);
+
+    return 0;
+}
+
+// Print ranks [first, first + page_size); only the hits shown are ranked.
+// Returns the number of rows printed.
+int display_search_results(ResultSet *set, int first, int page_size) {
+    int shown = 0;
+
+    if (set == NULL || set->count <= 0) {
+        printf("No results to display.\n");
+        return 0;
+    }
+    
+    printf("\n");
+    printf("%-3s %-20s %-12s %-8s %-8s %-15s %s\n", "ID", "Name", "Version", "Repo", "Votes", "Maintainer", "Description");
+    printf("---------------------------------------------------------------------------------------------------------------\n");
+    
+    for (int rank = first; rank < first + page_size; rank++) {
+        const Package *package = result_set_get(set, rank);
+        if (package == NULL) break;
+
+        printf("%-3d %-20s %-12s %-8s %-8d %-15.15s %.50s\n", 
+               rank + 1, 
+               package->name, 
+               package->version,
+               package->repo,
+               package->votes,
+               package->maintainer, 
+               package->description);
+        shown++;
+    }
+    printf("\n");
+
+    return shown;
+}
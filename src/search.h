@@ -0,0 +1,17 @@
+#ifndef METHAUR_SEARCH_H
+#define METHAUR_SEARCH_H
+
+#include "http.h"
+#include "results.h"
+
+#define MAX_SEARCH_RESULTS 20000
+#define SEARCH_PAGE_SIZE 20
+#define SEARCH_MAX_TERMS 8
+#define SEARCH_MAX_TERM 128
+
+void search_aur(HttpEngine *engine, const char *query, ResultSet *set);
+void search_arch_repos(HttpEngine *engine, const char *query, ResultSet *set);
+int search_packages(const char *query, ResultSet *set);
+int display_search_results(ResultSet *set, int first, int page_size);
+
+#endif
@@ -0,0 +1,260 @@
+#include <archive.h>
+#include <archive_entry.h>
+#include <curl/curl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "download.h"
+#include "http.h"
+#include "snapshot.h"
+#include "trace.h"
+
+// A download that libarchive pulls from: every read callback drives the
+// transfer until curl has delivered at least one more chunk. A transfer
+// that breaks off is picked up again where it stopped, if the server sent
+// a validator; what was extracted cannot be taken back otherwise.
+typedef struct {
+    CURLM *multi;
+    CURL *handle;
+    struct curl_slist *headers;
+    const char *url;
+    int trace_lane;
+    char *buffer;
+    size_t size;
+    size_t capacity;
+    curl_off_t offset;       // bytes of the tarball received so far
+    curl_off_t resumed_at;   // offset the current attempt started from
+    int attempt;
+    int started;
+    char validator[DOWNLOAD_VALIDATOR_MAX];
+    int done;
+    CURLcode result;
+} SnapshotStream;
+
+static size_t stream_write(void *contents, size_t size, size_t nmemb, void *userp) {
+    SnapshotStream *stream = userp;
+    size_t real_size = size * nmemb;
+
+    if (!stream->started) {
+        long status = 0;
+        stream->started = 1;
+        curl_easy_getinfo(stream->handle, CURLINFO_RESPONSE_CODE, &status);
+
+        // If-Range got the whole tarball back: it has changed since
+        if (stream->offset > 0 && status != 206) {
+            fprintf(stderr, "Error: %s changed while it was downloaded\n", stream->url);
+            return 0;
+        }
+    }
+
+    if (stream->size + real_size > stream->capacity) {
+        size_t capacity = stream->capacity ? stream->capacity : SNAPSHOT_BUFFER_SIZE;
+        while (capacity < stream->size + real_size) capacity *= 2;
+
+        char *grown = realloc(stream->buffer, capacity);
+        if (!grown) return 0;
+        stream->buffer = grown;
+        stream->capacity = capacity;
+    }
+
+    memcpy(stream->buffer + stream->size, contents, real_size);
+    stream->size += real_size;
+    stream->offset += (curl_off_t)real_size;
+    return real_size;
+}
+
+static int stream_start(SnapshotStream *stream) {
+    stream->handle = curl_easy_init();
+    if (!stream->handle) return 1;
+
+    stream->started = 0;
+    stream->resumed_at = stream->offset;
+    curl_easy_setopt(stream->handle, CURLOPT_URL, stream->url);
+    curl_easy_setopt(stream->handle, CURLOPT_WRITEFUNCTION, stream_write);
+    curl_easy_setopt(stream->handle, CURLOPT_WRITEDATA, (void *)stream);
+    curl_easy_setopt(stream->handle, CURLOPT_HEADERFUNCTION, download_header_callback);
+    curl_easy_setopt(stream->handle, CURLOPT_HEADERDATA, (void *)stream->validator);
+    http_configure(stream->handle);
+    // The tarball is compressed already, and offsets count wire bytes
+    curl_easy_setopt(stream->handle, CURLOPT_ACCEPT_ENCODING, NULL);
+    curl_easy_setopt(stream->handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(stream->handle, CURLOPT_FAILONERROR, 1L);
+
+    if (stream->offset > 0) {
+        stream->headers = download_set_range(stream->handle, stream->offset, stream->validator);
+    }
+
+    return curl_multi_add_handle(stream->multi, stream->handle) != CURLM_OK;
+}
+
+static void stream_stop(SnapshotStream *stream) {
+    if (stream->multi && stream->handle) curl_multi_remove_handle(stream->multi, stream->handle);
+    if (stream->handle) curl_easy_cleanup(stream->handle);
+    curl_slist_free_all(stream->headers);
+    stream->handle = NULL;
+    stream->headers = NULL;
+}
+
+// Start the transfer over from the current offset after a retryable
+// failure. Attempts that got further reset the count.
+static int stream_retry(SnapshotStream *stream, CURLcode result) {
+    long status = 0;
+
+    curl_easy_getinfo(stream->handle, CURLINFO_RESPONSE_CODE, &status);
+    if (!download_retryable(result, status)) return 1;
+    // Without a validator the rest of a changed tarball would be spliced
+    // onto the part of the old one that is already extracted
+    if (stream->offset > 0 && stream->validator[0] == '\0') {
+        fprintf(stderr, "Error: Download of %s interrupted (%s) and it cannot be resumed\n",
+                stream->url, curl_easy_strerror(result));
+        return 1;
+    }
+    if (stream->offset > stream->resumed_at && stream->validator[0] != '\0') stream->attempt = 0;
+    if (++stream->attempt >= DOWNLOAD_RETRIES) return 1;
+
+    fprintf(stderr, "Warning: Download of %s interrupted (%s), retrying\n", stream->url, curl_easy_strerror(result));
+    stream_stop(stream);
+    download_backoff(stream->attempt - 1);
+    return stream_start(stream);
+}
+
+static ssize_t stream_read(struct archive *archive, void *client_data, const void **buffer) {
+    SnapshotStream *stream = client_data;
+    int running = 1;
+
+    // libarchive is done with the previous block once it asks again
+    stream->size = 0;
+
+    while (stream->size == 0 && !stream->done) {
+        if (curl_multi_perform(stream->multi, &running) != CURLM_OK) {
+            stream->done = 1;
+            stream->result = CURLE_FAILED_INIT;
+            break;
+        }
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(stream->multi, &queued)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) continue;
+
+            CURLcode result = msg->data.result;
+            trace_transfer(stream->handle, stream->trace_lane, stream->url);
+            if (result != CURLE_OK && stream_retry(stream, result) == 0) {
+                running = 1;
+                break;
+            }
+            stream->done = 1;
+            stream->result = result;
+        }
+
+        if (stream->size == 0 && !stream->done && running) {
+            curl_multi_poll(stream->multi, NULL, 0, 1000, NULL);
+        }
+    }
+
+    (void)archive;
+    if (stream->size == 0 && stream->result != CURLE_OK) {
+        return ARCHIVE_FATAL;
+    }
+
+    *buffer = stream->buffer;
+    return (ssize_t)stream->size;
+}
+
+static int stream_open(SnapshotStream *stream, const char *url) {
+    stream->multi = curl_multi_init();
+    if (!stream->multi) return 1;
+
+    stream->url = url;
+    stream->trace_lane = trace_http_lane(url);
+    return stream_start(stream);
+}
+
+static void stream_close(SnapshotStream *stream) {
+    stream_stop(stream);
+    if (stream->multi) curl_multi_cleanup(stream->multi);
+    free(stream->buffer);
+}
+
+// Rebase a relative archive path onto dest_dir. Absolute paths and ".."
+// components are refused so an entry cannot escape dest_dir.
+static int rebase_path(char *path, size_t size, const char *dest_dir, const char *name) {
+    if (name[0] == '/') return 1;
+
+    for (const char *p = name; (p = strstr(p, "..")) != NULL; p += 2) {
+        if ((p == name || p[-1] == '/') && (p[2] == '\0' || p[2] == '/')) return 1;
+    }
+
+    return snprintf(path, size, "%s/%s", dest_dir, name) >= (int)size;
+}
+
+// Download a .tar.gz and unpack it under dest_dir while it arrives; no
+// temporary tarball is written.
+int snapshot_extract(const char *url, const char *dest_dir) {
+    SnapshotStream stream;
+    struct archive *reader = archive_read_new();
+    struct archive *writer = archive_write_disk_new();
+    struct archive_entry *entry;
+    char path[PATH_MAX];
+    int failed = 0;
+    int status = ARCHIVE_FATAL;
+    double start = trace_now();
+
+    memset(&stream, 0, sizeof(SnapshotStream));
+    if (!reader || !writer || stream_open(&stream, url) != 0) {
+        fprintf(stderr, "Error: Failed to initialize download of %s\n", url);
+        if (reader) archive_read_free(reader);
+        if (writer) archive_write_free(writer);
+        stream_close(&stream);
+        return 1;
+    }
+
+    archive_read_support_filter_all(reader);
+    archive_read_support_format_tar(reader);
+    archive_write_disk_set_options(writer,
+        ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_PERM |
+        ARCHIVE_EXTRACT_SECURE_NODOTDOT | ARCHIVE_EXTRACT_SECURE_SYMLINKS);
+
+    if (archive_read_open(reader, &stream, NULL, stream_read, NULL) != ARCHIVE_OK) {
+        failed = 1;
+    }
+
+    while (!failed && (status = archive_read_next_header(reader, &entry)) == ARCHIVE_OK) {
+        const char *hardlink = archive_entry_hardlink(entry);
+
+        if (rebase_path(path, sizeof(path), dest_dir, archive_entry_pathname(entry)) != 0) {
+            fprintf(stderr, "Error: Refusing to extract %s\n", archive_entry_pathname(entry));
+            failed = 1;
+            break;
+        }
+        archive_entry_set_pathname(entry, path);
+
+        if (hardlink) {
+            if (rebase_path(path, sizeof(path), dest_dir, hardlink) != 0) {
+                failed = 1;
+                break;
+            }
+            archive_entry_set_hardlink(entry, path);
+        }
+
+        if (archive_read_extract2(reader, entry, writer) < ARCHIVE_WARN) {
+            failed = 1;
+        }
+    }
+
+    if (!failed && status != ARCHIVE_EOF) failed = 1;
+
+    if (failed && stream.result != CURLE_OK) {
+        fprintf(stderr, "Error: Failed to download %s: %s\n", url, curl_easy_strerror(stream.result));
+    } else if (failed && archive_error_string(reader) != NULL) {
+        fprintf(stderr, "Error: Failed to extract %s: %s\n", url, archive_error_string(reader));
+    }
+
+    archive_read_free(reader);
+    archive_write_free(writer);
+    stream_close(&stream);
+    trace_end("fetch", "snapshot", url, start);
+    return failed;
+}
@@ -0,0 +1,8 @@
+#ifndef METHAUR_SNAPSHOT_H
+#define METHAUR_SNAPSHOT_H
+
+#define SNAPSHOT_BUFFER_SIZE (64 * 1024)
+
+int snapshot_extract(const char *url, const char *dest_dir);
+
+#endif
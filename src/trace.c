@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+typedef struct {
+    const char *category;
+    char *name;
+    char *detail;
+    int lane;
+    double start;
+    double duration;
+    double cpu;                  // user + system time, < 0 when not measured
+} TraceEvent;
+
+typedef struct {
+    int lane;
+    char *name;
+} TraceLane;
+
+// A child process between spawn and reap
+typedef struct {
+    pid_t pid;
+    double start;
+    char *name;
+    char *detail;
+} TraceProcess;
+
+typedef struct {
+    const char *category;
+    const char *name;
+    int count;
+    double total;
+    double max;
+    double cpu;
+} TraceSummaryRow;
+
+static struct {
+    int enabled;
+    FILE *out;
+    struct timespec origin;
+    TraceEvent *events;
+    int event_count;
+    int event_capacity;
+    TraceLane *lanes;
+    int lane_count;
+    int lane_capacity;
+    TraceProcess *processes;
+    int process_count;
+    int process_capacity;
+    int next_http_lane;
+} trace;
+
+static int grow(void **array, int *capacity, int count, size_t size) {
+    if (count < *capacity) return 0;
+
+    int grown_capacity = *capacity ? *capacity * 2 : 64;
+    void *grown = realloc(*array, grown_capacity * size);
+    if (!grown) return 1;
+
+    *array = grown;
+    *capacity = grown_capacity;
+    return 0;
+}
+
+static void record(const char *category, const char *name, const char *detail, int lane,
+                   double start, double duration, double cpu) {
+    if (grow((void **)&trace.events, &trace.event_capacity, trace.event_count, sizeof(TraceEvent)) != 0) return;
+
+    TraceEvent *event = &trace.events[trace.event_count];
+    event->category = category;
+    event->name = strdup(name);
+    event->detail = detail ? strndup(detail, TRACE_MAX_DETAIL) : NULL;
+    event->lane = lane;
+    event->start = start;
+    event->duration = duration > 0 ? duration : 0;
+    event->cpu = cpu;
+    if (event->name) trace.event_count++;
+}
+
+static void name_lane(int lane, const char *name) {
+    if (grow((void **)&trace.lanes, &trace.lane_capacity, trace.lane_count, sizeof(TraceLane)) != 0) return;
+
+    trace.lanes[trace.lane_count].lane = lane;
+    trace.lanes[trace.lane_count].name = strndup(name, TRACE_MAX_DETAIL);
+    if (trace.lanes[trace.lane_count].name) trace.lane_count++;
+}
+
+// Start recording. With a path the events are written there as a Chrome
+// trace (chrome://tracing, Perfetto) by trace_close().
+int trace_open(const char *path) {
+    if (path) {
+        trace.out = fopen(path, "w");
+        if (trace.out == NULL) {
+            fprintf(stderr, "Error: Failed to open trace file %s\n", path);
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &trace.origin);
+    trace.enabled = 1;
+    name_lane(TRACE_MAIN_LANE, "methaur");
+    return 0;
+}
+
+int trace_enabled(void) {
+    return trace.enabled;
+}
+
+double trace_now(void) {
+    struct timespec now;
+
+    if (!trace.enabled) return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - trace.origin.tv_sec) * 1e6 + (now.tv_nsec - trace.origin.tv_nsec) / 1e3;
+}
+
+void trace_event(const char *category, const char *name, const char *detail, int lane, double start, double duration) {
+    if (!trace.enabled) return;
+    record(category, name, detail, lane, start, duration, -1);
+}
+
+// Close a span on the main lane that began at start
+void trace_end(const char *category, const char *name, const char *detail, double start) {
+    if (!trace.enabled) return;
+    record(category, name, detail, TRACE_MAIN_LANE, start, trace_now() - start, -1);
+}
+
+// Every transfer gets a lane of its own, since concurrent transfers
+// overlap without nesting
+int trace_http_lane(const char *url) {
+    char host[TRACE_MAX_DETAIL];
+
+    if (!trace.enabled) return TRACE_MAIN_LANE;
+
+    const char *start = strstr(url, "://");
+    start = start ? start + 3 : url;
+    snprintf(host, sizeof(host), "http %.*s", (int)strcspn(start, "/?"), start);
+
+    int lane = TRACE_HTTP_LANE_BASE + trace.next_http_lane++;
+    name_lane(lane, host);
+    return lane;
+}
+
+static void transfer_phase(const char *name, const char *url, int lane, double origin, curl_off_t from, curl_off_t to) {
+    if (to > from) record("http", name, url, lane, origin + from, to - from, -1);
+}
+
+// Record a finished transfer and curl's breakdown of it. The
+// CURLINFO_*_TIME_T values are offsets from the start of the transfer.
+void trace_transfer(CURL *handle, int lane, const char *url) {
+    curl_off_t dns = 0, connect = 0, tls = 0, first_byte = 0, total = 0;
+
+    if (!trace.enabled) return;
+
+    curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+    curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &total);
+
+    double origin = trace_now() - total;
+    record("http", "GET", url, lane, origin, total, -1);
+
+    // A reused connection reports zero for the phases it skipped
+    transfer_phase("dns", url, lane, origin, 0, dns);
+    transfer_phase("connect", url, lane, origin, dns, connect);
+    transfer_phase("tls", url, lane, origin, connect, tls);
+    if (first_byte > 0) {
+        transfer_phase("wait", url, lane, origin, tls > connect ? tls : connect, first_byte);
+        transfer_phase("download", url, lane, origin, first_byte, total);
+    }
+}
+
+static TraceProcess *find_process(pid_t pid) {
+    for (int i = 0; i < trace.process_count; i++) {
+        if (trace.processes[i].pid == pid) return &trace.processes[i];
+    }
+    return NULL;
+}
+
+// Name a running child; the span is recorded when it is reaped
+void trace_process_label(pid_t pid, const char *name, const char *detail) {
+    if (!trace.enabled || pid <= 0) return;
+
+    TraceProcess *process = find_process(pid);
+    if (process == NULL) {
+        if (grow((void **)&trace.processes, &trace.process_capacity, trace.process_count, sizeof(TraceProcess)) != 0) {
+            return;
+        }
+        process = &trace.processes[trace.process_count++];
+        process->pid = pid;
+        process->start = trace_now();
+    } else {
+        free(process->name);
+        free(process->detail);
+    }
+
+    process->name = strdup(name);
+    process->detail = detail ? strndup(detail, TRACE_MAX_DETAIL) : NULL;
+}
+
+// Commands are grouped by program; for wrappers like sudo and git the
+// first word after the options is part of the name ("sudo pacman")
+void trace_process_start(pid_t pid, char *const argv[], const char *dir) {
+    char name[64];
+    char detail[TRACE_MAX_DETAIL];
+    size_t used = 0;
+
+    if (!trace.enabled || pid <= 0) return;
+
+    const char *program = strrchr(argv[0], '/');
+    program = program ? program + 1 : argv[0];
+    snprintf(name, sizeof(name), "%s", program);
+
+    if (strcmp(program, "sudo") == 0 || strcmp(program, "git") == 0) {
+        for (int i = 1; argv[i]; i++) {
+            if (argv[i][0] == '-') continue;
+            snprintf(name, sizeof(name), "%s %s", program, argv[i]);
+            break;
+        }
+    }
+
+    detail[0] = '\0';
+    for (int i = 0; argv[i] && used + 1 < sizeof(detail); i++) {
+        used += snprintf(detail + used, sizeof(detail) - used, "%s%s", i ? " " : "", argv[i]);
+    }
+    if (dir && used + 1 < sizeof(detail)) {
+        snprintf(detail + used, sizeof(detail) - used, " (in %s)", dir);
+    }
+
+    trace_process_label(pid, name, detail);
+}
+
+// Record a reaped child with its wall time and, from wait4(), its CPU time
+void trace_process_end(pid_t pid, const struct rusage *usage) {
+    if (!trace.enabled) return;
+
+    TraceProcess *process = find_process(pid);
+    if (process == NULL) return;
+
+    double cpu = -1;
+    if (usage) {
+        cpu = (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1e6 +
+              usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+    }
+
+    if (process->name) {
+        record("process", process->name, process->detail, pid, process->start, trace_now() - process->start, cpu);
+        name_lane(pid, process->name);
+    }
+
+    free(process->name);
+    free(process->detail);
+    *process = trace.processes[--trace.process_count];
+}
+
+static void write_json_string(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+// Chrome trace event format: one complete ("X") event per span plus
+// metadata events naming the process and its lanes
+static void write_trace(FILE *fp) {
+    int pid = (int)getpid();
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"methaur\"}}", pid);
+
+    for (int i = 0; i < trace.lane_count; i++) {
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, trace.lanes[i].lane);
+        write_json_string(fp, trace.lanes[i].name);
+        fprintf(fp, "}}");
+    }
+
+    for (int i = 0; i < trace.event_count; i++) {
+        const TraceEvent *event = &trace.events[i];
+
+        fprintf(fp, ",\n{\"name\":");
+        write_json_string(fp, event->name);
+        fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{",
+                event->category, event->start, event->duration, pid, event->lane);
+        if (event->detail) {
+            fprintf(fp, "\"detail\":");
+            write_json_string(fp, event->detail);
+        }
+        if (event->cpu >= 0) {
+            fprintf(fp, "%s\"cpu_ms\":%.3f", event->detail ? "," : "", event->cpu / 1e3);
+        }
+        fprintf(fp, "}}");
+    }
+
+    fprintf(fp, "\n]}\n");
+}
+
+static int compare_rows(const void *a, const void *b) {
+    double x = ((const TraceSummaryRow *)a)->total, y = ((const TraceSummaryRow *)b)->total;
+    return (x < y) - (x > y);
+}
+
+// Totals per kind of span. Parallel work overlaps, so a row can exceed
+// the wall time.
+static void print_summary(void) {
+    TraceSummaryRow *rows = calloc(trace.event_count > 0 ? trace.event_count : 1, sizeof(TraceSummaryRow));
+    int row_count = 0;
+
+    if (rows == NULL) return;
+
+    for (int i = 0; i < trace.event_count; i++) {
+        const TraceEvent *event = &trace.events[i];
+        TraceSummaryRow *row = NULL;
+
+        for (int j = 0; j < row_count && row == NULL; j++) {
+            if (strcmp(rows[j].category, event->category) == 0 && strcmp(rows[j].name, event->name) == 0) {
+                row = &rows[j];
+            }
+        }
+        if (row == NULL) {
+            row = &rows[row_count++];
+            row->category = event->category;
+            row->name = event->name;
+            row->cpu = -1;
+        }
+
+        row->count++;
+        row->total += event->duration;
+        if (event->duration > row->max) row->max = event->duration;
+        if (event->cpu >= 0) row->cpu = (row->cpu < 0 ? 0 : row->cpu) + event->cpu;
+    }
+
+    qsort(rows, row_count, sizeof(TraceSummaryRow), compare_rows);
+
+    fprintf(stderr, "\n%-32s %6s %11s %11s %11s %11s\n", "Phase", "count", "total ms", "mean ms", "max ms", "cpu ms");
+    for (int i = 0; i < row_count; i++) {
+        char label[64];
+        char cpu[32] = "-";
+
+        snprintf(label, sizeof(label), "%s %s", rows[i].category, rows[i].name);
+        if (rows[i].cpu >= 0) snprintf(cpu, sizeof(cpu), "%.1f", rows[i].cpu / 1e3);
+
+        fprintf(stderr, "%-32.32s %6d %11.1f %11.1f %11.1f %11s\n", label, rows[i].count,
+                rows[i].total / 1e3, rows[i].total / 1e3 / rows[i].count, rows[i].max / 1e3, cpu);
+    }
+    fprintf(stderr, "Wall time: %.1f ms\n", trace_now() / 1e3);
+
+    free(rows);
+}
+
+// Print the summary, write the trace file if one was requested, and stop
+// recording
+void trace_close(void) {
+    if (!trace.enabled) return;
+
+    print_summary();
+
+    if (trace.out) {
+        write_trace(trace.out);
+        if (fclose(trace.out) != 0) fprintf(stderr, "Error: Failed to write trace file\n");
+        trace.out = NULL;
+    }
+
+    for (int i = 0; i < trace.event_count; i++) {
+        free(trace.events[i].name);
+        free(trace.events[i].detail);
+    }
+    for (int i = 0; i < trace.lane_count; i++) free(trace.lanes[i].name);
+    for (int i = 0; i < trace.process_count; i++) {
+        free(trace.processes[i].name);
+        free(trace.processes[i].detail);
+    }
+    free(trace.events);
+    free(trace.lanes);
+    free(trace.processes);
+    memset(&trace, 0, sizeof(trace));
+}
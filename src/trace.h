@@ -0,0 +1,26 @@
+#ifndef METHAUR_TRACE_H
+#define METHAUR_TRACE_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <curl/curl.h>
+
+#define TRACE_MAIN_LANE 0
+#define TRACE_HTTP_LANE_BASE (1 << 24)   // above any pid
+#define TRACE_MAX_DETAIL 256
+
+// Spans are recorded only after trace_open(); until then every call is a
+// cheap no-op. Times are microseconds since trace_open().
+int trace_open(const char *path);
+int trace_enabled(void);
+double trace_now(void);
+void trace_event(const char *category, const char *name, const char *detail, int lane, double start, double duration);
+void trace_end(const char *category, const char *name, const char *detail, double start);
+int trace_http_lane(const char *url);
+void trace_transfer(CURL *handle, int lane, const char *url);
+void trace_process_start(pid_t pid, char *const argv[], const char *dir);
+void trace_process_label(pid_t pid, const char *name, const char *detail);
+void trace_process_end(pid_t pid, const struct rusage *usage);
+void trace_close(void);
+
+#endif
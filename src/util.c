@@ -0,0 +1,218 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "trace.h"
+#include "util.h"
+
+// Create path and any missing parents, like mkdir -p
+int mkdir_p(const char *path, mode_t mode) {
+    char buffer[PATH_MAX];
+
+    if (snprintf(buffer, sizeof(buffer), "%s", path) >= (int)sizeof(buffer)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    for (char *p = buffer + 1; *p; p++) {
+        if (*p != '/') continue;
+
+        *p = '\0';
+        if (mkdir(buffer, mode) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+
+    if (mkdir(buffer, mode) != 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+// Whether program is an executable somewhere in PATH, like `which`
+int find_program(const char *program) {
+    const char *path = getenv("PATH");
+    char candidate[PATH_MAX];
+
+    if (path == NULL || *path == '\0') path = "/usr/local/bin:/usr/bin:/bin";
+
+    while (*path) {
+        size_t length = strcspn(path, ":");
+        const char *dir = length ? path : ".";
+        int dir_length = length ? (int)length : 1;
+
+        if (snprintf(candidate, sizeof(candidate), "%.*s/%s", dir_length, dir, program) < (int)sizeof(candidate) &&
+            access(candidate, X_OK) == 0) {
+            return 1;
+        }
+
+        path += length;
+        if (*path == ':') path++;
+    }
+
+    return 0;
+}
+
+int require_sudo(void) {
+    if (!find_program("sudo")) {
+        fprintf(stderr, "Error: sudo is required but not found\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Start argv[0] (looked up in PATH) in dir without going through a shell.
+// With a log_path, stdout and stderr go to that file instead of the
+// terminal. Returns the child's pid, or -1 if it could not be started.
+pid_t spawn_command(char *const argv[], const char *dir, const char *log_path) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        if (pid < 0) fprintf(stderr, "Error: Failed to start %s: %s\n", argv[0], strerror(errno));
+        trace_process_start(pid, argv, dir);
+        return pid;
+    }
+
+    if (dir && chdir(dir) != 0) {
+        fprintf(stderr, "Error: Failed to change to directory %s\n", dir);
+        _exit(127);
+    }
+
+    if (log_path) {
+        int fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "Error: Failed to open log file %s\n", log_path);
+            _exit(127);
+        }
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+
+    execvp(argv[0], argv);
+    fprintf(stderr, "Error: Failed to run %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+}
+
+// Wait for a spawned command; returns its exit status, or 1 if it was
+// killed by a signal.
+int wait_command(pid_t pid) {
+    struct rusage usage;
+    int status;
+
+    if (pid < 0) return 1;
+
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) return 1;
+    }
+    trace_process_end(pid, &usage);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int run_command(char *const argv[], const char *dir) {
+    return wait_command(spawn_command(argv, dir, NULL));
+}
+
+// Run a command and collect its stdout; stderr is discarded. *output is
+// NUL-terminated and must be freed by the caller, even on failure.
+int run_capture(char *const argv[], const char *dir, char **output) {
+    int fds[2];
+    size_t size = 0, capacity = 4096;
+
+    *output = malloc(capacity);
+    if (*output == NULL) return 1;
+    (*output)[0] = '\0';
+
+    if (pipe(fds) != 0) return 1;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        if (dir && chdir(dir) != 0) _exit(127);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    trace_process_start(pid, argv, dir);
+    for (;;) {
+        if (size + 1 >= capacity) {
+            char *grown = realloc(*output, capacity * 2);
+            if (!grown) break;
+            *output = grown;
+            capacity *= 2;
+        }
+
+        ssize_t n = read(fds[0], *output + size, capacity - size - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        size += (size_t)n;
+    }
+    (*output)[size] = '\0';
+    close(fds[0]);
+
+    return wait_command(pid);
+}
+
+// Hard link src to dest, or copy it when they are on different file
+// systems. With sync the data is on disk before this returns.
+int copy_file(const char *src, const char *dest, int sync) {
+    char buffer[65536];
+    ssize_t n = 0;
+
+    if (link(src, dest) == 0) {
+        if (!sync) return 0;
+        int fd = open(dest, O_RDONLY);
+        int failed = fd < 0 || fsync(fd) != 0;
+        if (fd >= 0) close(fd);
+        return failed;
+    }
+
+    int in = open(src, O_RDONLY);
+    if (in < 0) return 1;
+
+    int out = open(dest, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out < 0) {
+        close(in);
+        return 1;
+    }
+
+    while ((n = read(in, buffer, sizeof(buffer))) > 0) {
+        if (write(out, buffer, (size_t)n) != n) {
+            n = -1;
+            break;
+        }
+    }
+
+    close(in);
+    if (n >= 0 && sync && fsync(out) != 0) n = -1;
+    if (close(out) != 0) n = -1;
+    return n < 0;
+}
+
+void free_string_list(char **list, int count) {
+    if (list == NULL) return;
+
+    for (int i = 0; i < count; i++) {
+        free(list[i]);
+    }
+
+    free(list);
+}
@@ -0,0 +1,18 @@
+#ifndef METHAUR_UTIL_H
+#define METHAUR_UTIL_H
+
+#include <sys/types.h>
+
+int mkdir_p(const char *path, mode_t mode);
+int find_program(const char *program);
+int require_sudo(void);
+
+pid_t spawn_command(char *const argv[], const char *dir, const char *log_path);
+int wait_command(pid_t pid);
+int run_command(char *const argv[], const char *dir);
+int run_capture(char *const argv[], const char *dir, char **output);
+int copy_file(const char *src, const char *dest, int sync);
+
+void free_string_list(char **list, int count);
+
+#endif
@@ -0,0 +1,500 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+#include "aur.h"
+#include "build.h"
+#include "config.h"
+#include "trace.h"
+#include "util.h"
+#include "vcs.h"
+
+#define VCS_LINE 4096
+#define VCS_REF_MAX 512
+#define VCS_REVISION_MAX 65
+#define VCS_POLL_MS 10            // pause between checks on running ls-remotes
+
+// pkgver() rewrites the version of VCS packages at build time, so their
+// AUR version says nothing about what upstream has
+int vcs_package(const char *pkgbase) {
+    static const char *suffixes[] = { "-git", "-svn", "-hg", "-bzr", "-fossil", "-darcs" };
+    size_t length = strlen(pkgbase);
+
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        size_t suffix_length = strlen(suffixes[i]);
+        if (length > suffix_length && strcmp(pkgbase + length - suffix_length, suffixes[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static void free_sources(VcsSource *sources, int count) {
+    for (int i = 0; i < count; i++) {
+        free(sources[i].package);
+        free(sources[i].url);
+        free(sources[i].ref);
+        free(sources[i].revision);
+        free(sources[i].clone);
+    }
+    free(sources);
+}
+
+static int add_source(VcsSource **sources, int *count, const char *package, const char *url,
+                      const char *ref, const char *revision) {
+    VcsSource *grown = realloc(*sources, (*count + 1) * sizeof(VcsSource));
+    if (!grown) return 1;
+    *sources = grown;
+
+    VcsSource *source = &grown[*count];
+    source->package = strdup(package);
+    source->url = strdup(url);
+    source->ref = strdup(ref);
+    source->revision = revision ? strdup(revision) : NULL;
+    source->clone = NULL;
+    (*count)++;
+
+    return !source->package || !source->url || !source->ref || (revision && !source->revision);
+}
+
+static void state_path(char *path, size_t size) {
+    snprintf(path, size, "%s/%s", config.cache_dir, VCS_STATE_FILE);
+}
+
+// One line per source: package, url, ref and revision, tab separated
+static int load_state(VcsSource **sources, int *count) {
+    char path[PATH_MAX + sizeof(VCS_STATE_FILE) + 1];
+    char line[VCS_LINE];
+
+    *sources = NULL;
+    *count = 0;
+
+    state_path(path, sizeof(path));
+    FILE *fp = fopen(path, "r");
+    if (!fp) return errno != ENOENT;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *saveptr = NULL;
+        char *package = strtok_r(line, "\t\n", &saveptr);
+        char *url = strtok_r(NULL, "\t\n", &saveptr);
+        char *ref = strtok_r(NULL, "\t\n", &saveptr);
+        char *revision = strtok_r(NULL, "\t\n", &saveptr);
+
+        if (revision && add_source(sources, count, package, url, ref, revision) != 0) {
+            fclose(fp);
+            return 1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static int save_state(const VcsSource *sources, int count) {
+    char path[PATH_MAX + sizeof(VCS_STATE_FILE) + 1];
+    char tmp_path[sizeof(path) + 4];
+
+    state_path(path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (mkdir_p(config.cache_dir, 0755) != 0) return 1;
+
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) {
+        fprintf(stderr, "Warning: Failed to write %s: %s\n", tmp_path, strerror(errno));
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (sources[i].revision == NULL) continue;
+        fprintf(fp, "%s\t%s\t%s\t%s\n", sources[i].package, sources[i].url, sources[i].ref, sources[i].revision);
+    }
+
+    if (fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Warning: Failed to write %s\n", path);
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+// Split a makepkg source entry, [dir::]git+url[#branch=|#tag=], into the
+// URL git understands, the ref to follow and the directory makepkg clones
+// it into. Returns non-zero for anything but an unpinned git source.
+static int parse_git_source(const char *entry, char *url, size_t url_size, char *ref, size_t ref_size,
+                            char *clone, size_t clone_size) {
+    const char *separator = strstr(entry, "::");
+    const char *location = separator ? separator + 2 : entry;
+
+    if (strncmp(location, "git+", 4) == 0) {
+        location += 4;
+    } else if (strncmp(location, "git://", 6) != 0) {
+        return 1;
+    }
+
+    size_t length = strcspn(location, "#");
+    const char *fragment = location[length] == '#' ? location + length + 1 : "";
+    if (length >= 7 && strncmp(location + length - 7, "?signed", 7) == 0) length -= 7;
+    if (length == 0 || length >= url_size) return 1;
+    snprintf(url, url_size, "%.*s", (int)length, location);
+
+    if (*fragment == '\0') {
+        snprintf(ref, ref_size, "HEAD");
+    } else if (strncmp(fragment, "branch=", 7) == 0) {
+        snprintf(ref, ref_size, "refs/heads/%s", fragment + 7);
+    } else if (strncmp(fragment, "tag=", 4) == 0) {
+        snprintf(ref, ref_size, "refs/tags/%s", fragment + 4);
+    } else {
+        return 1;               // commit= never moves
+    }
+
+    if (separator) {
+        snprintf(clone, clone_size, "%.*s", (int)(separator - entry), entry);
+    } else {
+        char name[PATH_MAX];
+        snprintf(name, sizeof(name), "%s", url);
+        size_t name_length = strlen(name);
+        while (name_length > 0 && name[name_length - 1] == '/') name[--name_length] = '\0';
+
+        char *base = strrchr(name, '/');
+        base = base ? base + 1 : name;
+        char *suffix = strstr(base, ".git");
+        if (suffix) *suffix = '\0';
+        snprintf(clone, clone_size, "%s", base);
+    }
+    return strchr(clone, '/') != NULL || *clone == '\0' || *clone == '.';
+}
+
+// The git sources (source and source_<arch>) of the recipe in the build
+// directory of pkgbase, recorded for package_name
+static int read_git_sources(const char *pkgbase, const char *package_name, VcsSource **sources, int *count) {
+    char dir[PATH_MAX];
+    char path[PATH_MAX + 16];
+    char line[VCS_LINE];
+    char arch_key[80];
+    char url[VCS_LINE], ref[VCS_REF_MAX], clone[PATH_MAX];
+    struct utsname uts;
+
+    if (package_build_dir(pkgbase, dir, sizeof(dir)) != 0) return 1;
+    snprintf(path, sizeof(path), "%s/.SRCINFO", dir);
+
+    if (uname(&uts) != 0) {
+        snprintf(uts.machine, sizeof(uts.machine), "x86_64");
+    }
+    snprintf(arch_key, sizeof(arch_key), "source_%s", uts.machine);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return 1;
+
+    int failed = 0;
+    while (!failed && fgets(line, sizeof(line), fp) != NULL) {
+        char *key = line;
+        while (isspace((unsigned char)*key)) key++;
+        if (strncmp(key, "pkgname = ", 10) == 0) break;
+
+        char *value = strstr(key, " = ");
+        if (value == NULL) continue;
+        *value = '\0';
+        value += 3;
+        value[strcspn(value, "\r\n")] = '\0';
+
+        if (strcmp(key, "source") != 0 && strcmp(key, arch_key) != 0) continue;
+        if (parse_git_source(value, url, sizeof(url), ref, sizeof(ref), clone, sizeof(clone)) != 0) continue;
+
+        failed = add_source(sources, count, package_name, url, ref, NULL) != 0 ||
+                 ((*sources)[*count - 1].clone = strdup(clone)) == NULL;
+    }
+
+    fclose(fp);
+    return failed;
+}
+
+// The line for ref in git ls-remote output: "<revision>\t<ref>"
+static int parse_ls_remote(const char *output, const char *ref, char *revision, size_t size) {
+    size_t ref_length = strlen(ref);
+
+    for (const char *line = output; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        const char *tab = strchr(line, '\t');
+        const char *end = line + strcspn(line, "\n");
+        if (tab == NULL || tab > end || tab - line >= (ptrdiff_t)size || tab - line < 40) continue;
+
+        if ((size_t)(end - tab - 1) == ref_length && strncmp(tab + 1, ref, ref_length) == 0) {
+            snprintf(revision, size, "%.*s", (int)(tab - line), line);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static pid_t start_ls_remote(const VcsSource *source, const char *log_path) {
+    char low_speed[64];
+
+    // Nobody is there to type a password for a repository that went away
+    setenv("GIT_TERMINAL_PROMPT", "0", 1);
+
+    snprintf(low_speed, sizeof(low_speed), "http.lowSpeedTime=%ld",
+             config.request_timeout > 0 ? config.request_timeout : (long)DEFAULT_REQUEST_TIMEOUT);
+    char *argv[] = { "git", "-c", "http.lowSpeedLimit=1", "-c", low_speed,
+                     "ls-remote", "--quiet", source->url, source->ref, NULL };
+    return spawn_command(argv, NULL, log_path);
+}
+
+static void ls_remote_log(char *path, size_t size, int index) {
+    snprintf(path, size, "%s.ls-remote-%d-%d", TMP_DIR, (int)getpid(), index);
+}
+
+// Run git ls-remote for every source, VCS_MAX_JOBS at a time. current[i]
+// receives the upstream revision of sources[i], or stays NULL when the
+// remote could not be asked.
+static void remote_revisions(const VcsSource *sources, int count, char **current) {
+    pid_t *pids = malloc(count * sizeof(pid_t));
+    char log_path[PATH_MAX];
+    int next = 0, running = 0;
+
+    if (!pids) return;
+    for (int i = 0; i < count; i++) pids[i] = -1;
+
+    while (next < count || running > 0) {
+        while (next < count && running < VCS_MAX_JOBS) {
+            ls_remote_log(log_path, sizeof(log_path), next);
+            pids[next] = start_ls_remote(&sources[next], log_path);
+            if (pids[next] > 0) {
+                trace_process_label(pids[next], "ls-remote", sources[next].package);
+                running++;
+            }
+            next++;
+        }
+        if (running == 0) break;
+
+        // Only our own children: this also runs while the build scheduler
+        // has makepkg processes of its own to reap
+        struct rusage usage;
+        int status;
+        int reaped = 0;
+        for (int i = 0; i < next; i++) {
+            if (pids[i] <= 0) continue;
+
+            pid_t pid = wait4(pids[i], &status, WNOHANG, &usage);
+            if (pid == 0 || (pid < 0 && errno == EINTR)) continue;
+            if (pid > 0) {
+                trace_process_end(pid, &usage);
+            } else {
+                status = -1;     // lost track of it; no answer
+            }
+
+            reaped = 1;
+            running--;
+            pids[i] = -1;
+            ls_remote_log(log_path, sizeof(log_path), i);
+
+            char revision[VCS_REVISION_MAX];
+            FILE *fp = fopen(log_path, "r");
+            if (fp && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+                char output[VCS_LINE * 4];
+                size_t n = fread(output, 1, sizeof(output) - 1, fp);
+                output[n] = '\0';
+                if (parse_ls_remote(output, sources[i].ref, revision, sizeof(revision)) == 0) {
+                    current[i] = strdup(revision);
+                }
+            }
+            if (fp) fclose(fp);
+            unlink(log_path);
+        }
+
+        if (!reaped) {
+            struct timespec pause = { 0, VCS_POLL_MS * 1000000L };
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    free(pids);
+}
+
+// What makepkg's clone of the source says the ref was when it built. A
+// tag reads as the tag object, like ls-remote shows it.
+static int local_revision(const char *dir, const char *clone, const char *ref, char *revision, size_t size) {
+    char repo[PATH_MAX];
+    char git_dir[PATH_MAX + 16];
+    struct stat st;
+    char *output = NULL;
+
+    if (snprintf(repo, sizeof(repo), "%s/%s", dir, clone) >= (int)sizeof(repo) ||
+        stat(repo, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return 1;
+    }
+
+    snprintf(git_dir, sizeof(git_dir), "--git-dir=%s", repo);
+    char *argv[] = { "git", git_dir, "rev-parse", "--verify", "--quiet", (char *)ref, NULL };
+    int status = run_capture(argv, NULL, &output);
+    if (status == 0 && output) {
+        output[strcspn(output, "\n")] = '\0';
+        snprintf(revision, size, "%s", output);
+    }
+    free(output);
+    return status != 0 || strlen(revision) < 40;
+}
+
+int vcs_record_build(const char *pkgbase, const char *package_name) {
+    VcsSource *state = NULL, *sources = NULL;
+    int state_count = 0, source_count = 0;
+    char dir[PATH_MAX];
+    const char *srcdest = getenv("SRCDEST");
+
+    if (!vcs_package(pkgbase)) return 0;
+    if (package_build_dir(pkgbase, dir, sizeof(dir)) != 0 ||
+        read_git_sources(pkgbase, package_name, &sources, &source_count) != 0 ||
+        load_state(&state, &state_count) != 0) {
+        free_sources(sources, source_count);
+        free_sources(state, state_count);
+        return 1;
+    }
+
+    // makepkg keeps its clones next to the PKGBUILD unless SRCDEST says
+    // otherwise. Without a clone nothing is recorded: upstream's tip now
+    // need not be what was built, and the next -Ufull records the package
+    // like one it has never seen.
+    for (int i = 0; i < source_count; i++) {
+        char revision[VCS_REVISION_MAX] = "";
+        if (local_revision(dir, sources[i].clone, sources[i].ref, revision, sizeof(revision)) == 0 ||
+            (srcdest && local_revision(srcdest, sources[i].clone, sources[i].ref, revision, sizeof(revision)) == 0)) {
+            sources[i].revision = strdup(revision);
+        }
+    }
+
+    // Replace what was recorded for the package
+    int kept = 0;
+    for (int i = 0; i < state_count; i++) {
+        if (strcmp(state[i].package, package_name) == 0) {
+            free(state[i].package);
+            free(state[i].url);
+            free(state[i].ref);
+            free(state[i].revision);
+            free(state[i].clone);
+        } else {
+            state[kept++] = state[i];
+        }
+    }
+    state_count = kept;
+
+    int failed = 0;
+    for (int i = 0; i < source_count && !failed; i++) {
+        if (sources[i].revision == NULL) continue;
+        failed = add_source(&state, &state_count, package_name, sources[i].url, sources[i].ref, sources[i].revision);
+    }
+    if (!failed) failed = save_state(state, state_count);
+
+    free_sources(sources, source_count);
+    free_sources(state, state_count);
+    return failed;
+}
+
+static int list_contains(char **list, int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(list[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+int vcs_check_updates(const char **names, int count, char ***changed, int *changed_count) {
+    VcsSource *state = NULL, *sources = NULL;
+    int state_count = 0, source_count = 0;
+    const char **unknown = malloc((count > 0 ? count : 1) * sizeof(char *));
+    int unknown_count = 0;
+    int failed = 0;
+
+    *changed = NULL;
+    *changed_count = 0;
+    if (!unknown) return 1;
+
+    if (load_state(&state, &state_count) != 0) {
+        fprintf(stderr, "Warning: Failed to read the recorded VCS revisions\n");
+    }
+
+    // The recorded sources of each package; records of packages that are
+    // no longer installed are dropped along the way
+    for (int i = 0; i < count && !failed; i++) {
+        int recorded = 0;
+        if (!vcs_package(names[i])) continue;
+
+        for (int j = 0; j < state_count && !failed; j++) {
+            if (strcmp(state[j].package, names[i]) != 0) continue;
+            failed = add_source(&sources, &source_count, state[j].package, state[j].url, state[j].ref, state[j].revision);
+            recorded = 1;
+        }
+        if (!recorded) unknown[unknown_count++] = names[i];
+    }
+    free_sources(state, state_count);
+
+    // A package without a record takes the sources of its current recipe,
+    // fetched once per pkgbase
+    if (!failed && unknown_count > 0) {
+        AurInfo *info = NULL;
+        int info_count = 0;
+        const char **bases = malloc(unknown_count * sizeof(char *));
+        int base_count = 0;
+
+        printf("Recording the upstream revisions of %d VCS package(s)...\n", unknown_count);
+        aur_info_query(unknown, unknown_count, &info, &info_count);
+        for (int i = 0; bases && i < unknown_count; i++) {
+            const AurInfo *remote = aur_info_find(info, info_count, unknown[i]);
+            if (remote && !list_contains((char **)bases, base_count, remote->package_base)) {
+                bases[base_count++] = remote->package_base;
+            }
+        }
+        if (bases) fetch_aur_sources(bases, base_count);
+
+        for (int i = 0; i < unknown_count; i++) {
+            const AurInfo *remote = aur_info_find(info, info_count, unknown[i]);
+            if (!bases || !remote || read_git_sources(remote->package_base, unknown[i], &sources, &source_count) != 0) {
+                fprintf(stderr, "Warning: No recipe for %s, its upstream is not checked\n", unknown[i]);
+            }
+        }
+        for (int i = 0; i < base_count; i++) {
+            clean_build_files(bases[i]);
+        }
+        free(bases);
+        free_aur_info(info, info_count);
+    }
+    free(unknown);
+
+    char **current = calloc(source_count > 0 ? source_count : 1, sizeof(char *));
+    if (failed || !current) {
+        free(current);
+        free_sources(sources, source_count);
+        return 1;
+    }
+
+    double start = trace_now();
+    remote_revisions(sources, source_count, current);
+    trace_end("phase", "vcs check", NULL, start);
+
+    for (int i = 0; i < source_count && !failed; i++) {
+        VcsSource *source = &sources[i];
+        if (current[i] == NULL) {
+            fprintf(stderr, "Warning: Could not check %s for new commits (%s)\n", source->package, source->url);
+        } else if (source->revision == NULL) {
+            source->revision = current[i];
+            current[i] = NULL;
+        } else if (strcmp(source->revision, current[i]) != 0 && !list_contains(*changed, *changed_count, source->package)) {
+            char **grown = realloc(*changed, (*changed_count + 1) * sizeof(char *));
+            failed = grown == NULL;
+            if (grown) {
+                *changed = grown;
+                grown[(*changed_count)++] = strdup(source->package);
+            }
+        }
+    }
+
+    // The changed ones keep their old revisions until they are rebuilt
+    if (!failed) save_state(sources, source_count);
+
+    free_string_list(current, source_count);
+    free_sources(sources, source_count);
+    return failed;
+}
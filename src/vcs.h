@@ -0,0 +1,31 @@
+#ifndef METHAUR_VCS_H
+#define METHAUR_VCS_H
+
+#define VCS_STATE_FILE "vcs"
+#define VCS_MAX_JOBS 16
+
+// One git source of an installed VCS package and the upstream revision
+// it was built from. ref is HEAD, refs/heads/<branch> or refs/tags/<tag>.
+typedef struct {
+    char *package;
+    char *url;
+    char *ref;
+    char *revision;          // NULL until known
+    char *clone;             // makepkg's clone directory, when read from a recipe
+} VcsSource;
+
+int vcs_package(const char *pkgbase);
+
+// Remember the revisions an installed package was just built from, read
+// from makepkg's clones in the build directory of its pkgbase (or
+// $SRCDEST). Sources without a clone are not recorded. Does nothing for
+// packages that are not VCS packages.
+int vcs_record_build(const char *pkgbase, const char *package_name);
+
+// Ask every upstream of the given VCS packages for its current revision,
+// all at once, and list the packages that moved since they were built.
+// Packages seen for the first time get their current revisions recorded
+// instead, as if they were up to date.
+int vcs_check_updates(const char **names, int count, char ***changed, int *changed_count);
+
+#endif
@@ -0,0 +1,166 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vercmp.h"
+
+// Split "epoch:version-release" in place. A missing epoch becomes "0" and
+// a missing release is returned as NULL.
+static void parse_evr(char *evr, const char **epoch, const char **version, const char **release) {
+    char *s = evr;
+    char *se;
+
+    while (*s && isdigit((unsigned char)*s)) s++;
+    se = strrchr(s, '-');
+
+    if (*s == ':') {
+        *epoch = evr;
+        *s++ = '\0';
+        *version = s;
+        if (**epoch == '\0') *epoch = "0";
+    } else {
+        *epoch = "0";
+        *version = evr;
+    }
+
+    if (se) {
+        *se++ = '\0';
+        *release = se;
+    } else {
+        *release = NULL;
+    }
+}
+
+// Segment-wise comparison used by rpm and pacman: runs of digits compare
+// numerically, runs of letters lexically, and a numeric segment is always
+// newer than an alphabetic one.
+static int rpmvercmp(const char *a, const char *b) {
+    if (strcmp(a, b) == 0) return 0;
+
+    char *str1 = strdup(a);
+    char *str2 = strdup(b);
+    if (!str1 || !str2) {
+        free(str1);
+        free(str2);
+        return strcmp(a, b) < 0 ? -1 : 1;
+    }
+
+    char *one = str1, *two = str2;
+    char *ptr1 = str1, *ptr2 = str2;
+    int ret = 0;
+
+    while (*one && *two) {
+        while (*one && !isalnum((unsigned char)*one)) one++;
+        while (*two && !isalnum((unsigned char)*two)) two++;
+
+        if (!*one || !*two) break;
+
+        // Different separator lengths decide the comparison on their own
+        if ((one - ptr1) != (two - ptr2)) {
+            ret = (one - ptr1) < (two - ptr2) ? -1 : 1;
+            goto cleanup;
+        }
+
+        ptr1 = one;
+        ptr2 = two;
+
+        int isnum;
+        if (isdigit((unsigned char)*ptr1)) {
+            while (*ptr1 && isdigit((unsigned char)*ptr1)) ptr1++;
+            while (*ptr2 && isdigit((unsigned char)*ptr2)) ptr2++;
+            isnum = 1;
+        } else {
+            while (*ptr1 && isalpha((unsigned char)*ptr1)) ptr1++;
+            while (*ptr2 && isalpha((unsigned char)*ptr2)) ptr2++;
+            isnum = 0;
+        }
+
+        char oldch1 = *ptr1;
+        *ptr1 = '\0';
+        char oldch2 = *ptr2;
+        *ptr2 = '\0';
+
+        if (one == ptr1) {
+            ret = -1;
+            goto cleanup;
+        }
+
+        // Segments of different types: numeric wins
+        if (two == ptr2) {
+            ret = isnum ? 1 : -1;
+            goto cleanup;
+        }
+
+        if (isnum) {
+            while (*one == '0') one++;
+            while (*two == '0') two++;
+
+            size_t len1 = strlen(one);
+            size_t len2 = strlen(two);
+            if (len1 != len2) {
+                ret = len1 > len2 ? 1 : -1;
+                goto cleanup;
+            }
+        }
+
+        int rc = strcmp(one, two);
+        if (rc) {
+            ret = rc < 1 ? -1 : 1;
+            goto cleanup;
+        }
+
+        *ptr1 = oldch1;
+        one = ptr1;
+        *ptr2 = oldch2;
+        two = ptr2;
+    }
+
+    if (!*one && !*two) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    // A trailing alpha segment never beats an empty one (1.0alpha < 1.0)
+    if ((!*one && !isalpha((unsigned char)*two)) || isalpha((unsigned char)*one)) {
+        ret = -1;
+    } else {
+        ret = 1;
+    }
+
+cleanup:
+    free(str1);
+    free(str2);
+    return ret;
+}
+
+int vercmp(const char *a, const char *b) {
+    if (!a && !b) return 0;
+    if (!a) return -1;
+    if (!b) return 1;
+    if (strcmp(a, b) == 0) return 0;
+
+    char *full1 = strdup(a);
+    char *full2 = strdup(b);
+    if (!full1 || !full2) {
+        free(full1);
+        free(full2);
+        return rpmvercmp(a, b);
+    }
+
+    const char *epoch1, *version1, *release1;
+    const char *epoch2, *version2, *release2;
+    parse_evr(full1, &epoch1, &version1, &release1);
+    parse_evr(full2, &epoch2, &version2, &release2);
+
+    int ret = rpmvercmp(epoch1, epoch2);
+    if (ret == 0) {
+        ret = rpmvercmp(version1, version2);
+        if (ret == 0 && release1 && release2) {
+            ret = rpmvercmp(release1, release2);
+        }
+    }
+
+    free(full1);
+    free(full2);
+    return ret;
+}
@@ -0,0 +1,8 @@
+#ifndef METHAUR_VERCMP_H
+#define METHAUR_VERCMP_H
+
+// Compare two [epoch:]pkgver[-pkgrel] strings exactly like pacman's
+// vercmp. Returns < 0 if a is older than b, 0 if equal, > 0 if newer.
+int vercmp(const char *a, const char *b);
+
+#endif